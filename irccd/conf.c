@@ -16,12 +16,14 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -33,6 +35,7 @@
 
 #include <utlist.h>
 
+#include <irccd/config.h>
 #include <irccd/hook.h>
 #include <irccd/irccd.h>
 #include <irccd/log.h>
@@ -42,8 +45,14 @@
 #include <irccd/util.h>
 
 #include "conf.h"
+#include "exporter.h"
+#include "peer.h"
 #include "transport.h"
 
+#ifdef IRCCD_WITH_JS
+#include "js-plugin.h"
+#endif
+
 #define CONF(Ptr, Field) \
         (IRC_UTIL_CONTAINER_OF(Ptr, struct conf, Field))
 
@@ -67,6 +76,7 @@ struct token {
 enum log_type {
 	LOG_TYPE_CONSOLE,
 	LOG_TYPE_FILE,
+	LOG_TYPE_JSON,
 	LOG_TYPE_SYSLOG
 };
 
@@ -91,11 +101,21 @@ struct conf {
 	long long tpt_uid;
 	long long tpt_gid;
 	char *tpt;
+	struct peer_limits tpt_limits;
+	int tpt_backlog;
+	size_t tpt_replay;
+
+	char *metrics;
+	int metrics_port;
 
 	enum log_type log_type;
 	int log_level;
 	char *log_template;
 	char *log_file;
+	size_t log_rotate_size;
+	unsigned int log_rotate_count;
+	int log_levels[IRC_LOG_SUBSYSTEM_NUM];
+	unsigned int log_samples[IRC_LOG_SUBSYSTEM_NUM];
 };
 
 IRC_ATTR_PRINTF(2, 3)
@@ -484,14 +504,83 @@ conf_end(struct conf *conf)
 
 /* {{{ log(s) */
 
+static inline void
+conf_parse_log_rotate(struct conf *conf)
+{
+	long long size, count;
+
+	size = conf_int(conf);
+	count = conf_int(conf);
+
+	if (size <= 0)
+		conf_fatal(conf, "invalid rotate size '%lld'", size);
+	if (count < 0 || count > 100)
+		conf_fatal(conf, "invalid rotate count '%lld'", count);
+
+	conf->log_rotate_size = size;
+	conf->log_rotate_count = count;
+}
+
+static size_t
+conf_parse_log_subsystem(struct conf *conf)
+{
+	const char *value, *name;
+	size_t sub;
+
+	value = conf_string(conf);
+
+	for (sub = 0; (name = irc_log_subsystem_name(sub)); ++sub)
+		if (strcmp(name, value) == 0)
+			return sub;
+
+	conf_fatal(conf, "invalid log subsystem '%s'", value);
+}
+
+static inline void
+conf_parse_log_level(struct conf *conf)
+{
+	const char *value, *name;
+	size_t sub, level;
+
+	sub = conf_parse_log_subsystem(conf);
+	value = conf_string(conf);
+
+	for (level = 0; (name = irc_log_level_name(level)); ++level)
+		if (strcmp(name, value) == 0)
+			break;
+
+	if (!name)
+		conf_fatal(conf, "invalid log level '%s'", value);
+
+	/* Stored shifted by one, zero means the verbosity applies. */
+	conf->log_levels[sub] = level + 1;
+}
+
+static inline void
+conf_parse_log_sample(struct conf *conf)
+{
+	long long rate;
+	size_t sub;
+
+	sub = conf_parse_log_subsystem(conf);
+	rate = conf_int(conf);
+
+	if (rate < 0 || rate > UINT_MAX)
+		conf_fatal(conf, "invalid sample rate '%lld'", rate);
+
+	conf->log_samples[sub] = rate;
+}
+
 /*
  * Logging section.
  *
- * log[s] [verbose] [template fmt] to (console|syslog|file path)
+ * log[s] [verbose] [template fmt] to (console|syslog|file path|json path) [{ options }]
  */
 static void
 conf_parse_log(struct conf *conf)
 {
+	struct token token;
+
 	/* verbose|quiet */
 	if (conf_string_is(conf, "verbose"))
 		conf->log_level = 1;
@@ -505,7 +594,7 @@ conf_parse_log(struct conf *conf)
 	/* Now 'to' keyword is to be expected. */
 	conf_keyword(conf, "to");
 
-	/* console|syslog|file path */
+	/* console|syslog|file path|json path */
 	if (conf_string_is(conf, "console")) {
 		conf->log_type = LOG_TYPE_CONSOLE;
 	} else if (conf_string_is(conf, "syslog")) {
@@ -513,23 +602,99 @@ conf_parse_log(struct conf *conf)
 	} else if (conf_string_is(conf, "file")) {
 		conf->log_type = LOG_TYPE_FILE;
 		conf->log_file = conf_string_new(conf);
+	} else if (conf_string_is(conf, "json")) {
+		conf->log_type = LOG_TYPE_JSON;
+		conf->log_file = conf_string_new(conf);
 	} else {
 		conf_fatal(conf, "invalid log sink");
 	}
+
+	if (conf_begin_is(conf)) {
+		while (conf_next_is(conf, &token, TOKEN_STRING)) {
+			conf_debug(conf, "log", "parsing '%s'", token.data);
+
+			if (CONF_EQ(token.data, "rotate") && conf->log_file)
+				conf_parse_log_rotate(conf);
+			else if (CONF_EQ(token.data, "level"))
+				conf_parse_log_level(conf);
+			else if (CONF_EQ(token.data, "sample"))
+				conf_parse_log_sample(conf);
+			else
+				conf_fatal(conf, "invalid log option '%s'", token.data);
+		}
+
+		conf_end(conf);
+	}
 }
 
 /* }}} */
 
 /* {{{ transport */
 
+static inline void
+conf_parse_transport_watermarks(struct conf *conf)
+{
+	long long high, low;
+
+	high = conf_int(conf);
+	low = conf_int(conf);
+
+	if (high < IRC_BUF_LEN || high > INT_MAX)
+		conf_fatal(conf, "invalid high watermark '%lld'", high);
+	if (low < 0 || low >= high)
+		conf_fatal(conf, "invalid low watermark '%lld'", low);
+
+	conf->tpt_limits.high = high;
+	conf->tpt_limits.low = low;
+}
+
+static inline void
+conf_parse_transport_backlog(struct conf *conf)
+{
+	long long backlog;
+
+	backlog = conf_int(conf);
+
+	if (backlog <= 0 || backlog > INT_MAX)
+		conf_fatal(conf, "invalid backlog '%lld'", backlog);
+
+	conf->tpt_backlog = backlog;
+}
+
+static inline void
+conf_parse_transport_replay(struct conf *conf)
+{
+	long long replay;
+
+	replay = conf_int(conf);
+
+	if (replay < 0)
+		conf_fatal(conf, "invalid replay '%lld'", replay);
+
+	conf->tpt_replay = replay;
+}
+
+static inline void
+conf_parse_transport_overflow(struct conf *conf)
+{
+	if (conf_string_is(conf, "drop"))
+		conf->tpt_limits.overflow = PEER_OVERFLOW_DROP;
+	else if (conf_string_is(conf, "disconnect"))
+		conf->tpt_limits.overflow = PEER_OVERFLOW_DISCONNECT;
+	else
+		conf_fatal(conf, "drop or disconnect expected");
+}
+
 /*
  * Transport section.
  *
- * transport [with uid value gid value] to path
+ * transport [with uid value gid value] to path [{ options }]
  */
 static void
 conf_parse_transport(struct conf *conf)
 {
+	struct token token;
+
 	if (conf->tpt)
 		conf_fatal(conf, "transport already defined");
 
@@ -543,6 +708,91 @@ conf_parse_transport(struct conf *conf)
 
 	conf_keyword(conf, "to");
 	conf->tpt = conf_string_new(conf);
+	conf->tpt_backlog = SOMAXCONN;
+	conf->tpt_limits.high = PEER_HIGH;
+	conf->tpt_limits.low = PEER_LOW;
+	conf->tpt_limits.overflow = PEER_OVERFLOW_DROP;
+
+	if (conf_begin_is(conf)) {
+		while (conf_next_is(conf, &token, TOKEN_STRING)) {
+			conf_debug(conf, "transport", "parsing '%s'", token.data);
+
+			if (CONF_EQ(token.data, "backlog"))
+				conf_parse_transport_backlog(conf);
+			else if (CONF_EQ(token.data, "watermarks"))
+				conf_parse_transport_watermarks(conf);
+			else if (CONF_EQ(token.data, "overflow"))
+				conf_parse_transport_overflow(conf);
+			else if (CONF_EQ(token.data, "replay"))
+				conf_parse_transport_replay(conf);
+			else
+				conf_fatal(conf, "invalid transport option '%s'", token.data);
+		}
+
+		conf_end(conf);
+	}
+}
+
+/* }}} */
+
+/* {{{ metrics */
+
+/*
+ * Metrics section.
+ *
+ * metrics to path
+ * metrics port number
+ */
+static void
+conf_parse_metrics(struct conf *conf)
+{
+	long long port;
+
+	if (conf->metrics || conf->metrics_port)
+		conf_fatal(conf, "metrics already defined");
+
+	if (conf_string_is(conf, "to"))
+		conf->metrics = conf_string_new(conf);
+	else if (conf_string_is(conf, "port")) {
+		port = conf_int(conf);
+
+		if (port <= 0 || port > 65535)
+			conf_fatal(conf, "invalid port number '%lld'", port);
+
+		conf->metrics_port = port;
+	} else
+		conf_fatal(conf, "to or port expected");
+}
+
+/* }}} */
+
+/* {{{ javascript */
+
+/*
+ * Javascript section, plugins are opened while parsing so it only applies to
+ * the plugins defined after.
+ *
+ * javascript (shared|isolated|threaded)
+ */
+static void
+conf_parse_javascript(struct conf *conf)
+{
+	int shared = 0, threaded = 0;
+
+	if (conf_string_is(conf, "shared"))
+		shared = 1;
+	else if (conf_string_is(conf, "threaded"))
+		threaded = 1;
+	else if (!conf_string_is(conf, "isolated"))
+		conf_fatal(conf, "shared, isolated or threaded expected");
+
+#ifdef IRCCD_WITH_JS
+	js_plugin_set_shared(shared);
+	js_plugin_set_threaded(threaded);
+#else
+	(void)shared;
+	(void)threaded;
+#endif
 }
 
 /* }}} */
@@ -854,6 +1104,91 @@ conf_parse_plugin_options(struct conf *conf,
  *     }
  * }
  */
+static inline void
+conf_parse_plugin_timeout(struct conf *conf, struct irc_plugin *plg)
+{
+	long long timeout;
+
+	timeout = conf_int(conf);
+
+	if (timeout < 0 || timeout > UINT_MAX)
+		conf_fatal(conf, "invalid timeout '%lld'", timeout);
+
+	plg->timeout = timeout;
+}
+
+static inline void
+conf_parse_plugin_strikes(struct conf *conf, struct irc_plugin *plg)
+{
+	long long strikes;
+
+	strikes = conf_int(conf);
+
+	if (strikes < 0 || strikes > UINT_MAX)
+		conf_fatal(conf, "invalid number of strikes '%lld'", strikes);
+
+	plg->strikes = strikes;
+}
+
+static inline void
+conf_parse_plugin_queue(struct conf *conf, struct irc_plugin *plg)
+{
+	long long max;
+
+	max = conf_int(conf);
+
+	if (max < 0)
+		conf_fatal(conf, "invalid queue size '%lld'", max);
+
+	plg->queue.max = max;
+
+	if (conf_string_is(conf, "drop-oldest"))
+		plg->queue.overflow = IRC_PLUGIN_OVERFLOW_DROP_OLDEST;
+	else if (conf_string_is(conf, "drop-type"))
+		plg->queue.overflow = IRC_PLUGIN_OVERFLOW_DROP_TYPE;
+	else if (conf_string_is(conf, "block"))
+		plg->queue.overflow = IRC_PLUGIN_OVERFLOW_BLOCK;
+}
+
+static inline void
+conf_parse_plugin_budget(struct conf *conf, struct irc_plugin *plg)
+{
+	long long budget;
+
+	budget = conf_int(conf);
+
+	if (budget < 0 || budget > UINT_MAX)
+		conf_fatal(conf, "invalid budget '%lld'", budget);
+
+	plg->queue.budget = budget;
+}
+
+static inline void
+conf_parse_plugin_memory(struct conf *conf, struct irc_plugin *plg)
+{
+	long long memory;
+
+	memory = conf_int(conf);
+
+	if (memory < 0)
+		conf_fatal(conf, "invalid memory limit '%lld'", memory);
+
+	plg->memory_limit = memory;
+}
+
+static inline void
+conf_parse_plugin_gc(struct conf *conf, struct irc_plugin *plg)
+{
+	long long gc;
+
+	gc = conf_int(conf);
+
+	if (gc < 0)
+		conf_fatal(conf, "invalid gc threshold '%lld'", gc);
+
+	plg->gc_threshold = gc;
+}
+
 static void
 conf_parse_plugin(struct conf *conf)
 {
@@ -880,7 +1215,21 @@ conf_parse_plugin(struct conf *conf)
 	if (conf_begin_is(conf)) {
 		while (conf_next_is(conf, &token, TOKEN_STRING)) {
 			conf_debug(conf, "plugin", "parsing '%s'", token.data);
-			conf_parse_plugin_options(conf, plg, token.data);
+
+			if (CONF_EQ(token.data, "timeout"))
+				conf_parse_plugin_timeout(conf, plg);
+			else if (CONF_EQ(token.data, "strikes"))
+				conf_parse_plugin_strikes(conf, plg);
+			else if (CONF_EQ(token.data, "queue"))
+				conf_parse_plugin_queue(conf, plg);
+			else if (CONF_EQ(token.data, "budget"))
+				conf_parse_plugin_budget(conf, plg);
+			else if (CONF_EQ(token.data, "memory"))
+				conf_parse_plugin_memory(conf, plg);
+			else if (CONF_EQ(token.data, "gc"))
+				conf_parse_plugin_gc(conf, plg);
+			else
+				conf_parse_plugin_options(conf, plg, token.data);
 		}
 
 		conf_end(conf);
@@ -911,6 +1260,10 @@ conf_parser_entry(struct nce_coro *self)
 			conf_parse_log(conf);
 		} else if (CONF_EQ(topic, "transport")) {
 			conf_parse_transport(conf);
+		} else if (CONF_EQ(topic, "metrics")) {
+			conf_parse_metrics(conf);
+		} else if (CONF_EQ(topic, "javascript")) {
+			conf_parse_javascript(conf);
 		} else if (CONF_EQ(topic, "hook")) {
 			conf_parse_hook(conf);
 		} else if (CONF_EQ(topic, "server")) {
@@ -935,8 +1288,14 @@ conf_apply_log(const struct conf *conf)
 		break;
 	case LOG_TYPE_FILE:
 		conf_debug(conf, "log", "verbose (%d) into file %s", conf->log_level, conf->log_file);
+		irc_log_set_rotate(conf->log_rotate_size, conf->log_rotate_count);
 		irc_log_to_file(conf->log_file);
 		break;
+	case LOG_TYPE_JSON:
+		conf_debug(conf, "log", "verbose (%d) into json %s", conf->log_level, conf->log_file);
+		irc_log_set_rotate(conf->log_rotate_size, conf->log_rotate_count);
+		irc_log_to_json(conf->log_file);
+		break;
 	case LOG_TYPE_SYSLOG:
 		conf_debug(conf, "log", "verbose (%d) into console", conf->log_level);
 		irc_log_to_syslog();
@@ -945,6 +1304,13 @@ conf_apply_log(const struct conf *conf)
 
 	irc_log_set_verbose(conf->log_level);
 	irc_log_set_template(conf->log_template);
+
+	for (size_t sub = 0; sub < IRC_LOG_SUBSYSTEM_NUM; ++sub) {
+		if (conf->log_levels[sub])
+			irc_log_set_level(sub, conf->log_levels[sub] - 1);
+		if (conf->log_samples[sub])
+			irc_log_set_sampling(sub, conf->log_samples[sub]);
+	}
 }
 
 static void
@@ -1006,12 +1372,23 @@ conf_apply_transport(struct conf *conf)
 	else
 		conf_debug(conf, "transport", "binding on '%s'", conf->tpt);
 
-	rc = transport_start(conf->tpt, conf->tpt_uid, conf->tpt_gid);
+	rc = transport_start(conf->tpt, conf->tpt_uid, conf->tpt_gid,
+	    conf->tpt_backlog, &conf->tpt_limits, conf->tpt_replay);
 
 	if (rc < 0)
 		irc_util_die("abort: %s: %s\n", conf->tpt, strerror(-rc));
 }
 
+static void
+conf_apply_metrics(struct conf *conf)
+{
+	if (!conf->metrics && !conf->metrics_port)
+		return;
+
+	if (exporter_start(conf->metrics, conf->metrics_port) < 0)
+		irc_util_die("abort: unable to start metrics endpoint\n");
+}
+
 void
 conf_open(const char *path)
 {
@@ -1065,9 +1442,11 @@ conf_open(const char *path)
 	conf_apply_plugins(&conf);
 	conf_apply_hooks(&conf);
 	conf_apply_transport(&conf);
+	conf_apply_metrics(&conf);
 
 	free(conf.log_file);
 	free(conf.log_template);
 	free(conf.tpt);
+	free(conf.metrics);
 	free(conf.text);
 }
@@ -130,6 +130,24 @@ metadata(struct self *self, const char *name)
 	return *addr;
 }
 
+/*
+ * Plugins without an event function don't need to be called at all, others
+ * may export an optional <prefix>_events mask to restrict the events they
+ * are interested in.
+ */
+static void
+subscribe(struct self *self)
+{
+	const unsigned int *events;
+
+	if (!dlsym(self->handle, symbol(self, "event")))
+		self->parent.events = 0;
+	else if ((events = dlsym(self->handle, symbol(self, "events"))))
+		self->parent.events = *events;
+	else
+		self->parent.events = IRC_PLUGIN_EVENT_ALL;
+}
+
 static void
 set_template(struct irc_plugin *plg, const char *key, const char *value)
 {
@@ -208,6 +226,7 @@ static void
 reload(struct irc_plugin *plg)
 {
 	INVOKE_NA_NR(plg, "reload", reload_fn);
+	subscribe(SELF(plg));
 }
 
 static void
@@ -216,10 +235,12 @@ unload(struct irc_plugin *plg)
 	INVOKE_NA_NR(plg, "unload", unload_fn);
 }
 
-static void
+static int
 handle(struct irc_plugin *plg, const struct irc_event *ev)
 {
 	INVOKE_NR(plg, "event", event_fn, ev);
+
+	return 0;
 }
 
 static void
@@ -324,6 +345,8 @@ dl_plugin_open(const char *name, const char *path)
 	    metadata(self, "license")
 	);
 
+	subscribe(self);
+
 	return &self->parent;
 }
 
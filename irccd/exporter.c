@@ -0,0 +1,268 @@
+/*
+ * exporter.c -- metrics over HTTP
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utlist.h>
+
+#include <nce/io.h>
+#include <nce/stream.h>
+
+#include <irccd/log.h>
+#include <irccd/metrics.h>
+#include <irccd/util.h>
+
+#include "exporter.h"
+
+#define CLIENT(Ptr, Field) \
+        (IRC_UTIL_CONTAINER_OF(Ptr, struct client, Field))
+
+/*
+ * Request headers are read but ignored, they are never expected to be larger.
+ */
+#define CLIENT_IN 4096
+#define CLIENT_OUT 16384
+
+struct client {
+	struct nce_stream_coro stream;
+	struct client *prev;
+	struct client *next;
+};
+
+static union {
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+} addr;
+
+static int fd = -1;
+static struct nce_io_coro fd_co;
+static struct client *clients;
+
+/*
+ * Build the whole response, metrics are collected at the time of the request.
+ */
+static char *
+response(const char *request, size_t *len)
+{
+	char *body = NULL, *out = NULL;
+	size_t bodysz = 0;
+	FILE *fp;
+
+	if (!(fp = open_memstream(&body, &bodysz)))
+		return NULL;
+
+	if (strncmp(request, "GET ", 4) == 0)
+		irc_metrics_dump(fp, IRC_METRICS_FORMAT_PROMETHEUS);
+
+	fclose(fp);
+
+	if (!(fp = open_memstream(&out, len))) {
+		free(body);
+		return NULL;
+	}
+
+	if (strncmp(request, "GET ", 4) == 0)
+		fprintf(fp, "HTTP/1.0 200 OK\r\n"
+		    "Content-Type: text/plain; version=0.0.4\r\n");
+	else
+		fprintf(fp, "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\n");
+
+	fprintf(fp, "Content-Length: %zu\r\nConnection: close\r\n\r\n", bodysz);
+	fwrite(body, 1, bodysz, fp);
+	fclose(fp);
+	free(body);
+
+	return out;
+}
+
+static void
+client_entry(struct nce_coro *self)
+{
+	struct client *clt = CLIENT(self, stream.coro);
+	struct nce_stream *stream = &clt->stream.stream;
+	char *out;
+	size_t len, off = 0;
+	ssize_t rc;
+
+	/* Wait for the end of headers, a request never has a body. */
+	while (!memmem(stream->in, stream->in_len, "\r\n\r\n", 4)) {
+		if (stream->in_len == stream->in_cap || nce_stream_wait(stream) < 0)
+			goto end;
+	}
+
+	/* The input buffer is large enough to hold the terminator. */
+	stream->in[stream->in_len - 1] = '\0';
+
+	if (!(out = response((const char *)stream->in, &len)))
+		goto end;
+
+	while (off < len) {
+		if ((rc = nce_stream_write(stream, out + off, len - off)) < 0 ||
+		    nce_stream_flush(stream) < 0)
+			break;
+
+		off += rc;
+	}
+
+	free(out);
+
+end:
+	nce_stream_stop(stream);
+}
+
+static void
+client_finalizer(struct nce_coro *self)
+{
+	struct client *clt = CLIENT(self, stream.coro);
+
+	DL_DELETE(clients, clt);
+	free(clt);
+}
+
+static void
+client_new(int sockfd)
+{
+	struct client *clt;
+	int flags, rc;
+
+	if ((flags = fcntl(sockfd, F_GETFL)) < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		irc_log_warn("exporter: fcntl: %s", strerror(errno));
+		close(sockfd);
+		return;
+	}
+
+	clt = irc_util_calloc(1, sizeof (*clt));
+	clt->stream.coro.name = "exporter.client";
+	clt->stream.coro.entry = client_entry;
+	clt->stream.coro.terminate = nce_stream_coro_terminate;
+	clt->stream.coro.finalizer = client_finalizer;
+	clt->stream.stream.ops = &nce_stream_ops_socket;
+	clt->stream.stream.fd = sockfd;
+	clt->stream.stream.in_cap = CLIENT_IN;
+	clt->stream.stream.out_cap = CLIENT_OUT;
+	clt->stream.stream.close = 1;
+
+	DL_APPEND(clients, clt);
+
+	if ((rc = nce_stream_coro_spawn(&clt->stream)) < 0)
+		irc_util_die("exporter: %s\n", strerror(-rc));
+}
+
+static void
+exporter_entry(struct nce_coro *)
+{
+	int clt;
+
+	while (nce_io_wait(&fd_co.io))
+		while ((clt = accept(fd, NULL, 0)) >= 0)
+			client_new(clt);
+}
+
+int
+exporter_start(const char *path, int port)
+{
+	const struct sockaddr *sa;
+	socklen_t salen;
+	int flags, reuse = 1;
+
+	if (path) {
+		addr.un.sun_family = AF_UNIX;
+
+		if (irc_util_strlcpy(addr.un.sun_path, path, sizeof (addr.un.sun_path)) >= sizeof (addr.un.sun_path)) {
+			errno = ENAMETOOLONG;
+			goto err;
+		}
+
+		/* Silently remove the file first. */
+		unlink(path);
+
+		sa = (const struct sockaddr *)&addr.un;
+		salen = sizeof (addr.un);
+	} else {
+		/* Never expose metrics outside of the host. */
+		addr.in.sin_family = AF_INET;
+		addr.in.sin_port = htons(port);
+		addr.in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		sa = (const struct sockaddr *)&addr.in;
+		salen = sizeof (addr.in);
+	}
+
+	if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) < 0)
+		goto err;
+	if (!path && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse)) < 0)
+		goto err;
+	if (bind(fd, sa, salen) < 0 || listen(fd, 16) < 0)
+		goto err;
+	if ((flags = fcntl(fd, F_GETFL)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		goto err;
+
+	if (path)
+		irc_log_info("exporter: listening on %s", path);
+	else
+		irc_log_info("exporter: listening on 127.0.0.1:%d", port);
+
+	fd_co.coro.name = "exporter.entry";
+	fd_co.coro.entry = exporter_entry;
+	nce_io_coro_spawn(&fd_co, fd, EV_READ);
+
+	return 0;
+
+err:
+	if (path)
+		irc_log_warn("exporter: %s: %s", path, strerror(errno));
+	else
+		irc_log_warn("exporter: port %d: %s", port, strerror(errno));
+
+	if (fd != -1) {
+		close(fd);
+		fd = -1;
+	}
+
+	return -1;
+}
+
+void
+exporter_stop(void)
+{
+	struct client *clt, *tmp;
+
+	if (fd == -1)
+		return;
+
+	nce_coro_destroy(&fd_co.coro);
+	close(fd);
+	fd = -1;
+
+	if (addr.un.sun_family == AF_UNIX)
+		unlink(addr.un.sun_path);
+
+	/* The finalizer releases the client. */
+	DL_FOREACH_SAFE(clients, clt, tmp)
+		nce_stream_coro_destroy(&clt->stream);
+}
@@ -0,0 +1,47 @@
+/*
+ * exporter.h -- metrics over HTTP
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IRCCD_EXPORTER_H
+#define IRCCD_EXPORTER_H
+
+/**
+ * \file exporter.h
+ * \brief Metrics over HTTP.
+ *
+ * Minimal HTTP/1.0 endpoint answering every GET request with the registered
+ * metrics in the Prometheus text format.
+ */
+
+/**
+ * Open the endpoint either on a unix socket or on the loopback interface.
+ *
+ * \param path path to the unix socket (or NULL to use port)
+ * \param port the TCP port bound on 127.0.0.1 if path is NULL
+ * \return 0 on success
+ * \return -1 on error
+ */
+int
+exporter_start(const char *path, int port);
+
+/**
+ * Close the endpoint and all pending clients.
+ */
+void
+exporter_stop(void);
+
+#endif /* !IRCCD_EXPORTER_H */
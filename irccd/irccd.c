@@ -37,25 +37,18 @@
 
 #include "conf.h"
 #include "dl-plugin.h"
+#include "exporter.h"
 #include "transport.h"
 
 #ifdef IRCCD_WITH_JS
 #       include "js-plugin.h"
 #endif
 
+static struct ev_signal sig_hup;
 static struct ev_signal sig_int;
 static struct ev_signal sig_term;
 static const char *config = IRCCD_SYSCONFDIR "/irccd.conf";
 
-static void
-broadcaster(const struct irc_event *ev)
-{
-	char buf[IRC_BUF_LEN] = {};
-
-	if (irc_event_str(ev, buf, sizeof (buf)) == 0)
-		transport_broadcast(buf);
-}
-
 static void
 run_info(void)
 {
@@ -145,19 +138,29 @@ sig_cb(struct ev_signal *self, int)
 	nce_sched_break(NULL, EVBREAK_ALL);
 }
 
+static void
+sig_hup_cb(struct ev_signal *, int)
+{
+	irc_log_info("irccd: reopening log file");
+	irc_log_reopen();
+}
+
 static void
 init(void)
 {
 	irc_bot_init();
-	irc_bot_observe(broadcaster);
+	irc_bot_observe(transport_broadcast);
 	irc_bot_plugin_loader_add(dl_plugin_loader_new());
 
 #ifdef IRCCD_WITH_JS
+	js_plugin_set_cache(IRCCD_CACHEDIR "/js");
 	irc_bot_plugin_loader_add(js_plugin_loader_new());
 #endif
 
+	ev_signal_init(&sig_hup, sig_hup_cb, SIGHUP);
 	ev_signal_init(&sig_int, sig_cb, SIGINT);
 	ev_signal_init(&sig_term, sig_cb, SIGTERM);
+	ev_signal_start(&sig_hup);
 	ev_signal_start(&sig_int);
 	ev_signal_start(&sig_term);
 }
@@ -171,8 +174,10 @@ load(void)
 static inline void
 finish(void)
 {
+	exporter_stop();
 	transport_stop();
 	irc_bot_finish();
+	irc_log_finish();
 }
 
 _Noreturn static void
@@ -21,14 +21,25 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <ev.h>
+#include <utlist.h>
+
 #include <irccd/channel.h>
 #include <irccd/config.h>
 #include <irccd/event.h>
+#include <irccd/irccd.h>
 #include <irccd/log.h>
+#include <irccd/metrics.h>
 #include <irccd/plugin.h>
 #include <irccd/server.h>
 #include <irccd/util.h>
@@ -52,9 +63,170 @@
 #define LDR_PATHS       IRCCD_LIBDIR "/irccd"
 #define LDR_EXTENSIONS  "js"
 
+/* Event functions resolved by subscribe, in the global stash. */
+#define HANDLERS        DUK_HIDDEN_SYMBOL("Irccd.handlers")
+
+/*
+ * Allocations up to POOL_GRANULE * POOL_CLASSES bytes are served from slabs
+ * of POOL_SLAB bytes, each slab holds blocks of a single size class. Slabs
+ * are carved from arenas of POOL_ARENA slabs. Larger allocations are prefixed
+ * with their size in POOL_HEADER bytes.
+ */
+#define POOL_GRANULE    16
+#define POOL_CLASSES    16
+#define POOL_SLAB       1024
+#define POOL_ARENA      64
+#define POOL_HEADER     8
+
+/* Events queued for a threaded plugin, must be a power of two. */
+#define THREAD_RING     1024
+
+/* Native function called through marshal, see js_plugin_push_c_function. */
+#define MARSHAL         DUK_HIDDEN_SYMBOL("Irccd.marshal")
+
+/* Bump if the layout of the cached files changes. */
+#define CACHE_MAGIC     "IRB2"
+
 #define SELF(Plg)                                                       \
 	IRC_UTIL_CONTAINER_OF(Plg, struct self, parent)
 
+/*
+ * Free blocks of a slab are linked in place.
+ */
+struct block {
+	struct block *next;
+};
+
+/*
+ * Duktape makes many small allocations of similar sizes, they are recycled
+ * within their heap rather than going back and forth to the libc allocator.
+ * Only slabs with free blocks are linked in the pool, a slab is released once
+ * all of its blocks are free unless it is the last one of its class.
+ *
+ * Slabs are aligned on their size so that the slab of a block is found from
+ * its address, blocks don't carry any header. Pooled blocks are aligned on
+ * POOL_GRANULE bytes while the larger allocations are always POOL_HEADER
+ * bytes past it, which tells them apart.
+ */
+struct slab {
+	struct block *free;
+	size_t size;                    /* of its blocks */
+	unsigned int used;
+	unsigned int capacity;
+	struct arena *arena;
+	struct slab *prev;
+	struct slab *next;
+};
+
+/*
+ * Aligning every slab on its own with the libc allocator wastes about as much
+ * memory as it returns, they are taken from larger aligned arenas instead.
+ * Slabs are carved as needed and the free ones are kept spare for any class,
+ * an arena is released once none of its slabs is used unless it is the last.
+ */
+struct arena {
+	char *base;
+	unsigned int carved;            /* slabs carved so far */
+	unsigned int used;              /* slabs given to a class */
+	struct arena *prev;
+	struct arena *next;
+};
+
+struct pool {
+	struct slab *slabs[POOL_CLASSES];
+	struct slab *spare;
+	struct arena *arenas;
+};
+
+/*
+ * Garbage collection of a heap once enough was allocated, deferred until the
+ * loop has nothing else to do so that it does not happen within a call.
+ */
+struct collector {
+	size_t allocated;               /* bytes allocated since the last run */
+	struct ev_idle idle;
+	struct irc_metric runs;
+	struct irc_metric time;         /* in microseconds */
+};
+
+/*
+ * Memory accounting of a threaded plugin, updated by the thread holding the
+ * heap and published to the plugin by the main thread. The peak and failures
+ * are reset once published.
+ */
+struct usage {
+	size_t memory;
+	size_t peak;
+	unsigned long long failures;
+};
+
+/*
+ * Event given to a threaded plugin, given back once handled with the result
+ * of the call.
+ */
+struct job {
+	struct irc_event ev;
+	int rc;
+	unsigned long long duration;    /* in microseconds */
+	struct usage usage;
+	int collected;                  /* garbage collected afterwards */
+	unsigned long long collect_time;
+};
+
+/*
+ * Jobs exchanged with a threaded plugin, single producer and single consumer.
+ * The main thread never has more jobs pending than a ring holds so pushing
+ * never fails.
+ */
+struct ring {
+	struct job *jobs[THREAD_RING];
+	atomic_size_t head;             /* producer only */
+	atomic_size_t tail;             /* consumer only */
+};
+
+/*
+ * Function the plugin thread needs the main thread to run.
+ */
+struct call {
+	void (*fn)(void *);
+	void *data;
+	int refused;                    /* plugin removed meanwhile */
+};
+
+/*
+ * Thread running a plugin in threaded mode, it owns the heap while it handles
+ * events. Everything the plugin does outside of its heap is run by the main
+ * thread while the plugin thread waits (see thread_call) and the main thread
+ * borrows the heap when it needs it (see thread_acquire).
+ */
+struct thread {
+	struct self *self;
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct call *call;              /* waiting for the main thread */
+	int busy;                       /* handling jobs */
+	atomic_int borrowed;            /* heap wanted by the main thread */
+	atomic_int stop;
+	atomic_int idle;                /* waiting for jobs */
+	atomic_int signaled;            /* main thread notified */
+
+	/* Main thread only. */
+	int started;
+	int serving;                    /* running a call */
+	unsigned int held;              /* nested borrows of the heap */
+	size_t queued;                  /* jobs not given back yet */
+	int fds[2];                     /* plugin thread notifications */
+	struct ev_io io;
+	struct ev_timer reaper;         /* deferred destruction */
+
+	/* Owned by the thread holding the heap. */
+	struct usage usage;
+
+	struct ring todo;
+	struct ring done;
+};
+
 struct self {
 	struct irc_plugin parent;
 	duk_context *ctx;
@@ -62,8 +234,344 @@ struct self {
 	char **options;
 	char **templates;
 	char **paths;
+
+	/* Execution time budget. */
+	unsigned long long deadline;    /* monotonic time in ms, 0 if none */
+	unsigned int depth;             /* nested calls into the plugin */
+	unsigned int strikes;           /* aborted calls since loaded */
+	struct ev_timer unloader;       /* deferred removal on too many strikes */
+
+	/* Bytes allocated by the Javascript heap. */
+	struct irc_metric heap;
+	struct pool pool;
+	struct collector gc;
+
+	/* Global environment within the shared heap. */
+	unsigned int shared;            /* ctx is a thread of the shared heap */
+	struct self *prev;              /* plugin running before this one */
+
+	/* Event functions resolved on load/reload, kept alive in the stash. */
+	void *handlers[IRC_EVENT_NUM];
+
+	/* Own thread in threaded mode, NULL otherwise. */
+	struct thread *thread;
+	char *value;                    /* copy of the last value returned */
+};
+
+/*
+ * Heap shared by every plugin opened in shared mode, each plugin runs in its
+ * own thread with a new global environment so that plugins can't see each
+ * other. The heap udata is NULL, the running plugin is tracked instead.
+ */
+static struct {
+	int enabled;
+	duk_context *ctx;
+	struct self *current;
+	unsigned int refs;
+	struct irc_metric heap;
+	struct pool pool;
+	struct collector gc;
+} shared = {
+	.heap = {
+		.name = "irccd_js_heap_bytes",
+		.help = "Bytes allocated by the Javascript heap.",
+		.type = IRC_METRIC_GAUGE,
+		.label = "plugin",
+		.label_value = "(shared)"
+	}
 };
 
+/* Plugins opened from now on run on their own thread. */
+static int threaded;
+
+/* Plugin of the current thread, NULL on the main thread. */
+static _Thread_local struct self *running;
+
+static unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static unsigned long long
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+ring_push(struct ring *r, struct job *job)
+{
+	size_t head;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	r->jobs[head & (THREAD_RING - 1)] = job;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static struct job *
+ring_pop(struct ring *r)
+{
+	struct job *job;
+	size_t tail;
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	if (atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+		return NULL;
+
+	job = r->jobs[tail & (THREAD_RING - 1)];
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+
+	return job;
+}
+
+static inline int
+ring_empty(struct ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) ==
+	    atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+/*
+ * Wake up the main thread, once until it reads the pipe. A full pipe already
+ * wakes it up.
+ */
+static void
+thread_notify(struct thread *t)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_exchange(&t->signaled, 1))
+		return;
+
+	while (write(t->fds[1], "", 1) < 0 && errno == EINTR)
+		continue;
+}
+
+/*
+ * Run fn on the main thread and wait for it, the heap is held by the main
+ * thread meanwhile. Called from the plugin thread with its heap, returns -1 if
+ * the plugin was removed, fn is not called then.
+ */
+static int
+thread_call(struct thread *t, void (*fn)(void *), void *data)
+{
+	struct call call = {
+		.fn = fn,
+		.data = data
+	};
+
+	pthread_mutex_lock(&t->mtx);
+	t->call = &call;
+	pthread_cond_broadcast(&t->cond);
+	thread_notify(t);
+
+	while (t->call)
+		pthread_cond_wait(&t->cond, &t->mtx);
+
+	pthread_mutex_unlock(&t->mtx);
+
+	return call.refused ? -1 : 0;
+}
+
+/*
+ * Run the call the plugin thread is waiting for, if any. Called from the main
+ * thread with the mutex locked. Once stopping, the plugin may already be
+ * destroyed by the bot and the call is refused.
+ */
+static void
+thread_serve(struct thread *t)
+{
+	struct call *call;
+
+	if (!(call = t->call))
+		return;
+
+	t->serving = 1;
+	pthread_mutex_unlock(&t->mtx);
+
+	if (atomic_load(&t->stop))
+		call->refused = 1;
+	else
+		call->fn(call->data);
+
+	pthread_mutex_lock(&t->mtx);
+	t->serving = 0;
+	t->call = NULL;
+	pthread_cond_broadcast(&t->cond);
+}
+
+/*
+ * Run fn on the main thread, which is not thread safe: the loop, the logs and
+ * the bot itself.
+ */
+static int
+main_call(void (*fn)(void *), void *data)
+{
+	if (running)
+		return thread_call(running->thread, fn, data);
+
+	fn(data);
+
+	return 0;
+}
+
+/*
+ * Update the plugin with the memory usage of its heap.
+ */
+static void
+heap_publish(struct self *self, const struct usage *usage)
+{
+	struct irc_plugin *plg = &self->parent;
+
+	plg->memory = usage->memory;
+	plg->memory_failures += usage->failures;
+
+	if (usage->peak > plg->memory_peak)
+		plg->memory_peak = usage->peak;
+
+	irc_metric_set(&self->heap, plg->memory);
+}
+
+static void
+job_free(struct job *job)
+{
+	if (job->ev.server)
+		irc_server_decref(job->ev.server);
+
+	irc_event_finish(&job->ev);
+	free(job);
+}
+
+/*
+ * Record the events handled by the plugin thread.
+ */
+static void
+thread_drain(struct self *self)
+{
+	struct thread *t = self->thread;
+	struct job *job;
+
+	while ((job = ring_pop(&t->done))) {
+		irc_plugin_stats_record(&self->parent.stats[job->ev.type],
+		    job->duration, job->rc < 0);
+
+		heap_publish(self, &job->usage);
+
+		if (job->collected) {
+			irc_metric_inc(&self->gc.runs);
+			irc_metric_add(&self->gc.time, job->collect_time);
+		}
+
+		job_free(job);
+		t->queued--;
+	}
+}
+
+/*
+ * Take the heap of a threaded plugin from the main thread, waiting for the
+ * plugin thread to finish the event it is handling. Calls may be nested.
+ */
+static void
+thread_acquire(struct thread *t)
+{
+	/* Already ours, the plugin thread is waiting for us otherwise. */
+	if (t->held++ || t->serving)
+		return;
+
+	pthread_mutex_lock(&t->mtx);
+	atomic_store(&t->borrowed, 1);
+
+	/* It may need us to finish its event. */
+	while (t->busy) {
+		if (t->call)
+			thread_serve(t);
+		else
+			pthread_cond_wait(&t->cond, &t->mtx);
+	}
+
+	pthread_mutex_unlock(&t->mtx);
+}
+
+static void
+thread_release(struct thread *t)
+{
+	assert(t->held);
+
+	if (--t->held || t->serving)
+		return;
+
+	/* Events handled before are older. */
+	thread_drain(t->self);
+	heap_publish(t->self, &t->usage);
+	t->usage.peak = t->usage.memory;
+	t->usage.failures = 0;
+
+	pthread_mutex_lock(&t->mtx);
+	atomic_store(&t->borrowed, 0);
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->mtx);
+}
+
+static inline void
+heap_acquire(struct self *self)
+{
+	if (self->thread)
+		thread_acquire(self->thread);
+}
+
+static inline void
+heap_release(struct self *self)
+{
+	if (self->thread)
+		thread_release(self->thread);
+}
+
+static void
+unloader_cb(struct ev_timer *w, int)
+{
+	struct self *self;
+
+	self = IRC_UTIL_CONTAINER_OF(w, struct self, unloader);
+	irc_bot_plugin_remove(self->parent.name);
+}
+
+/*
+ * Called when a call into the plugin was aborted because of its deadline. We
+ * can't remove the plugin here as we are still within its own heap, use a
+ * timer to do it from the event loop instead.
+ */
+static void
+timeout_run(void *data)
+{
+	struct self *self = data;
+
+	self->parent.timeouts++;
+
+	irc_log_warn("plugin %s: call aborted after %u ms", self->parent.name,
+	    self->parent.timeout);
+
+	if (self->parent.strikes && ++self->strikes >= self->parent.strikes) {
+		irc_log_warn("plugin %s: too many timeouts, unloading", self->parent.name);
+		ev_timer_start(&self->unloader);
+	}
+}
+
+static inline void
+timeout(struct self *self)
+{
+	main_call(timeout_run, self);
+}
+
 static void
 freelist(char **table)
 {
@@ -151,44 +659,62 @@ push_whois(duk_context *ctx, const struct irc_event *ev)
 	duk_put_prop_string(ctx, -2, "channels");
 }
 
+struct trace {
+	struct self *self;
+	char *stack;
+	int linenumber;
+};
+
+static void
+log_trace_run(void *data)
+{
+	struct trace *trace = data;
+	const char *name = trace->self->parent.name;
+	char *token, *p;
+
+	irc_log_warn("plugin %s: %s:%d", name, trace->self->location, trace->linenumber);
+
+	/* We can't put a '\n' in irc_log_warn so loop for them. */
+	for (p = trace->stack; *trace->stack && (token = strtok_r(p, "\n", &p)); )
+		irc_log_warn("plugin %s: %s", name, token);
+}
+
 static void
 log_trace(struct self *self)
 {
-	char *stack, *token, *p;
-	int linenumber;
+	struct trace trace = {
+		.self = self
+	};
 
 	duk_get_prop_string(self->ctx, -1, "stack");
-	stack = strdup(duk_opt_string(self->ctx, -1, ""));
+	trace.stack = irc_util_strdup(duk_opt_string(self->ctx, -1, ""));
 	duk_pop(self->ctx);
 	duk_get_prop_string(self->ctx, -1, "lineNumber");
-	linenumber = duk_get_int(self->ctx, -1);
+	trace.linenumber = duk_get_int(self->ctx, -1);
 	duk_pop(self->ctx);
 
-	irc_log_warn("plugin %s: %s:%d", self->parent.name, self->location, linenumber);
-
-	/* We can't put a '\n' in irc_log_warn so loop for them. */
-	for (p = stack; *stack && (token = strtok_r(p, "\n", &p)); )
-		irc_log_warn("plugin %s: %s", self->parent.name, token);
-
-	free(stack);
+	main_call(log_trace_run, &trace);
+	free(trace.stack);
 }
 
 static const char * const *
-get_table(duk_context *ctx, const char *name, char ***ptable)
+get_table(struct self *self, const char *name, char ***ptable)
 {
 	char **list = NULL;
 	size_t listsz = 0;
 
-	duk_get_global_string(ctx, name);
-	duk_enum(ctx, -1, 0);
+	heap_acquire(self);
+	duk_get_global_string(self->ctx, name);
+	duk_enum(self->ctx, -1, 0);
 
-	for (size_t i = 0; duk_next(ctx, -1, 1); ++i) {
+	for (size_t i = 0; duk_next(self->ctx, -1, 1); ++i) {
 		list = irc_util_reallocarray(list, ++listsz, sizeof (char *));
-		list[i] = irc_util_strdup(duk_to_string(ctx, -2));
-		duk_pop_n(ctx, 2);
+		list[i] = irc_util_strdup(duk_to_string(self->ctx, -2));
+		duk_pop_n(self->ctx, 2);
 	}
 
-	duk_pop_n(ctx, 2);
+	duk_pop_n(self->ctx, 2);
+	heap_release(self);
 
 	/* Add a NULL sentinel value. */
 	list = irc_util_reallocarray(list, listsz + 1, sizeof (char *));
@@ -201,23 +727,34 @@ get_table(duk_context *ctx, const char *name, char ***ptable)
 }
 
 static void
-set_key_value(duk_context *ctx, const char *table, const char *key, const char *value)
+set_key_value(struct self *self, const char *table, const char *key, const char *value)
 {
-	duk_get_global_string(ctx, table);
-	duk_push_string(ctx, value);
-	duk_put_prop_string(ctx, -2, key);
-	duk_pop(ctx);
+	heap_acquire(self);
+	duk_get_global_string(self->ctx, table);
+	duk_push_string(self->ctx, value);
+	duk_put_prop_string(self->ctx, -2, key);
+	duk_pop(self->ctx);
+	heap_release(self);
 }
 
 static const char *
-get_value(duk_context *ctx, const char *table, const char *key)
+get_value(struct self *self, const char *table, const char *key)
 {
 	const char *ret;
 
-	duk_get_global_string(ctx, table);
-	duk_get_prop_string(ctx, -1, key);
-	ret = duk_to_string(ctx, -1);
-	duk_pop_n(ctx, 2);
+	heap_acquire(self);
+	duk_get_global_string(self->ctx, table);
+	duk_get_prop_string(self->ctx, -1, key);
+	ret = duk_to_string(self->ctx, -1);
+
+	/* The string may be collected by the plugin thread afterwards. */
+	if (self->thread) {
+		free(self->value);
+		ret = self->value = irc_util_strdup(ret);
+	}
+
+	duk_pop_n(self->ctx, 2);
+	heap_release(self);
 
 	return ret;
 }
@@ -227,7 +764,7 @@ set_template(struct irc_plugin *plg, const char *key, const char *value)
 {
 	struct self *js = SELF(plg);
 
-	set_key_value(js->ctx, JSAPI_PLUGIN_PROP_TEMPLATES, key, value);
+	set_key_value(js, JSAPI_PLUGIN_PROP_TEMPLATES, key, value);
 }
 
 static const char *
@@ -235,7 +772,7 @@ get_template(struct irc_plugin *plg, const char *key)
 {
 	struct self *js = SELF(plg);
 
-	return get_value(js->ctx, JSAPI_PLUGIN_PROP_TEMPLATES, key);
+	return get_value(js, JSAPI_PLUGIN_PROP_TEMPLATES, key);
 }
 
 static const char * const *
@@ -243,7 +780,7 @@ get_templates(struct irc_plugin *plg)
 {
 	struct self *js = SELF(plg);
 
-	return get_table(js->ctx, JSAPI_PLUGIN_PROP_TEMPLATES, &js->templates);
+	return get_table(js, JSAPI_PLUGIN_PROP_TEMPLATES, &js->templates);
 }
 
 static void
@@ -251,7 +788,7 @@ set_path(struct irc_plugin *plg, const char *key, const char *value)
 {
 	struct self *js = SELF(plg);
 
-	set_key_value(js->ctx, JSAPI_PLUGIN_PROP_PATHS, key, value);
+	set_key_value(js, JSAPI_PLUGIN_PROP_PATHS, key, value);
 }
 
 static const char *
@@ -259,7 +796,7 @@ get_path(struct irc_plugin *plg, const char *key)
 {
 	struct self *js = SELF(plg);
 
-	return get_value(js->ctx, JSAPI_PLUGIN_PROP_PATHS, key);
+	return get_value(js, JSAPI_PLUGIN_PROP_PATHS, key);
 }
 
 static const char * const *
@@ -267,7 +804,7 @@ get_paths(struct irc_plugin *plg)
 {
 	struct self *js = SELF(plg);
 
-	return get_table(js->ctx, JSAPI_PLUGIN_PROP_PATHS, &js->paths);
+	return get_table(js, JSAPI_PLUGIN_PROP_PATHS, &js->paths);
 }
 
 static void
@@ -275,7 +812,7 @@ set_option(struct irc_plugin *plg, const char *key, const char *value)
 {
 	struct self *js = SELF(plg);
 
-	set_key_value(js->ctx, JSAPI_PLUGIN_PROP_OPTIONS, key, value);
+	set_key_value(js, JSAPI_PLUGIN_PROP_OPTIONS, key, value);
 }
 
 static const char *
@@ -283,7 +820,7 @@ get_option(struct irc_plugin *plg, const char *key)
 {
 	struct self *js = SELF(plg);
 
-	return get_value(js->ctx, JSAPI_PLUGIN_PROP_OPTIONS, key);
+	return get_value(js, JSAPI_PLUGIN_PROP_OPTIONS, key);
 }
 
 static const char * const *
@@ -291,200 +828,1250 @@ get_options(struct irc_plugin *plg)
 {
 	struct self *js = SELF(plg);
 
-	return get_table(js->ctx, JSAPI_PLUGIN_PROP_OPTIONS, &js->options);
+	return get_table(js, JSAPI_PLUGIN_PROP_OPTIONS, &js->options);
 }
 
-static int
-vcall(struct irc_plugin *plg, const char *function, const char *fmt, va_list ap)
+struct push {
+	duk_context *ctx;
+	struct irc_server *server;
+};
+
+static duk_ret_t
+push_server_safe(duk_context *ctx, void *data)
 {
-	struct self *self = SELF(plg);
-	int nargs = 0, ret = 0;
+	jsapi_server_push(ctx, data);
 
-	duk_get_global_string(self->ctx, function);
+	return 1;
+}
 
-	if (!duk_is_function(self->ctx, -1)) {
-		duk_pop(self->ctx);
-		return ret;
-	}
+static void
+push_server_run(void *data)
+{
+	struct push *push = data;
 
-	for (const char *f = fmt; *f; ++f) {
-		void (*push)(duk_context *, void *);
+	duk_safe_call(push->ctx, push_server_safe, push->server, 0, 1);
+}
 
-		switch (*f) {
-		case 'S':
-			jsapi_server_push(self->ctx, va_arg(ap, struct irc_server *));
-			break;
-		case 's':
-			duk_push_string(self->ctx, va_arg(ap, const char *));
-			break;
-		case 'x':
-			push = va_arg(ap, void (*)(duk_context *, void *));
-			push(self->ctx, va_arg(ap, void *));
-			break;
-		default:
-			continue;
-		}
+/*
+ * Servers are wrapped from the main thread as they are shared with it, errors
+ * must not be thrown there.
+ */
+static void
+push_server(struct self *self, struct irc_server *server)
+{
+	struct push push = {
+		.ctx = self->ctx,
+		.server = server
+	};
+
+	if (!running)
+		jsapi_server_push(self->ctx, server);
+	else if (thread_call(self->thread, push_server_run, &push) < 0)
+		duk_push_undefined(self->ctx);
+}
 
-		++nargs;
-	}
+struct marshal {
+	duk_context *ctx;
+	duk_c_function fn;
+	duk_int_t rc;
+};
 
-	if (duk_pcall(self->ctx, nargs) != 0) {
-		log_trace(SELF(plg));
-		ret = -1;
+static duk_ret_t
+marshal_native(duk_context *ctx, void *data)
+{
+	const struct marshal *m = data;
+
+	return m->fn(ctx);
+}
+
+static void
+marshal_run(void *data)
+{
+	struct marshal *m = data;
+
+	m->rc = duk_safe_call(m->ctx, marshal_native, m, duk_get_top(m->ctx), 1);
+}
+
+/*
+ * Native function of a threaded plugin, run on the main thread when called
+ * from the plugin thread. Errors are thrown back to the plugin thread.
+ */
+static duk_ret_t
+marshal(duk_context *ctx)
+{
+	struct marshal m = {
+		.ctx = ctx
+	};
+
+	duk_push_current_function(ctx);
+	duk_get_prop_string(ctx, -1, MARSHAL);
+	m.fn = (duk_c_function)duk_get_pointer(ctx, -1);
+	duk_pop_n(ctx, 2);
+
+	if (!running)
+		return m.fn(ctx);
+
+	if (thread_call(running->thread, marshal_run, &m) < 0)
+		return duk_error(ctx, DUK_ERR_ERROR, "plugin unloaded");
+	if (m.rc != DUK_EXEC_SUCCESS)
+		return duk_throw(ctx);
+
+	return 1;
+}
+
+static inline struct self *
+heap_self(duk_context *ctx)
+{
+	duk_memory_functions funcs;
+
+	/* NULL for the shared heap. */
+	duk_get_memory_functions(ctx, &funcs);
+
+	return funcs.udata;
+}
+
+/*
+ * Call the function on top of the stack with the arguments described by fmt.
+ */
+static int
+vcall(struct irc_plugin *plg, const char *fmt, va_list ap)
+{
+	struct self *self = SELF(plg);
+	int nargs = 0, ret = 0;
+
+	for (const char *f = fmt; *f; ++f) {
+		void (*push)(duk_context *, void *);
+
+		switch (*f) {
+		case 'S':
+			push_server(self, va_arg(ap, struct irc_server *));
+			break;
+		case 's':
+			duk_push_string(self->ctx, va_arg(ap, const char *));
+			break;
+		case 'x':
+			push = va_arg(ap, void (*)(duk_context *, void *));
+			push(self->ctx, va_arg(ap, void *));
+			break;
+		default:
+			continue;
+		}
+
+		++nargs;
+	}
+
+	/* The memory limit only applies within the protected call. */
+	js_plugin_enter(plg);
+	ret = duk_pcall(self->ctx, nargs);
+	js_plugin_leave(plg, ret);
+
+	if (ret != 0)
+		log_trace(self);
+
+	duk_pop(self->ctx);
+
+	if (ret != 0)
+		ret = -1;
+
+	return ret;
+}
+
+static int
+call(struct irc_plugin *plg, const char *function, const char *fmt, ...)
+{
+	struct self *self = SELF(plg);
+	va_list ap;
+	int ret;
+
+	duk_get_global_string(self->ctx, function);
+
+	if (!duk_is_function(self->ctx, -1)) {
+		duk_pop(self->ctx);
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	ret = vcall(plg, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/*
+ * Call the event function resolved by subscribe, the global is not looked up
+ * again.
+ */
+static int
+emit(struct irc_plugin *plg, enum irc_event_type type, const char *fmt, ...)
+{
+	struct self *self = SELF(plg);
+	va_list ap;
+	int ret;
+
+	if (!self->handlers[type])
+		return 0;
+
+	duk_push_heapptr(self->ctx, self->handlers[type]);
+
+	va_start(ap, fmt);
+	ret = vcall(plg, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/*
+ * Only subscribe to events the plugin has a function for so the bot does not
+ * call us for nothing. Called again on load/reload as the script may define
+ * its functions at that time.
+ *
+ * The functions are stored in the global stash so that their heap pointers
+ * stay valid until the next call even if the script replaces its globals.
+ */
+static void
+subscribe(struct self *self)
+{
+	const char *name;
+
+	self->parent.events = 0;
+	duk_push_global_stash(self->ctx);
+	duk_push_array(self->ctx);
+
+	for (int type = 0; type < IRC_EVENT_NUM; ++type) {
+		self->handlers[type] = NULL;
+
+		if (!(name = irc_event_name(type)))
+			continue;
+
+		duk_get_global_string(self->ctx, name);
+
+		if (duk_is_function(self->ctx, -1)) {
+			self->parent.events |= IRC_PLUGIN_EVENT(type);
+			self->handlers[type] = duk_get_heapptr(self->ctx, -1);
+			duk_put_prop_index(self->ctx, -2, type);
+		} else
+			duk_pop(self->ctx);
+	}
+
+	duk_put_prop_string(self->ctx, -2, HANDLERS);
+	duk_pop(self->ctx);
+}
+
+static int
+dispatch(struct irc_plugin *plg, const struct irc_event *ev)
+{
+	switch (ev->type) {
+	case IRC_EVENT_COMMAND:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->message.origin,
+		    ev->message.channel, ev->message.message);
+	case IRC_EVENT_CONNECT:
+		return emit(plg, ev->type, "S", ev->server);
+	case IRC_EVENT_DISCONNECT:
+		return emit(plg, ev->type, "S", ev->server);
+	case IRC_EVENT_INVITE:
+		return emit(plg, ev->type, "Ss s", ev->server, ev->invite.origin,
+		     ev->invite.channel);
+	case IRC_EVENT_JOIN:
+		return emit(plg, ev->type, "Ss s", ev->server, ev->join.origin,
+		    ev->join.channel);
+	case IRC_EVENT_KICK:
+		return emit(plg, ev->type, "Ss sss", ev->server, ev->kick.origin,
+		    ev->kick.channel, ev->kick.target, ev->kick.reason);
+	case IRC_EVENT_ME:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->message.origin,
+		    ev->message.channel, ev->message.message);
+	case IRC_EVENT_MESSAGE:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->message.origin,
+		    ev->message.channel, ev->message.message);
+	case IRC_EVENT_MODE:
+		return emit(plg, ev->type, "Ss ssx", ev->server, ev->mode.origin,
+		    ev->mode.channel, ev->mode.mode, push_modes, ev->mode.args);
+	case IRC_EVENT_NAMES:
+		return emit(plg, ev->type, "Ss x", ev->server, ev->names.channel,
+		    push_names, ev);
+	case IRC_EVENT_NICK:
+		return emit(plg, ev->type, "Ss s", ev->server, ev->nick.origin,
+		    ev->nick.nickname);
+	case IRC_EVENT_NOTICE:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->notice.origin,
+		    ev->notice.channel, ev->notice.notice);
+	case IRC_EVENT_PART:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->part.origin,
+		    ev->part.channel, ev->part.reason);
+	case IRC_EVENT_TOPIC:
+		return emit(plg, ev->type, "Ss ss", ev->server, ev->topic.origin,
+		    ev->topic.channel, ev->topic.topic);
+	case IRC_EVENT_WHOIS:
+		return emit(plg, ev->type, "Sx", ev->server, push_whois, ev);
+	default:
+		return 0;
+	}
+}
+
+static char *
+eat(const char *path, struct stat *st)
+{
+	int fd = -1;
+	char *ret = NULL;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		goto err;
+	if (fstat(fd, st) < 0)
+		goto err;
+	if (!(ret = calloc(1, st->st_size + 1)))
+		goto err;
+	if (read(fd, ret, st->st_size) != st->st_size)
+		goto err;
+
+	close(fd);
+
+	return ret;
+
+err:
+	if (fd != -1)
+		close(fd);
+
+	free(ret);
+
+	return NULL;
+}
+
+/*
+ * Compiled scripts are dumped as Duktape bytecode into one file per script,
+ * prefixed by this header and the script path. The cache is only used if
+ * every field matches the script being loaded and the bytecode matches its
+ * checksum, Duktape does not validate bytecode on its own.
+ */
+struct cache_header {
+	char magic[4];
+	long version;
+	long long mtime;
+	long mtime_nsec;
+	long long size;
+	size_t pathsz;
+	size_t codesz;
+	unsigned long long codesum;
+};
+
+/* Disabled until js_plugin_set_cache is called. */
+static char cache[PATH_MAX];
+
+/*
+ * FNV-1a.
+ */
+static unsigned long long
+cache_hash(const void *data, size_t datasz)
+{
+	const unsigned char *p = data;
+	unsigned long long hash = 14695981039346656037ULL;
+
+	while (datasz--)
+		hash = (hash ^ *p++) * 1099511628211ULL;
+
+	return hash;
+}
+
+static int
+cache_path(char *buf, size_t bufsz, const char *path)
+{
+	unsigned long long hash;
+
+	/* The real path is stored in the file. */
+	hash = cache_hash(path, strlen(path));
+
+	return snprintf(buf, bufsz, "%s/%016llx", cache, hash) >= (int)bufsz ? -1 : 0;
+}
+
+static void
+cache_header_init(struct cache_header *hdr, const char *path, const struct stat *st)
+{
+	memset(hdr, 0, sizeof (*hdr));
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof (hdr->magic));
+	hdr->version = DUK_VERSION;
+	hdr->mtime = st->st_mtim.tv_sec;
+	hdr->mtime_nsec = st->st_mtim.tv_nsec;
+	hdr->size = st->st_size;
+	hdr->pathsz = strlen(path);
+}
+
+/*
+ * Push the cached function for this script if it is still valid.
+ */
+static int
+cache_load(duk_context *ctx, const char *path, const struct stat *st)
+{
+	struct cache_header expected, hdr;
+	char file[PATH_MAX], stored[PATH_MAX];
+	void *code;
+	FILE *fp;
+	int ret = -1;
+
+	if (!cache[0] || cache_path(file, sizeof (file), path) < 0 || !(fp = fopen(file, "rb")))
+		return -1;
+
+	cache_header_init(&expected, path, st);
+
+	if (fread(&hdr, sizeof (hdr), 1, fp) != 1 || hdr.pathsz >= sizeof (stored))
+		goto end;
+
+	/* Only the bytecode size and checksum differ from the expected header. */
+	expected.codesz = hdr.codesz;
+	expected.codesum = hdr.codesum;
+
+	if (memcmp(&hdr, &expected, sizeof (hdr)) != 0)
+		goto end;
+	if (fread(stored, 1, hdr.pathsz, fp) != hdr.pathsz || memcmp(stored, path, hdr.pathsz) != 0)
+		goto end;
+
+	code = duk_push_fixed_buffer(ctx, hdr.codesz);
+
+	/* A truncated or corrupted file would be loaded as garbage. */
+	if (fread(code, 1, hdr.codesz, fp) != hdr.codesz || fgetc(fp) != EOF ||
+	    cache_hash(code, hdr.codesz) != hdr.codesum) {
+		duk_pop(ctx);
+		goto end;
+	}
+
+	duk_load_function(ctx);
+	ret = 0;
+
+end:
+	fclose(fp);
+
+	return ret;
+}
+
+static int
+cache_mkdir(char *path)
+{
+	for (char *p = path + 1; *p; ++p) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+
+		if (mkdir(path, 0755) < 0 && errno != EEXIST)
+			return *p = '/', -1;
+
+		*p = '/';
+	}
+
+	return mkdir(path, 0755) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+/*
+ * Dump the function on top of the stack, the file is written aside and
+ * renamed so that a concurrent load never reads a partial file.
+ */
+static void
+cache_save(duk_context *ctx, const char *path, const struct stat *st)
+{
+	struct cache_header hdr;
+	char file[PATH_MAX], tmp[PATH_MAX + 8], dir[PATH_MAX];
+	duk_size_t codesz;
+	void *code;
+	FILE *fp;
+	int fd, ok;
+
+	if (!cache[0] || cache_path(file, sizeof (file), path) < 0)
+		return;
+
+	irc_util_strlcpy(dir, cache, sizeof (dir));
+
+	if (cache_mkdir(dir) < 0) {
+		irc_log_debug("plugin: %s: %s", cache, strerror(errno));
+		return;
+	}
+
+	duk_dup(ctx, -1);
+	duk_dump_function(ctx);
+	code = duk_get_buffer(ctx, -1, &codesz);
+
+	cache_header_init(&hdr, path, st);
+	hdr.codesz = codesz;
+	hdr.codesum = cache_hash(code, codesz);
+
+	snprintf(tmp, sizeof (tmp), "%s.XXXXXX", file);
+
+	if ((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "wb"))) {
+		if (fd >= 0) {
+			close(fd);
+			remove(tmp);
+		}
+
+		irc_log_debug("plugin: %s: %s", tmp, strerror(errno));
+		duk_pop(ctx);
+		return;
+	}
+
+	ok = fwrite(&hdr, sizeof (hdr), 1, fp) == 1 &&
+	     fwrite(path, 1, hdr.pathsz, fp) == hdr.pathsz &&
+	     fwrite(code, 1, codesz, fp) == codesz;
+	ok = fclose(fp) == 0 && ok && rename(tmp, file) == 0;
+
+	if (!ok) {
+		irc_log_debug("plugin: %s: %s", file, strerror(errno));
+		remove(tmp);
+	}
+
+	duk_pop(ctx);
+}
+
+/*
+ * Push the script function, from the cache if possible, otherwise compile it
+ * and update the cache.
+ */
+static int
+compile(duk_context *ctx, const char *path, const char *script, const struct stat *st)
+{
+	if (cache_load(ctx, path, st) == 0)
+		return 0;
+
+	duk_push_string(ctx, path);
+
+	if (duk_pcompile_string_filename(ctx, 0, script) != 0)
+		return -1;
+
+	cache_save(ctx, path, st);
+
+	return 0;
+}
+
+/*
+ * Size class of an allocation, POOL_CLASSES if too large for the pool.
+ */
+static inline size_t
+pool_class(size_t size)
+{
+	if (size > POOL_GRANULE * POOL_CLASSES)
+		return POOL_CLASSES;
+
+	return size ? (size - 1) / POOL_GRANULE : 0;
+}
+
+static inline int
+pool_owns(const void *ptr)
+{
+	return (uintptr_t)ptr % POOL_GRANULE == 0;
+}
+
+static inline struct slab *
+pool_slab(const void *ptr)
+{
+	return (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(POOL_SLAB - 1));
+}
+
+/*
+ * Usable size of a block, as accounted in the heap.
+ */
+static inline size_t
+pool_size(const void *ptr)
+{
+	if (pool_owns(ptr))
+		return pool_slab(ptr)->size;
+
+	return *(const size_t *)((const char *)ptr - POOL_HEADER);
+}
+
+/*
+ * Size accounted for an allocation of size bytes.
+ */
+static inline size_t
+pool_round(size_t size)
+{
+	size_t cls;
+
+	if ((cls = pool_class(size)) == POOL_CLASSES)
+		return size;
+
+	return (cls + 1) * POOL_GRANULE;
+}
+
+/*
+ * Allocation too large for the pool, the size header keeps the block
+ * POOL_HEADER bytes past an aligned address. The libc allocator alignment
+ * is enough on most platforms, otherwise the block is moved.
+ */
+static void *
+pool_large(void *base, size_t size)
+{
+	void *ret;
+
+	if (base)
+		base = irc_util_realloc(base, POOL_HEADER + size);
+	else
+		base = irc_util_malloc(POOL_HEADER + size);
+
+	if ((uintptr_t)base % POOL_GRANULE != 0) {
+		if (!(ret = aligned_alloc(POOL_GRANULE, (POOL_HEADER + size + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)))
+			irc_util_die("aligned_alloc: %s\n", strerror(errno));
+
+		memcpy(ret, base, POOL_HEADER + size);
+		free(base);
+		base = ret;
+	}
+
+	*(size_t *)base = size;
+
+	return (char *)base + POOL_HEADER;
+}
+
+/*
+ * Take a spare slab or carve a new one, the arena with slabs left to carve
+ * is always the first.
+ */
+static struct slab *
+pool_take(struct pool *pool)
+{
+	struct arena *arena;
+	struct slab *slab;
+
+	if ((slab = pool->spare))
+		DL_DELETE(pool->spare, slab);
+	else {
+		if (!(arena = pool->arenas) || arena->carved == POOL_ARENA) {
+			arena = irc_util_calloc(1, sizeof (*arena));
+
+			if (!(arena->base = aligned_alloc(POOL_SLAB, POOL_SLAB * POOL_ARENA)))
+				irc_util_die("aligned_alloc: %s\n", strerror(errno));
+
+			DL_PREPEND(pool->arenas, arena);
+		}
+
+		slab = (struct slab *)(arena->base + arena->carved++ * POOL_SLAB);
+		slab->arena = arena;
+	}
+
+	slab->arena->used++;
+
+	return slab;
+}
+
+static void
+pool_release(struct pool *pool, struct slab *slab)
+{
+	struct arena *arena = slab->arena;
+	struct slab *tmp;
+
+	DL_PREPEND(pool->spare, slab);
+
+	if (--arena->used || (arena->prev == arena && !arena->next))
+		return;
+
+	DL_FOREACH_SAFE(pool->spare, slab, tmp)
+		if (slab->arena == arena)
+			DL_DELETE(pool->spare, slab);
+
+	DL_DELETE(pool->arenas, arena);
+	free(arena->base);
+	free(arena);
+}
+
+/*
+ * Create a new slab for the class and carve it into free blocks.
+ */
+static struct slab *
+pool_grow(struct pool *pool, size_t cls)
+{
+	struct slab *slab;
+	struct block *blk;
+	size_t offset;
+
+	slab = pool_take(pool);
+	slab->free = NULL;
+	slab->size = (cls + 1) * POOL_GRANULE;
+	slab->used = 0;
+	slab->capacity = 0;
+	offset = (sizeof (*slab) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+
+	for (; offset + slab->size <= POOL_SLAB; offset += slab->size) {
+		blk = (struct block *)((char *)slab + offset);
+		blk->next = slab->free;
+		slab->free = blk;
+		slab->capacity++;
+	}
+
+	DL_PREPEND(pool->slabs[cls], slab);
+
+	return slab;
+}
+
+static void *
+pool_get(struct pool *pool, size_t size)
+{
+	struct slab *slab;
+	struct block *blk;
+	size_t cls;
+
+	if ((cls = pool_class(size)) == POOL_CLASSES)
+		return pool_large(NULL, size);
+
+	if (!(slab = pool->slabs[cls]))
+		slab = pool_grow(pool, cls);
+
+	blk = slab->free;
+	slab->free = blk->next;
+
+	/* Full, only linked again once a block is freed. */
+	if (++slab->used == slab->capacity)
+		DL_DELETE(pool->slabs[cls], slab);
+
+	return blk;
+}
+
+static void
+pool_put(struct pool *pool, void *ptr)
+{
+	struct slab *slab;
+	struct block *blk = ptr;
+	size_t cls;
+
+	if (!pool_owns(ptr)) {
+		free((char *)ptr - POOL_HEADER);
+		return;
+	}
+
+	slab = pool_slab(ptr);
+	cls = pool_class(slab->size);
+
+	if (slab->used-- == slab->capacity)
+		DL_PREPEND(pool->slabs[cls], slab);
+
+	blk->next = slab->free;
+	slab->free = blk;
+
+	if (slab->used == 0 && (slab->prev != slab || slab->next)) {
+		DL_DELETE(pool->slabs[cls], slab);
+		pool_release(pool, slab);
+	}
+}
+
+static void
+pool_clear(struct pool *pool)
+{
+	struct arena *arena, *tmp;
+
+	DL_FOREACH_SAFE(pool->arenas, arena, tmp) {
+		free(arena->base);
+		free(arena);
+	}
+
+	memset(pool, 0, sizeof (*pool));
+}
+
+/*
+ * Collect the garbage of the heap unless a call is still running on it, the
+ * next allocation tries again.
+ */
+static void
+collector_cb(struct ev_idle *w, int)
+{
+	struct collector *gc = IRC_UTIL_CONTAINER_OF(w, struct collector, idle);
+	struct self *self;
+	duk_context *ctx;
+	unsigned long long start;
+
+	ev_idle_stop(w);
+
+	if (gc == &shared.gc) {
+		if (shared.current)
+			return;
+
+		ctx = shared.ctx;
+	} else {
+		self = IRC_UTIL_CONTAINER_OF(gc, struct self, gc);
+
+		if (self->depth)
+			return;
+
+		ctx = self->ctx;
+	}
+
+	start = now_us();
+	duk_gc(ctx, 0);
+	irc_metric_inc(&gc->runs);
+	irc_metric_add(&gc->time, now_us() - start);
+	gc->allocated = 0;
+}
+
+static void
+collector_init(struct collector *gc, const char *label)
+{
+	memset(gc, 0, sizeof (*gc));
+	ev_idle_init(&gc->idle, collector_cb);
+
+	gc->runs.name = "irccd_js_gc_total";
+	gc->runs.help = "Garbage collections of the Javascript heap while idle.";
+	gc->runs.type = IRC_METRIC_COUNTER;
+	gc->runs.label = "plugin";
+	gc->runs.label_value = label;
+
+	gc->time.name = "irccd_js_gc_microseconds_total";
+	gc->time.help = "Time spent collecting garbage of the Javascript heap while idle.";
+	gc->time.type = IRC_METRIC_COUNTER;
+	gc->time.label = "plugin";
+	gc->time.label_value = label;
+}
+
+static void
+collector_metrics(struct collector *gc, void (*fn)(struct irc_metric *))
+{
+	fn(&gc->runs);
+	fn(&gc->time);
+}
+
+static inline void
+collector_add(struct collector *gc, size_t size, size_t threshold)
+{
+	gc->allocated += size;
+
+	if (threshold && gc->allocated >= threshold && !ev_is_active(&gc->idle))
+		ev_idle_start(&gc->idle);
+}
+
+static inline struct pool *
+heap_pool(void *udata)
+{
+	struct self *self = udata;
+
+	return self ? &self->pool : &shared.pool;
+}
+
+/*
+ * Account size more bytes in the heap. The allocation is refused if the
+ * plugin is running and would exceed its memory limit, Duktape then collects
+ * garbage and tries again before raising an error within the plugin. Outside
+ * of calls, allocations are not protected and always succeed.
+ */
+static int
+heap_grow(void *udata, size_t size)
+{
+	struct self *self = udata;
+	struct irc_plugin *plg;
+	struct usage *usage;
+
+	if (!self) {
+		irc_metric_add(&shared.heap, size);
+		collector_add(&shared.gc, size, IRC_PLUGIN_DEFAULT_GC);
+		return 0;
+	}
+
+	plg = &self->parent;
+
+	/* Published once the heap is given back to the main thread. */
+	if (self->thread) {
+		usage = &self->thread->usage;
+
+		if (plg->memory_limit && self->depth && usage->memory + size > plg->memory_limit) {
+			usage->failures++;
+			return -1;
+		}
+
+		usage->memory += size;
+
+		if (usage->memory > usage->peak)
+			usage->peak = usage->memory;
+
+		self->gc.allocated += size;
+
+		return 0;
+	}
+
+	if (plg->memory_limit && self->depth && plg->memory + size > plg->memory_limit) {
+		plg->memory_failures++;
+		return -1;
+	}
+
+	plg->memory += size;
+
+	if (plg->memory > plg->memory_peak)
+		plg->memory_peak = plg->memory;
+
+	irc_metric_set(&self->heap, plg->memory);
+	collector_add(&self->gc, size, plg->gc_threshold);
+
+	return 0;
+}
+
+static void
+heap_shrink(void *udata, size_t size)
+{
+	struct self *self = udata;
+
+	if (!self)
+		irc_metric_sub(&shared.heap, size);
+	else if (self->thread)
+		self->thread->usage.memory -= size;
+	else {
+		self->parent.memory -= size;
+		irc_metric_set(&self->heap, self->parent.memory);
+	}
+}
+
+static void *
+wrap_malloc(void *udata, size_t size)
+{
+	if (heap_grow(udata, pool_round(size)) < 0)
+		return NULL;
+
+	return pool_get(heap_pool(udata), size);
+}
+
+static void
+wrap_free(void *udata, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	heap_shrink(udata, pool_size(ptr));
+	pool_put(heap_pool(udata), ptr);
+}
+
+static void *
+wrap_realloc(void *udata, void *ptr, size_t size)
+{
+	size_t cls, old, new;
+	void *ret;
+
+	if (!ptr)
+		return wrap_malloc(udata, size);
+	if (size == 0)
+		return wrap_free(udata, ptr), NULL;
+
+	old = pool_size(ptr);
+	new = pool_round(size);
+
+	if (new > old && heap_grow(udata, new - old) < 0)
+		return NULL;
+	if (new < old)
+		heap_shrink(udata, old - new);
+
+	/* Still fits the same block or both are too large for the pool. */
+	if ((cls = pool_class(size)) == pool_class(old)) {
+		if (cls == POOL_CLASSES)
+			ptr = pool_large((char *)ptr - POOL_HEADER, size);
+
+		return ptr;
 	}
 
-	duk_pop(self->ctx);
+	ret = pool_get(heap_pool(udata), size);
+	memcpy(ret, ptr, size < old ? size : old);
+	pool_put(heap_pool(udata), ptr);
 
 	return ret;
 }
 
-static int
-call(struct irc_plugin *plg, const char *function, const char *fmt, ...)
+/*
+ * Create the plugin context, either a new heap or a thread with a new global
+ * environment in the shared heap. The thread is referenced from the heap
+ * stash until the plugin is destroyed.
+ */
+static void
+heap_open(struct self *js)
 {
-	va_list ap;
-	int ret;
+	if (!shared.enabled || js->thread) {
+		/* Javascript, the heap udata is used to check the deadline. */
+		js->ctx = duk_create_heap(wrap_malloc, wrap_realloc, wrap_free, js, NULL);
+		return;
+	}
 
-	va_start(ap, fmt);
-	ret = vcall(plg, function, fmt, ap);
-	va_end(ap);
+	if (!shared.ctx) {
+		collector_init(&shared.gc, "(shared)");
+		shared.ctx = duk_create_heap(wrap_malloc, wrap_realloc, wrap_free, NULL, NULL);
+		irc_metrics_register(&shared.heap);
+		collector_metrics(&shared.gc, irc_metrics_register);
+	}
 
-	return ret;
+	duk_push_heap_stash(shared.ctx);
+	duk_push_pointer(shared.ctx, js);
+	duk_push_thread_new_globalenv(shared.ctx);
+	js->ctx = duk_get_context(shared.ctx, -1);
+	duk_put_prop(shared.ctx, -3);
+	duk_pop(shared.ctx);
+
+	js->shared = 1;
+	shared.refs++;
 }
 
 static void
-handle(struct irc_plugin *plg, const struct irc_event *ev)
+heap_close(struct self *js)
 {
-	(void)plg;
-	(void)ev;
+	if (!js->shared) {
+		/* Finalizers may still allocate. */
+		duk_destroy_heap(js->ctx);
+		ev_idle_stop(&js->gc.idle);
+		pool_clear(&js->pool);
+		return;
+	}
 
-	switch (ev->type) {
-	case IRC_EVENT_COMMAND:
-		call(plg, "onCommand", "Ss ss", ev->server, ev->message.origin,
-		    ev->message.channel, ev->message.message);
-		break;
-	case IRC_EVENT_CONNECT:
-		call(plg, "onConnect", "S", ev->server);
-		break;
-	case IRC_EVENT_DISCONNECT:
-		call(plg, "onDisconnect", "S", ev->server);
-		break;
-	case IRC_EVENT_INVITE:
-		call(plg, "onInvite", "Ss s", ev->server, ev->invite.origin,
-		     ev->invite.channel);
-		break;
-	case IRC_EVENT_JOIN:
-		call(plg, "onJoin", "Ss s", ev->server, ev->join.origin,
-		    ev->join.channel);
-		break;
-	case IRC_EVENT_KICK:
-		call(plg, "onKick", "Ss sss", ev->server, ev->kick.origin,
-		    ev->kick.channel, ev->kick.target, ev->kick.reason);
-		break;
-	case IRC_EVENT_ME:
-		call(plg, "onMe", "Ss ss", ev->server, ev->message.origin,
-		    ev->message.channel, ev->message.message);
-		break;
-	case IRC_EVENT_MESSAGE:
-		call(plg, "onMessage", "Ss ss", ev->server, ev->message.origin,
-		    ev->message.channel, ev->message.message);
-		break;
-	case IRC_EVENT_MODE:
-		call(plg, "onMode", "Ss ssx", ev->server, ev->mode.origin,
-		    ev->mode.channel, ev->mode.mode, push_modes, ev->mode.args);
-		break;
-	case IRC_EVENT_NAMES:
-		call(plg, "onNames", "Ss x", ev->server, ev->names.channel,
-		    push_names, ev);
-		break;
-	case IRC_EVENT_NICK:
-		call(plg, "onNick", "Ss s", ev->server, ev->nick.origin,
-		    ev->nick.nickname);
-		break;
-	case IRC_EVENT_NOTICE:
-		call(plg, "onNotice", "Ss ss", ev->server, ev->notice.origin,
-		    ev->notice.channel, ev->notice.notice);
-		break;
-	case IRC_EVENT_PART:
-		call(plg, "onPart", "Ss ss", ev->server, ev->part.origin,
-		    ev->part.channel, ev->part.reason);
-		break;
-	case IRC_EVENT_TOPIC:
-		call(plg, "onTopic", "Ss ss", ev->server, ev->topic.origin,
-		    ev->topic.channel, ev->topic.topic);
-		break;
-	case IRC_EVENT_WHOIS:
-		call(plg, "onWhois", "Sx", ev->server, push_whois, ev);
-		break;
-	default:
-		break;
+	duk_push_heap_stash(shared.ctx);
+	duk_push_pointer(shared.ctx, js);
+	duk_del_prop(shared.ctx, -2);
+	duk_pop(shared.ctx);
+
+	/*
+	 * Collect the plugin objects right now, their finalizers stop the
+	 * timers and requests that still refer to the plugin. Twice so that
+	 * objects resurrected by finalizers are collected as well.
+	 */
+	duk_gc(shared.ctx, 0);
+	duk_gc(shared.ctx, 0);
+
+	if (--shared.refs == 0) {
+		duk_destroy_heap(shared.ctx);
+		ev_idle_stop(&shared.gc.idle);
+		pool_clear(&shared.pool);
+		irc_metrics_unregister(&shared.heap);
+		collector_metrics(&shared.gc, irc_metrics_unregister);
+		shared.ctx = NULL;
 	}
 }
 
-static char *
-eat(const char *path)
+static void finish(struct irc_plugin *);
+
+/*
+ * Handle the event from the plugin thread, the garbage is collected there as
+ * well once it has nothing else to do.
+ */
+static void
+thread_handle(struct self *self, struct job *job)
 {
-	int fd = -1;
-	char *ret = NULL;
-	struct stat st;
+	struct thread *t = self->thread;
+	unsigned long long start;
+
+	start = now_us();
+	job->rc = dispatch(&self->parent, &job->ev);
+	job->duration = now_us() - start;
+
+	if (self->parent.gc_threshold && self->gc.allocated >= self->parent.gc_threshold &&
+	    ring_empty(&t->todo)) {
+		start = now_us();
+		duk_gc(self->ctx, 0);
+		job->collected = 1;
+		job->collect_time = now_us() - start;
+		self->gc.allocated = 0;
+	}
 
-	if ((fd = open(path, O_RDONLY)) < 0)
-		goto err;
-	if (fstat(fd, &st) < 0)
-		goto err;
-	if (!(ret = calloc(1, st.st_size + 1)))
-		goto err;
-	if (read(fd, ret, st.st_size) != st.st_size)
-		goto err;
+	job->usage = t->usage;
+	t->usage.peak = t->usage.memory;
+	t->usage.failures = 0;
+}
 
-	close(fd);
+static void *
+thread_entry(void *data)
+{
+	struct self *self = data;
+	struct thread *t = self->thread;
+	struct job *job;
 
-	return ret;
+	running = self;
+	pthread_mutex_lock(&t->mtx);
 
-err:
-	if (fd != -1)
-		close(fd);
+	for (;;) {
+		/* Pairs with the fence in handle so that no event is missed. */
+		atomic_store(&t->idle, 1);
+		atomic_thread_fence(memory_order_seq_cst);
 
-	free(ret);
+		while (!atomic_load(&t->stop) &&
+		    (atomic_load(&t->borrowed) || ring_empty(&t->todo)))
+			pthread_cond_wait(&t->cond, &t->mtx);
+
+		atomic_store(&t->idle, 0);
+
+		if (atomic_load(&t->stop))
+			break;
+
+		t->busy = 1;
+		pthread_mutex_unlock(&t->mtx);
+
+		/* The heap is given back between events when borrowed. */
+		while (!atomic_load(&t->stop) && !atomic_load(&t->borrowed) &&
+		    (job = ring_pop(&t->todo))) {
+			thread_handle(self, job);
+			ring_push(&t->done, job);
+			thread_notify(t);
+		}
+
+		pthread_mutex_lock(&t->mtx);
+		t->busy = 0;
+		pthread_cond_broadcast(&t->cond);
+	}
+
+	pthread_mutex_unlock(&t->mtx);
 
 	return NULL;
 }
 
-static void *
-wrap_malloc(void *udata, size_t size)
+static void
+thread_io_cb(struct ev_io *w, int)
 {
-	(void)udata;
+	struct thread *t = IRC_UTIL_CONTAINER_OF(w, struct thread, io);
+	char buf[64];
+
+	while (read(t->fds[0], buf, sizeof (buf)) > 0)
+		continue;
+
+	atomic_store(&t->signaled, 0);
+	atomic_thread_fence(memory_order_seq_cst);
 
-	return irc_util_malloc(size);
+	pthread_mutex_lock(&t->mtx);
+	thread_serve(t);
+	pthread_mutex_unlock(&t->mtx);
+
+	thread_drain(t->self);
 }
 
-static void *
-wrap_realloc(void *udata, void *ptr, size_t size)
+static void
+thread_reaper_cb(struct ev_timer *w, int)
 {
-	(void)udata;
+	struct thread *t = IRC_UTIL_CONTAINER_OF(w, struct thread, reaper);
 
-	return irc_util_realloc(ptr, size);
+	finish(&t->self->parent);
+}
+
+static struct thread *
+thread_new(struct self *self)
+{
+	struct thread *t;
+
+	t = irc_util_calloc(1, sizeof (*t));
+	t->self = self;
+
+	if (pipe(t->fds) < 0)
+		irc_util_die("abort: pipe: %s\n", strerror(errno));
+
+	for (int i = 0; i < 2; ++i) {
+		fcntl(t->fds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(t->fds[i], F_SETFL, fcntl(t->fds[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	pthread_mutex_init(&t->mtx, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	ev_io_init(&t->io, thread_io_cb, t->fds[0], EV_READ);
+	ev_timer_init(&t->reaper, thread_reaper_cb, 0.0, 0.0);
+
+	return t;
 }
 
 static void
-wrap_free(void *udata, void *ptr)
+thread_start(struct thread *t)
+{
+	int rc;
+
+	if ((rc = pthread_create(&t->thread, NULL, thread_entry, t->self)) != 0)
+		irc_util_die("abort: pthread_create: %s\n", strerror(rc));
+
+	t->started = 1;
+	ev_io_start(&t->io);
+}
+
+/*
+ * Stop the plugin thread once it has handled its current event, the heap then
+ * belongs to the main thread for good.
+ */
+static void
+thread_stop(struct thread *t)
+{
+	struct job *job;
+
+	if (t->started) {
+		pthread_mutex_lock(&t->mtx);
+		atomic_store(&t->stop, 1);
+		pthread_cond_broadcast(&t->cond);
+
+		while (t->busy) {
+			if (t->call)
+				thread_serve(t);
+			else
+				pthread_cond_wait(&t->cond, &t->mtx);
+		}
+
+		pthread_mutex_unlock(&t->mtx);
+		pthread_join(t->thread, NULL);
+	}
+
+	ev_io_stop(&t->io);
+	ev_timer_stop(&t->reaper);
+	close(t->fds[0]);
+	close(t->fds[1]);
+
+	while ((job = ring_pop(&t->done)))
+		job_free(job);
+	while ((job = ring_pop(&t->todo)))
+		job_free(job);
+}
+
+static void
+thread_free(struct thread *t)
+{
+	pthread_mutex_destroy(&t->mtx);
+	pthread_cond_destroy(&t->cond);
+	free(t);
+}
+
+/*
+ * Events are queued for the plugin thread once started, the plugin records
+ * its statistics itself when they are handled.
+ */
+static int
+handle(struct irc_plugin *plg, const struct irc_event *ev)
 {
-	(void)udata;
+	struct self *self = SELF(plg);
+	struct thread *t = self->thread;
+	struct job *job;
+
+	if (!t || !t->started)
+		return dispatch(plg, ev);
+
+	/* Not a call, only counted. */
+	if (t->queued == THREAD_RING) {
+		plg->queue.dropped++;
+		return 1;
+	}
+
+	job = irc_util_calloc(1, sizeof (*job));
+	irc_event_copy(&job->ev, ev);
+
+	if (job->ev.server)
+		irc_server_incref(job->ev.server);
 
-	free(ptr);
+	t->queued++;
+	ring_push(&t->todo, job);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load(&t->idle)) {
+		pthread_mutex_lock(&t->mtx);
+		pthread_cond_broadcast(&t->cond);
+		pthread_mutex_unlock(&t->mtx);
+	}
+
+	return 1;
 }
 
 static struct self *
-init(const char *name, const char *path, const char *script)
+init(const char *name, const char *path, const char *script, const struct stat *st)
 {
 	struct self *js;
 
 	js = irc_util_calloc(1, sizeof (*js));
 	irc_plugin_init(&js->parent, name);
 
-	/* Javascript */
-	js->ctx      = duk_create_heap(wrap_malloc, wrap_realloc, wrap_free, NULL, NULL);
+	js->heap.name = "irccd_js_heap_bytes";
+	js->heap.help = "Bytes allocated by the Javascript heap.";
+	js->heap.type = IRC_METRIC_GAUGE;
+	js->heap.label = "plugin";
+	js->heap.label_value = js->parent.name;
+	collector_init(&js->gc, js->parent.name);
+
+	/* Before anything is allocated, the accounting differs. */
+	if (threaded)
+		js->thread = thread_new(js);
+
+	heap_open(js);
 	js->location = irc_util_strdup(path);
 
+	ev_timer_init(&js->unloader, unloader_cb, 0.0, 0.0);
+
 	/* Tables used to retrieve data. */
 	duk_push_object(js->ctx);
 	duk_put_global_string(js->ctx, JSAPI_PLUGIN_PROP_OPTIONS);
@@ -493,31 +2080,45 @@ init(const char *name, const char *path, const char *script)
 	duk_push_object(js->ctx);
 	duk_put_global_string(js->ctx, JSAPI_PLUGIN_PROP_PATHS);
 
-	/* Load Javascript APIs. */
+	/*
+	 * Load Javascript APIs, most plugins only use a few modules so they
+	 * are only created on first access except Irccd.Plugin which refers
+	 * to the plugin itself.
+	 */
 	jsapi_load(js->ctx);
-	jsapi_chrono_load(js->ctx);
-	jsapi_directory_load(js->ctx);
-	jsapi_file_load(js->ctx);
-	jsapi_hook_load(js->ctx);
+	jsapi_lazy(js->ctx, "Chrono", jsapi_chrono_load);
+	jsapi_lazy(js->ctx, "Directory", jsapi_directory_load);
+	jsapi_lazy(js->ctx, "File", jsapi_file_load);
+	jsapi_lazy(js->ctx, "Hook", jsapi_hook_load);
 #ifdef IRCCD_WITH_HTTP
-	jsapi_http_load(js->ctx);
+	jsapi_lazy(js->ctx, "Http", jsapi_http_load);
 #endif
-	jsapi_logger_load(js->ctx);
+	jsapi_lazy(js->ctx, "Logger", jsapi_logger_load);
 	jsapi_plugin_load(js->ctx, &js->parent);
-	jsapi_rule_load(js->ctx);
-	jsapi_server_load(js->ctx);
-	jsapi_system_load(js->ctx);
-	jsapi_timer_load(js->ctx);
-	jsapi_unicode_load(js->ctx);
-	jsapi_util_load(js->ctx);
+	jsapi_lazy(js->ctx, "Rule", jsapi_rule_load);
+	jsapi_lazy(js->ctx, "Server", jsapi_server_load);
+	jsapi_lazy(js->ctx, "System", jsapi_system_load);
+	jsapi_lazy(js->ctx, "Timer", jsapi_timer_load);
+	jsapi_lazy(js->ctx, "Unicode", jsapi_unicode_load);
+	jsapi_lazy(js->ctx, "Util", jsapi_util_load);
 
 	/* Finally execute the script. */
-	if (duk_peval_string(js->ctx, script) != 0) {
-		log_trace(js);
-		duk_destroy_heap(js->ctx);
-		free(js->location);
-		free(js);
-		return NULL;
+	if (compile(js->ctx, path, script, st) != 0)
+		goto err;
+
+	js_plugin_enter(&js->parent);
+
+	if (duk_pcall(js->ctx, 0) != 0) {
+		js_plugin_leave(&js->parent, DUK_EXEC_ERROR);
+		goto err;
+	}
+
+	js_plugin_leave(&js->parent, DUK_EXEC_SUCCESS);
+	duk_pop(js->ctx);
+
+	if (!js->shared) {
+		irc_metrics_register(&js->heap);
+		collector_metrics(&js->gc, irc_metrics_register);
 	}
 
 	irc_plugin_set_info(&js->parent,
@@ -527,39 +2128,104 @@ init(const char *name, const char *path, const char *script)
 	    metadata(js->ctx, "summary")
 	);
 
+	subscribe(js);
+
+	if (js->thread) {
+		heap_publish(js, &js->thread->usage);
+		js->thread->usage.peak = js->thread->usage.memory;
+	}
+
 	return js;
+
+err:
+	log_trace(js);
+	heap_close(js);
+
+	if (js->thread) {
+		thread_stop(js->thread);
+		thread_free(js->thread);
+	}
+
+	free(js->location);
+	free(js);
+
+	return NULL;
 }
 
+/*
+ * The plugin thread only starts once loaded, it then handles the events.
+ */
 static int
 load(struct irc_plugin *plg)
 {
-	return call(plg, "onLoad", "");
+	struct self *self = SELF(plg);
+	int ret;
+
+	ret = call(plg, "onLoad", "");
+	subscribe(self);
+
+	if (self->thread && !self->thread->started)
+		thread_start(self->thread);
+
+	return ret;
 }
 
 static void
 reload(struct irc_plugin *plg)
 {
+	struct self *self = SELF(plg);
+
+	heap_acquire(self);
 	call(plg, "onReload", "");
+	subscribe(self);
+	heap_release(self);
 }
 
 static void
 unload(struct irc_plugin *plg)
 {
+	struct self *self = SELF(plg);
+
+	heap_acquire(self);
 	call(plg, "onUnload", "");
+	heap_release(self);
 }
 
 static void
 finish(struct irc_plugin *plg)
 {
 	struct self *self = SELF(plg);
+	struct thread *t = self->thread;
+
+	/*
+	 * Removed from one of its own calls, either from its thread or from a
+	 * timer or request callback on the main thread. The plugin thread
+	 * stops after the current event and we are called again once the
+	 * call has returned.
+	 */
+	if (t && (t->serving || t->held)) {
+		atomic_store(&t->stop, 1);
+		ev_timer_start(&t->reaper);
+		return;
+	}
+
+	if (t)
+		thread_stop(t);
+
+	ev_timer_stop(&self->unloader);
+	irc_metrics_unregister(&self->heap);
+	collector_metrics(&self->gc, irc_metrics_unregister);
 
 	if (self->ctx)
-		duk_destroy_heap(self->ctx);
+		heap_close(self);
+	if (t)
+		thread_free(t);
 
 	freelist(self->options);
 	freelist(self->templates);
 	freelist(self->paths);
 
+	free(self->value);
 	free(self->location);
 	free(self);
 }
@@ -578,6 +2244,106 @@ wrap_finish(struct irc_plugin_loader *ldr)
 	free(ldr);
 }
 
+duk_bool_t
+js_plugin_timeout_check(void *udata)
+{
+	const struct self *self = udata ? udata : shared.current;
+
+	/* A threaded plugin stops what it does once removed. */
+	if (self && self->thread && atomic_load(&self->thread->stop))
+		return 1;
+
+	return self && self->deadline && now() >= self->deadline;
+}
+
+void
+js_plugin_enter(struct irc_plugin *js)
+{
+	struct self *self = SELF(js);
+
+	if (self->depth++)
+		return;
+
+	/* Nested calls share the deadline of the outermost one. */
+	if (js->timeout)
+		self->deadline = now() + js->timeout;
+
+	/* A plugin may call into another one through Irccd.Plugin. */
+	if (self->shared) {
+		self->prev = shared.current;
+		shared.current = self;
+	}
+}
+
+void
+js_plugin_leave(struct irc_plugin *js, int status)
+{
+	struct self *self = SELF(js);
+	int expired;
+
+	assert(self->depth);
+
+	expired = status != DUK_EXEC_SUCCESS && self->deadline &&
+	    now() >= self->deadline;
+
+	if (--self->depth)
+		return;
+
+	self->deadline = 0;
+
+	if (self->shared) {
+		shared.current = self->prev;
+		self->prev = NULL;
+	}
+
+	if (expired)
+		timeout(self);
+}
+
+void
+js_plugin_acquire(duk_context *ctx)
+{
+	struct self *self;
+
+	if ((self = heap_self(ctx)))
+		heap_acquire(self);
+}
+
+void
+js_plugin_release(duk_context *ctx)
+{
+	struct self *self;
+
+	if ((self = heap_self(ctx)))
+		heap_release(self);
+}
+
+void
+js_plugin_push_c_function(duk_context *ctx, duk_c_function fn, duk_idx_t nargs)
+{
+	struct self *self = heap_self(ctx);
+
+	if (!self || !self->thread) {
+		duk_push_c_function(ctx, fn, nargs);
+		return;
+	}
+
+	duk_push_c_function(ctx, marshal, nargs);
+	duk_push_pointer(ctx, (void *)fn);
+	duk_put_prop_string(ctx, -2, MARSHAL);
+}
+
+void
+js_plugin_put_function_list(duk_context *ctx, duk_idx_t index, const duk_function_list_entry *list)
+{
+	index = duk_normalize_index(ctx, index);
+
+	for (; list->key; ++list) {
+		js_plugin_push_c_function(ctx, list->value, list->nargs);
+		duk_put_prop_string(ctx, index, list->key);
+	}
+}
+
 duk_context *
 js_plugin_get_context(struct irc_plugin *js)
 {
@@ -593,12 +2359,13 @@ js_plugin_open(const char *name, const char *path)
 
 	char *script = NULL;
 	struct self *self;
+	struct stat st;
 
 	/*
 	 * Duktape can't open script from file path so we need to read the
 	 * whole script at once.
 	 */
-	if (!(script = eat(path))) {
+	if (!(script = eat(path, &st))) {
 		if (errno != ENOENT)
 			irc_log_warn("plugin: %s: %s", path, strerror(errno));
 
@@ -606,7 +2373,7 @@ js_plugin_open(const char *name, const char *path)
 	}
 
 	/* Init already log errors. */
-	if (!(self = init(name, path, script))) {
+	if (!(self = init(name, path, script, &st))) {
 		free(script);
 		return NULL;
 	}
@@ -632,6 +2399,24 @@ js_plugin_open(const char *name, const char *path)
 	return &self->parent;
 }
 
+void
+js_plugin_set_shared(int enable)
+{
+	shared.enabled = enable;
+}
+
+void
+js_plugin_set_threaded(int enable)
+{
+	threaded = enable;
+}
+
+void
+js_plugin_set_cache(const char *path)
+{
+	irc_util_strlcpy(cache, path ? path : "", sizeof (cache));
+}
+
 struct irc_plugin_loader *
 js_plugin_loader_new(void)
 {
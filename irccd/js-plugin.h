@@ -23,12 +23,78 @@
 
 struct irc_plugin;
 
+/*
+ * Called by Duktape from its interrupt handler with the heap udata, returns
+ * non-zero if the current call exceeded its deadline.
+ */
+duk_bool_t
+js_plugin_timeout_check(void *);
+
+/*
+ * Surround every call into the plugin heap that does not go through the
+ * plugin callbacks (timers, HTTP responses, ...) so that the execution time
+ * budget applies, status is the duk_pcall result.
+ */
+void
+js_plugin_enter(struct irc_plugin *);
+
+void
+js_plugin_leave(struct irc_plugin *, int);
+
+/*
+ * Surround every access to the heap from the main thread that does not go
+ * through the plugin callbacks (timers, HTTP responses, ...), the heap of a
+ * threaded plugin is used by its own thread otherwise. Calls may be nested.
+ */
+void
+js_plugin_acquire(duk_context *);
+
+void
+js_plugin_release(duk_context *);
+
+/*
+ * Like duk_push_c_function and duk_put_function_list for functions that use
+ * anything outside of the heap, they are run on the main thread when called
+ * from a threaded plugin.
+ */
+void
+js_plugin_push_c_function(duk_context *, duk_c_function, duk_idx_t);
+
+void
+js_plugin_put_function_list(duk_context *, duk_idx_t, const duk_function_list_entry *);
+
+/*
+ * For threaded plugins, only between js_plugin_acquire and js_plugin_release.
+ */
 duk_context *
 js_plugin_get_context(struct irc_plugin *);
 
 struct irc_plugin *
 js_plugin_open(const char *, const char *);
 
+/*
+ * Open the next plugins in a single heap shared with every other plugin
+ * opened that way, each one within its own global environment. Plugins
+ * already opened are not affected.
+ */
+void
+js_plugin_set_shared(int);
+
+/*
+ * Run the next plugins on their own thread, each one with its own heap. Events
+ * are queued for the plugin and everything it does outside of its heap runs
+ * on the main thread. Plugins already opened are not affected.
+ */
+void
+js_plugin_set_threaded(int);
+
+/*
+ * Directory where compiled scripts are cached, NULL disables the cache.
+ * Disabled by default.
+ */
+void
+js_plugin_set_cache(const char *);
+
 struct irc_plugin_loader *
 js_plugin_loader_new(void);
 
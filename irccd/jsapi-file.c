@@ -28,6 +28,7 @@
 #include <irccd/util.h>
 
 #include "jsapi-file.h"
+#include "jsapi-irccd.h"
 #include "jsapi-system.h"
 
 #define SIGNATURE DUK_HIDDEN_SYMBOL("Irccd.File")
@@ -485,6 +486,8 @@ jsapi_file_push(duk_context *ctx, const char *path, FILE *fp, int (*finalizer)(F
 	if (path)
 		irc_util_strlcpy(file.path, path, sizeof (file.path));
 
+	jsapi_require(ctx, "File");
+
 	duk_push_object(ctx);
 	duk_push_pointer(ctx, irc_util_memdup(&file, sizeof (file)));
 	duk_put_prop_string(ctx, -2, SIGNATURE);
@@ -23,6 +23,7 @@
 #include <irccd/hook.h>
 #include <irccd/irccd.h>
 
+#include "js-plugin.h"
 #include "jsapi-hook.h"
 
 static int
@@ -81,7 +82,7 @@ jsapi_hook_load(duk_context *ctx)
 
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_put_function_list(ctx, -1, functions);
 	duk_put_prop_string(ctx, -2, "Hook");
 	duk_pop(ctx);
 }
@@ -34,6 +34,7 @@
 #include <irccd/util.h>
 
 #include "jsapi-http.h"
+#include "js-plugin.h"
 #include "jsapi-plugin.h"
 #include "jsapi-system.h"
 
@@ -105,11 +106,14 @@ request_attach(struct request *req, duk_context *ctx, duk_idx_t index)
 	req->addr = duk_get_heapptr(ctx, index);
 	duk_push_pointer(ctx, req);
 	duk_put_prop_string(ctx, index, SIGNATURE);
-	duk_push_c_function(ctx, Http_destructor, 1);
+	js_plugin_push_c_function(ctx, Http_destructor, 1);
 	duk_set_finalizer(ctx, index);
 
-	/* Now link this callback into the heap stash using its "pointer". */
-	duk_push_heap_stash(ctx);
+	/*
+	 * Now link this callback into the global stash using its "pointer",
+	 * it is only reachable from the plugin global environment.
+	 */
+	duk_push_global_stash(ctx);
 	duk_push_pointer(ctx, req->addr);
 	duk_dup(ctx, index);
 	duk_put_prop(ctx, -3);
@@ -119,7 +123,7 @@ request_attach(struct request *req, duk_context *ctx, duk_idx_t index)
 static inline void
 request_detach(struct request *req)
 {
-	duk_push_heap_stash(req->ctx);
+	duk_push_global_stash(req->ctx);
 	duk_del_prop_heapptr(req->ctx, -1, req->addr);
 	duk_pop(req->ctx);
 }
@@ -165,6 +169,8 @@ static void
 request_complete(struct request *req)
 {
 	struct irc_plugin *plg;
+	duk_context *ctx = req->ctx;
+	int rc;
 
 	/* Close file pointer to retrieve data. */
 	fflush(req->fp);
@@ -172,6 +178,7 @@ request_complete(struct request *req)
 	req->fp = NULL;
 
 	/* Get reference to the plugin. */
+	js_plugin_acquire(ctx);
 	plg = jsapi_plugin_self(req->ctx);
 
 	/*
@@ -200,13 +207,18 @@ request_complete(struct request *req)
 	req->out = NULL;
 	req->outsz = 0;
 
-	if (duk_pcall(req->ctx, 1) != 0)
+	js_plugin_enter(plg);
+	rc = duk_pcall(req->ctx, 1);
+	js_plugin_leave(plg, rc);
+
+	if (rc != 0)
 		irc_log_warn("plugin %s: %s", plg->name, duk_to_string(req->ctx, -1));
 
 	duk_pop(req->ctx);
 
 	/* Unlink the object from the stash. */
 	request_detach(req);
+	js_plugin_release(ctx);
 }
 
 static void
@@ -401,7 +413,7 @@ jsapi_http_load(duk_context *ctx)
 
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_put_function_list(ctx, -1, functions);
 	duk_put_prop_string(ctx, -2, "Http");
 	duk_pop(ctx);
 
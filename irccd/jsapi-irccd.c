@@ -25,6 +25,11 @@
 #include <irccd/config.h>
 #include <irccd/util.h>
 
+#include "jsapi-irccd.h"
+
+#define LAZY_NAME       DUK_HIDDEN_SYMBOL("Irccd.lazy.name")
+#define LAZY_LOAD       DUK_HIDDEN_SYMBOL("Irccd.lazy.load")
+
 static int
 SystemError_constructor(duk_context *ctx)
 {
@@ -292,6 +297,60 @@ print(duk_context *ctx)
 	return 0;
 }
 
+/*
+ * Getter installed by jsapi_lazy, replaces itself with the module.
+ */
+static int
+lazy_get(duk_context *ctx)
+{
+	void (*load)(duk_context *);
+	const char *name;
+
+	duk_push_current_function(ctx);
+	duk_get_prop_string(ctx, -1, LAZY_LOAD);
+	load = (void (*)(duk_context *))duk_get_pointer(ctx, -1);
+	duk_get_prop_string(ctx, -2, LAZY_NAME);
+	name = duk_get_string(ctx, -1);
+
+	/* The name is kept alive by the function on the stack. */
+	duk_get_global_string(ctx, "Irccd");
+	duk_del_prop_string(ctx, -1, name);
+	load(ctx);
+	duk_get_prop_string(ctx, -1, name);
+
+	return 1;
+}
+
+void
+jsapi_lazy(duk_context *ctx, const char *name, void (*load)(duk_context *))
+{
+	assert(ctx);
+	assert(name);
+	assert(load);
+
+	duk_get_global_string(ctx, "Irccd");
+	duk_push_string(ctx, name);
+	duk_push_c_function(ctx, lazy_get, 0);
+	duk_push_pointer(ctx, (void *)load);
+	duk_put_prop_string(ctx, -2, LAZY_LOAD);
+	duk_push_string(ctx, name);
+	duk_put_prop_string(ctx, -2, LAZY_NAME);
+	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_GETTER |
+	    DUK_DEFPROP_SET_CONFIGURABLE | DUK_DEFPROP_SET_ENUMERABLE);
+	duk_pop(ctx);
+}
+
+void
+jsapi_require(duk_context *ctx, const char *name)
+{
+	assert(ctx);
+	assert(name);
+
+	duk_get_global_string(ctx, "Irccd");
+	duk_get_prop_string(ctx, -1, name);
+	duk_pop_2(ctx);
+}
+
 void
 jsapi_load(duk_context *ctx)
 {
@@ -24,4 +24,18 @@
 void
 jsapi_load(duk_context *);
 
+/*
+ * Install Irccd.<name> as a getter which calls the module loader on first
+ * access and is then replaced by the module itself.
+ */
+void
+jsapi_lazy(duk_context *, const char *, void (*)(duk_context *));
+
+/*
+ * Make sure the lazy module Irccd.<name> is loaded, for functions that need
+ * its prototype without going through the Irccd object.
+ */
+void
+jsapi_require(duk_context *, const char *);
+
 #endif /* !IRCCD_JSAPI_IRCCD_H */
@@ -23,21 +23,23 @@
 #include <irccd/plugin.h>
 #include <irccd/log.h>
 
+#include "js-plugin.h"
 #include "jsapi-logger.h"
 #include "jsapi-plugin.h"
 
-#define LOG(c, f)                                                       \
+#define LOG(c, l)                                                       \
 do {                                                                    \
         const struct irc_plugin *p = jsapi_plugin_self(c);              \
         const char *message = duk_require_string(c, 0);                 \
                                                                         \
-        f("plugin %s: %s", p->name, message);                           \
+        IRC_LOG(IRC_LOG_SUBSYSTEM_PLUGIN, l, "plugin %s: %s",           \
+            p->name, message);                                          \
 } while (0)                                                             \
 
 static int
 Logger_info(duk_context *ctx)
 {
-	LOG(ctx, irc_log_info);
+	LOG(ctx, IRC_LOG_LEVEL_INFO);
 
 	return 0;
 }
@@ -45,7 +47,7 @@ Logger_info(duk_context *ctx)
 static int
 Logger_warning(duk_context *ctx)
 {
-	LOG(ctx, irc_log_warn);
+	LOG(ctx, IRC_LOG_LEVEL_WARN);
 
 	return 0;
 }
@@ -53,7 +55,7 @@ Logger_warning(duk_context *ctx)
 static int
 Logger_debug(duk_context *ctx)
 {
-	LOG(ctx, irc_log_debug);
+	LOG(ctx, IRC_LOG_LEVEL_DEBUG);
 
 	return 0;
 }
@@ -72,7 +74,7 @@ jsapi_logger_load(duk_context *ctx)
 
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_put_function_list(ctx, -1, functions);
 	duk_put_prop_string(ctx, -2, "Logger");
 	duk_pop(ctx);
 }
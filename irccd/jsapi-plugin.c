@@ -23,6 +23,7 @@
 #include <irccd/irccd.h>
 #include <irccd/plugin.h>
 
+#include "js-plugin.h"
 #include "jsapi-plugin.h"
 
 #define SIGNATURE DUK_HIDDEN_SYMBOL("Irccd.Plugin")
@@ -188,7 +189,8 @@ Plugin_load(duk_context *ctx)
 static int
 Plugin_reload(duk_context *ctx)
 {
-	irc_plugin_reload(find(ctx));
+	/* Use find so it can raise ReferenceError if not found. */
+	irc_bot_plugin_reload(find(ctx)->name);
 
 	return 0;
 }
@@ -223,7 +225,7 @@ jsapi_plugin_load(duk_context *ctx, struct irc_plugin *p)
 
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_put_function_list(ctx, -1, functions);
 
 	/* 'config' property. */
 	duk_push_string(ctx, "config");
@@ -25,6 +25,7 @@
 #include <irccd/rule.h>
 #include <irccd/util.h>
 
+#include "js-plugin.h"
 #include "jsapi-rule.h"
 
 static void
@@ -158,7 +159,7 @@ jsapi_rule_load(duk_context *ctx)
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
 	duk_put_number_list(ctx, -1, actions);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_put_function_list(ctx, -1, functions);
 	duk_put_prop_string(ctx, -2, "Rule");
 	duk_pop(ctx);
 }
@@ -28,10 +28,20 @@
 #include <irccd/server.h>
 #include <irccd/util.h>
 
+#include "js-plugin.h"
+#include "jsapi-irccd.h"
 #include "jsapi-server.h"
 
 #define SIGNATURE DUK_HIDDEN_SYMBOL("Irccd.Server")
 #define PROTOTYPE DUK_HIDDEN_SYMBOL("Irccd.Server.prototype")
+#define CACHE     DUK_HIDDEN_SYMBOL("Irccd.Server.cache")
+#define REMOVALS  DUK_HIDDEN_SYMBOL("Irccd.Server.cache.removals")
+#define USERS     DUK_HIDDEN_SYMBOL("Irccd.Server.users.prototype")
+#define CHANNEL   DUK_HIDDEN_SYMBOL("Irccd.Server.users.channel")
+#define SERVER    DUK_HIDDEN_SYMBOL("Irccd.Server.users.server")
+#define CURSOR    DUK_HIDDEN_SYMBOL("Irccd.Server.users.cursor")
+#define NEXT      DUK_HIDDEN_SYMBOL("Irccd.Server.users.next")
+#define STAMP     DUK_HIDDEN_SYMBOL("Irccd.Server.users.removals")
 
 static struct irc_server *
 self(duk_context *ctx)
@@ -220,6 +230,127 @@ get_ctcp(duk_context *ctx, duk_idx_t obj_idx, struct irc_server *s)
 	irc_server_set_ctcp(s, ctcp_version, ctcp_source);
 }
 
+/*
+ * Store the next user to return in the iterator at the given index. The user
+ * nickname is kept to find it again if users were removed in the meantime.
+ */
+static void
+users_set(duk_context *ctx, duk_idx_t obj_idx, const struct irc_channel_user *u)
+{
+	obj_idx = duk_normalize_index(ctx, obj_idx);
+
+	duk_push_pointer(ctx, (void *)u);
+	duk_put_prop_string(ctx, obj_idx, CURSOR);
+	duk_push_number(ctx, irc_channel_removals);
+	duk_put_prop_string(ctx, obj_idx, STAMP);
+
+	if (u)
+		duk_push_string(ctx, u->nickname);
+	else
+		duk_push_undefined(ctx);
+
+	duk_put_prop_string(ctx, obj_idx, NEXT);
+}
+
+static int
+Users_prototype_next(duk_context *ctx)
+{
+	const struct irc_channel *c;
+	const struct irc_channel_user *u;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, CURSOR);
+	u = duk_get_pointer(ctx, -1);
+	duk_get_prop_string(ctx, -2, STAMP);
+
+	/* The user may be gone, look it up again by its nickname. */
+	if (u && duk_get_number(ctx, -1) != irc_channel_removals) {
+		duk_get_prop_string(ctx, -3, SERVER);
+		duk_get_prop_string(ctx, -4, CHANNEL);
+		duk_get_prop_string(ctx, -5, NEXT);
+
+		if ((c = irc_server_channels_find(require(ctx, -3), duk_get_string(ctx, -2))))
+			u = irc_channel_get(c, duk_get_string(ctx, -1));
+		else
+			u = NULL;
+
+		duk_pop_3(ctx);
+	}
+
+	duk_pop_2(ctx);
+	duk_push_object(ctx);
+	duk_push_boolean(ctx, !u);
+	duk_put_prop_string(ctx, -2, "done");
+
+	if (u) {
+		duk_push_object(ctx);
+		duk_push_string(ctx, u->nickname);
+		duk_put_prop_string(ctx, -2, "nickname");
+		duk_push_int(ctx, u->modes);
+		duk_put_prop_string(ctx, -2, "modes");
+		duk_put_prop_string(ctx, -2, "value");
+	}
+
+	users_set(ctx, -2, u ? u->next : NULL);
+
+	return 1;
+}
+
+static void
+channel_push(duk_context *ctx, const struct irc_channel *c)
+{
+	duk_push_object(ctx);
+	duk_push_string(ctx, c->name);
+	duk_put_prop_string(ctx, -2, "name");
+	duk_push_boolean(ctx, c->flags & IRC_CHANNEL_FLAGS_JOINED);
+	duk_put_prop_string(ctx, -2, "joined");
+}
+
+static int
+Server_prototype_channel(duk_context *ctx)
+{
+	const struct irc_channel *c;
+
+	if (!(c = irc_server_channels_find(self(ctx), duk_require_string(ctx, 0))))
+		return 0;
+
+	channel_push(ctx, c);
+
+	return 1;
+}
+
+static int
+Server_prototype_channels(duk_context *ctx)
+{
+	const struct irc_channel *c;
+	duk_uarridx_t i = 0;
+
+	duk_push_array(ctx);
+
+	LL_FOREACH(self(ctx)->channels, c) {
+		channel_push(ctx, c);
+		duk_put_prop_index(ctx, -2, i++);
+	}
+
+	return 1;
+}
+
+static int
+Server_prototype_nickname(duk_context *ctx)
+{
+	duk_push_string(ctx, self(ctx)->nickname);
+
+	return 1;
+}
+
+static int
+Server_prototype_prefix(duk_context *ctx)
+{
+	duk_push_string(ctx, self(ctx)->prefix);
+
+	return 1;
+}
+
 static int
 Server_prototype_info(duk_context *ctx)
 {
@@ -281,6 +412,7 @@ Server_prototype_info(duk_context *ctx)
 		duk_push_boolean(ctx, c->flags & IRC_CHANNEL_FLAGS_JOINED);
 		duk_put_prop_string(ctx, -2, "joined");
 		duk_push_array(ctx);
+		ui = 0;
 
 		LL_FOREACH(c->users, u) {
 			duk_push_object(ctx);
@@ -312,6 +444,17 @@ Server_prototype_invite(duk_context *ctx)
 	return 1;
 }
 
+static int
+Server_prototype_isJoined(duk_context *ctx)
+{
+	const struct irc_channel *c;
+
+	c = irc_server_channels_find(self(ctx), duk_require_string(ctx, 0));
+	duk_push_boolean(ctx, c && (c->flags & IRC_CHANNEL_FLAGS_JOINED));
+
+	return 1;
+}
+
 static int
 Server_prototype_isSelf(duk_context *ctx)
 {
@@ -474,6 +617,25 @@ Server_prototype_toString(duk_context *ctx)
 	return 1;
 }
 
+static int
+Server_prototype_users(duk_context *ctx)
+{
+	const struct irc_channel *c;
+
+	c = irc_server_channels_find(self(ctx), duk_require_string(ctx, 0));
+
+	duk_push_object(ctx);
+	duk_get_global_string(ctx, USERS);
+	duk_set_prototype(ctx, -2);
+	duk_push_this(ctx);
+	duk_put_prop_string(ctx, -2, SERVER);
+	duk_dup(ctx, 0);
+	duk_put_prop_string(ctx, -2, CHANNEL);
+	users_set(ctx, -1, c ? c->users : NULL);
+
+	return 1;
+}
+
 static int
 Server_constructor(duk_context *ctx)
 {
@@ -560,8 +722,11 @@ Server_remove(duk_context *ctx)
 }
 
 static const duk_function_list_entry methods[] = {
+	{ "channel",    Server_prototype_channel,       1               },
+	{ "channels",   Server_prototype_channels,      0               },
 	{ "info",       Server_prototype_info,          0               },
 	{ "invite",     Server_prototype_invite,        2               },
+	{ "isJoined",   Server_prototype_isJoined,      1               },
 	{ "isSelf",     Server_prototype_isSelf,        1               },
 	{ "join",       Server_prototype_join,          DUK_VARARGS     },
 	{ "kick",       Server_prototype_kick,          DUK_VARARGS     },
@@ -575,10 +740,19 @@ static const duk_function_list_entry methods[] = {
 	{ "send",       Server_prototype_send,          1               },
 	{ "topic",      Server_prototype_topic,         2               },
 	{ "toString",   Server_prototype_toString,      0               },
+	{ "users",      Server_prototype_users,         1               },
 	{ "whois",      Server_prototype_whois,         1               },
 	{ NULL,         NULL,                           0               }
 };
 
+/* Read-only properties. */
+static const duk_function_list_entry properties[] = {
+	{ "name",       Server_prototype_toString,      0               },
+	{ "nickname",   Server_prototype_nickname,      0               },
+	{ "prefix",     Server_prototype_prefix,        0               },
+	{ NULL,         NULL,                           0               }
+};
+
 static const duk_function_list_entry functions[] = {
 	{ "add",        Server_add,                     1               },
 	{ "find",       Server_find,                    1               },
@@ -594,17 +768,89 @@ jsapi_server_load(duk_context *ctx)
 
 	duk_get_global_string(ctx, "Irccd");
 
-	duk_push_c_function(ctx, Server_constructor, 1);
-	duk_put_function_list(ctx, -1, functions);
+	js_plugin_push_c_function(ctx, Server_constructor, 1);
+	js_plugin_put_function_list(ctx, -1, functions);
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, methods);
-	duk_push_c_function(ctx, Server_destructor, 1);
+	js_plugin_put_function_list(ctx, -1, methods);
+
+	for (const duk_function_list_entry *p = properties; p->key; ++p) {
+		duk_push_string(ctx, p->key);
+		js_plugin_push_c_function(ctx, p->value, p->nargs);
+		duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_GETTER);
+	}
+
+	js_plugin_push_c_function(ctx, Server_destructor, 1);
 	duk_set_finalizer(ctx, -2);
 	duk_dup_top(ctx);
 	duk_put_global_string(ctx, PROTOTYPE);
 	duk_put_prop_string(ctx, -2, "prototype");
 	duk_put_prop_string(ctx, -2, "Server");
 	duk_pop(ctx);
+
+	/* Prototype of the iterators returned by Server.prototype.users. */
+	duk_push_object(ctx);
+	js_plugin_push_c_function(ctx, Users_prototype_next, 0);
+	duk_put_prop_string(ctx, -2, "next");
+	duk_put_global_string(ctx, USERS);
+}
+
+/*
+ * Remove the objects of servers no longer in the bot from the cache on top of
+ * the stack, they are released once the plugin drops them as well.
+ */
+static void
+cache_sweep(duk_context *ctx)
+{
+	struct irc_server *s, *it;
+
+	duk_enum(ctx, -1, 0);
+
+	while (duk_next(ctx, -1, 1)) {
+		duk_get_prop_string(ctx, -1, SIGNATURE);
+		s = duk_get_pointer(ctx, -1);
+		duk_pop_2(ctx);
+
+		LL_FOREACH(irccd->servers, it)
+			if (it == s)
+				break;
+
+		if (it)
+			duk_pop(ctx);
+		else
+			duk_del_prop(ctx, -3);
+	}
+
+	duk_pop(ctx);
+}
+
+/*
+ * Push the cache of server objects from the global stash, the cache is swept
+ * first if a server was removed since the last time.
+ */
+static void
+cache_push(duk_context *ctx)
+{
+	double removals;
+
+	duk_push_global_stash(ctx);
+
+	if (!duk_get_prop_string(ctx, -1, CACHE)) {
+		duk_pop(ctx);
+		duk_push_object(ctx);
+		duk_dup(ctx, -1);
+		duk_put_prop_string(ctx, -3, CACHE);
+	}
+
+	duk_remove(ctx, -2);
+	duk_get_prop_string(ctx, -1, REMOVALS);
+	removals = duk_get_number_default(ctx, -1, 0);
+	duk_pop(ctx);
+
+	if (removals != irccd->server_removals) {
+		cache_sweep(ctx);
+		duk_push_number(ctx, irccd->server_removals);
+		duk_put_prop_string(ctx, -2, REMOVALS);
+	}
 }
 
 void
@@ -613,6 +859,18 @@ jsapi_server_push(duk_context *ctx, struct irc_server *s)
 	assert(ctx);
 	assert(s);
 
+	jsapi_require(ctx, "Server");
+
+	/* Events reuse the same object for a server. */
+	cache_push(ctx);
+	duk_push_pointer(ctx, s);
+
+	if (duk_get_prop(ctx, -2)) {
+		duk_remove(ctx, -2);
+		return;
+	}
+
+	duk_pop(ctx);
 	irc_server_incref(s);
 
 	duk_push_object(ctx);
@@ -620,4 +878,9 @@ jsapi_server_push(duk_context *ctx, struct irc_server *s)
 	duk_put_prop_string(ctx, -2, SIGNATURE);
 	duk_get_global_string(ctx, PROTOTYPE);
 	duk_set_prototype(ctx, -2);
+
+	duk_push_pointer(ctx, s);
+	duk_dup(ctx, -2);
+	duk_put_prop(ctx, -4);
+	duk_remove(ctx, -2);
 }
@@ -26,6 +26,7 @@
 #include <irccd/plugin.h>
 #include <irccd/util.h>
 
+#include "js-plugin.h"
 #include "jsapi-plugin.h"
 
 #define SIGNATURE       DUK_HIDDEN_SYMBOL("Irccd.Timer")
@@ -46,19 +47,29 @@ struct stimer {
 static void
 stimer_cb(struct ev_timer *self, int)
 {
-	const struct irc_plugin *plg;
+	struct irc_plugin *plg;
 	struct stimer *st;
+	duk_context *ctx;
+	int rc;
 
 	st = IRC_UTIL_CONTAINER_OF(self, struct stimer, timer);
+	ctx = st->ctx;
+
+	js_plugin_acquire(ctx);
 	plg = jsapi_plugin_self(st->ctx);
 
 	duk_push_heapptr(st->ctx, st->addr);
 	duk_push_string(st->ctx, PROP_CALLBACK);
 
-	if (duk_pcall_prop(st->ctx, -2, 0) != DUK_EXEC_SUCCESS)
+	js_plugin_enter(plg);
+	rc = duk_pcall_prop(st->ctx, -2, 0);
+	js_plugin_leave(plg, rc);
+
+	if (rc != DUK_EXEC_SUCCESS)
 		irc_log_warn("plugin %s: %s", plg->name, duk_to_string(st->ctx, -1));
 
 	duk_pop_n(st->ctx, 2);
+	js_plugin_release(ctx);
 }
 
 static inline void
@@ -139,7 +150,7 @@ Timer_destructor(duk_context *ctx)
 	duk_get_prop_string(ctx, 0, SIGNATURE);
 	st = duk_to_pointer(ctx, -1);
 	duk_pop(ctx);
-	duk_del_prop_string(ctx, -2, SIGNATURE);
+	duk_del_prop_string(ctx, 0, SIGNATURE);
 
 	if (st) {
 		stimer_stop(st);
@@ -174,7 +185,7 @@ Timer_constructor(duk_context *ctx)
 	duk_push_this(ctx);
 	duk_push_pointer(ctx, st);
 	duk_put_prop_string(ctx, -2, SIGNATURE);
-	duk_push_c_function(ctx, Timer_destructor, 1);
+	js_plugin_push_c_function(ctx, Timer_destructor, 1);
 	duk_set_finalizer(ctx, -2);
 
 	/* Reference this object itself into the timer to retrieve it later on. */
@@ -208,10 +219,10 @@ jsapi_timer_load(duk_context *ctx)
 	assert(ctx);
 
 	duk_get_global_string(ctx, "Irccd");
-	duk_push_c_function(ctx, Timer_constructor, 3);
+	js_plugin_push_c_function(ctx, Timer_constructor, 3);
 	duk_put_number_list(ctx, -1, constants);
 	duk_push_object(ctx);
-	duk_put_function_list(ctx, -1, methods);
+	js_plugin_put_function_list(ctx, -1, methods);
 	duk_put_prop_string(ctx, -2, "prototype");
 	duk_put_prop_string(ctx, -2, "Timer");
 	duk_pop(ctx);
@@ -24,8 +24,20 @@
 #include <irccd/subst.h>
 #include <irccd/util.h>
 
+#include "js-plugin.h"
 #include "jsapi-util.h"
 
+/*
+ * Templates compiled by Irccd.Util.format indexed by a hash of their source,
+ * plugins usually format the same few templates over and over.
+ */
+#define TEMPLATES 64
+
+static struct {
+	char *source;
+	struct irc_subst_template *tpl;
+} templates[TEMPLATES];
+
 struct subspack {
 	struct irc_subst_keyword *kw;
 	struct irc_subst subst;
@@ -100,6 +112,32 @@ subspack_parse(duk_context *ctx, duk_idx_t index, struct subspack *pkg)
 	pkg->subst.keywords = pkg->kw;
 }
 
+static const struct irc_subst_template *
+template(const char *source)
+{
+	struct irc_subst_template *tpl;
+	unsigned long hash = 5381;
+	size_t i;
+
+	for (const char *p = source; *p; ++p)
+		hash = hash * 33 + (unsigned char)*p;
+
+	i = hash % TEMPLATES;
+
+	if (templates[i].source && strcmp(templates[i].source, source) == 0)
+		return templates[i].tpl;
+	if (!(tpl = irc_subst_compile(source)))
+		return NULL;
+
+	/* Replace any template that was in that slot. */
+	free(templates[i].source);
+	irc_subst_free(templates[i].tpl);
+	templates[i].source = irc_util_strdup(source);
+	templates[i].tpl = tpl;
+
+	return tpl;
+}
+
 static struct string *
 string_new(const char *v)
 {
@@ -269,11 +307,15 @@ static int
 Util_format(duk_context *ctx)
 {
 	const char *str = duk_require_string(ctx, 0);
+	const struct irc_subst_template *tpl;
 	struct subspack pkg;
 	char buf[1024] = {0};
 
 	subspack_parse(ctx, 1, &pkg);
-	irc_subst(buf, sizeof (buf), str, &pkg.subst);
+
+	if ((tpl = template(str)))
+		irc_subst_exec(tpl, buf, sizeof (buf), &pkg.subst);
+
 	duk_push_string(ctx, buf);
 	subspack_finish(&pkg);
 
@@ -312,7 +354,6 @@ Util_splithost(duk_context *ctx)
 
 static const duk_function_list_entry functions[] = {
 	{ "cut",        Util_cut,       DUK_VARARGS     },
-	{ "format",     Util_format,    DUK_VARARGS     },
 	{ "splituser",  Util_splituser, 1               },
 	{ "splithost",  Util_splithost, 1               },
 	{ NULL,         NULL,           0               }
@@ -324,6 +365,10 @@ jsapi_util_load(duk_context *ctx)
 	duk_get_global_string(ctx, "Irccd");
 	duk_push_object(ctx);
 	duk_put_function_list(ctx, -1, functions);
+
+	/* Templates are cached and substituted by the main thread. */
+	js_plugin_push_c_function(ctx, Util_format, DUK_VARARGS);
+	duk_put_prop_string(ctx, -2, "format");
 	duk_put_prop_string(ctx, -2, "Util");
 	duk_pop(ctx);
 }
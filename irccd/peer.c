@@ -16,22 +16,28 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include <utlist.h>
 
+#include <irccd/event.h>
 #include <irccd/hook.h>
 #include <irccd/irccd.h>
 #include <irccd/log.h>
+#include <irccd/metrics.h>
 #include <irccd/plugin.h>
 #include <irccd/rule.h>
 #include <irccd/server.h>
@@ -42,6 +48,17 @@
 #define PEER(Ptr, Field) \
         (IRC_UTIL_CONTAINER_OF(Ptr, struct peer, Field))
 
+#define DEBUG(...) IRC_LOG(IRC_LOG_SUBSYSTEM_TRANSPORT, IRC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* Chunks written at once. */
+#define PEER_IOV 32
+
+struct irc_metric peer_dropped = {
+	.name = "irccd_transport_events_dropped_total",
+	.help = "Events dropped for slow clients.",
+	.type = IRC_METRIC_COUNTER
+};
+
 typedef void (*plugin_set_fn)(struct irc_plugin *, const char *, const char *);
 typedef const char * (*plugin_get_fn)(struct irc_plugin *, const char *);
 typedef const char * const * (*plugin_list_fn)(struct irc_plugin *);
@@ -160,11 +177,11 @@ plugin_list_set(struct peer *p,
 		for (const char * const *key = keys; key && *key; ++key)
 			keysz++;
 
-		fprintf(fp, "OK %zu\n", keysz);
+		fprintf(fp, "OK %zu", keysz);
 
 		for (const char * const *key = keys; key && *key; ++key) {
 			value = get(plg, *key);
-			fprintf(fp, "%s=%s\n", *key, value ? value : "");
+			fprintf(fp, "\n%s=%s", *key, value ? value : "");
 		}
 	}
 
@@ -177,6 +194,8 @@ plugin_list_set(struct peer *p,
 static void
 rule_list_to_string(FILE *fp, char * const *values)
 {
+	fprintf(fp, "\n");
+
 	if (values) {
 		for (char * const *c = values; *c; ++c) {
 			fprintf(fp, "%s", *c);
@@ -185,8 +204,6 @@ rule_list_to_string(FILE *fp, char * const *values)
 				fputc(' ', fp);
 		}
 	}
-
-	fprintf(fp, "\n");
 }
 
 /*
@@ -253,6 +270,49 @@ cmd_hook_remove(struct peer *p, char *line)
 	return ok(p);
 }
 
+/*
+ * LOG-LEVEL [subsystem [level]]
+ */
+static int
+cmd_log_level(struct peer *p, char *line)
+{
+	const char *args[2] = {0}, *name;
+	size_t argsz, sub, level;
+
+	if ((argsz = parse(line, args, 2)) == 0) {
+		peer_push(p, "OK %d", IRC_LOG_SUBSYSTEM_NUM);
+
+		for (sub = 0; sub < IRC_LOG_SUBSYSTEM_NUM; ++sub)
+			peer_push(p, "%s=%s", irc_log_subsystem_name(sub),
+			    irc_log_level_name(irc_log_levels[sub]));
+
+		return 0;
+	}
+
+	for (sub = 0; (name = irc_log_subsystem_name(sub)); ++sub)
+		if (strcmp(name, args[0]) == 0)
+			break;
+
+	if (!name)
+		return EINVAL;
+
+	if (argsz == 1) {
+		peer_push(p, "OK 1\n%s", irc_log_level_name(irc_log_levels[sub]));
+		return 0;
+	}
+
+	for (level = 0; (name = irc_log_level_name(level)); ++level)
+		if (strcmp(name, args[1]) == 0)
+			break;
+
+	if (!name)
+		return EINVAL;
+
+	irc_log_set_level(sub, level);
+
+	return ok(p);
+}
+
 /*
  * PLUGIN-CONFIG plugin [var [value]]
  */
@@ -277,8 +337,9 @@ cmd_plugin_info(struct peer *p, char *line)
 	if (!(plg = require_plugin(p, args[0])))
 		return 0;
 
-	peer_push(p, "OK %s\n%s\n%s\n%s\n%s", plg->name, plg->description,
-	    plg->version, plg->license, plg->author);
+	peer_push(p, "OK %s\n%s\n%s\n%s\n%s\n%zu %zu %zu %llu", plg->name,
+	    plg->description, plg->version, plg->license, plg->author,
+	    plg->memory, plg->memory_peak, plg->memory_limit, plg->memory_failures);
 
 	return 0;
 }
@@ -352,13 +413,148 @@ cmd_plugin_reload(struct peer *p, char *line)
 	const char *args[1] = {0};
 
 	if (parse(line, args, 1) == 1) {
-		if (!(plg = irc_bot_plugin_get(args[0])))
+		if (irc_bot_plugin_reload(args[0]) < 0)
 			return peer_push(p, "could not reload plugin: %s", strerror(ENOENT)), 0;
-
-		irc_plugin_reload(plg);
 	} else
 		DL_FOREACH(irccd->plugins, plg)
-			irc_plugin_reload(plg);
+			irc_bot_plugin_reload(plg->name);
+
+	return ok(p);
+}
+
+static void
+plugin_stats_print(FILE *fp, const char *name, const struct irc_plugin_stats *st)
+{
+	fprintf(fp, "\n%s %llu %llu %llu %llu %llu %llu %llu", name,
+	    st->count, st->errors, st->total / st->count,
+	    irc_plugin_stats_percentile(st, 50),
+	    irc_plugin_stats_percentile(st, 90),
+	    irc_plugin_stats_percentile(st, 99),
+	    st->max);
+}
+
+/*
+ * Send a reply that may not fit below the high watermark in pieces of whole
+ * lines, waiting for the peer to read the previous ones. Events are dropped
+ * meanwhile rather than interleaved with the reply.
+ */
+static int
+reply(struct peer *p, const char *data)
+{
+	const char *end;
+	size_t rest, len, max;
+	int last, rc = 0;
+
+	rest = strlen(data);
+	max = p->limits.high - p->limits.low;
+	p->is_replying = 1;
+
+	while (rest) {
+		len = rest;
+
+		/* As many lines as fit, a longer line is sent alone. */
+		if (len > max) {
+			if ((end = memrchr(data, '\n', max)) || (end = memchr(data, '\n', rest)))
+				len = end - data + 1;
+		}
+
+		/* Every piece but the last ends with a newline, added back. */
+		last = len == rest;
+
+		if ((rc = peer_wait(p, len + last)) < 0 ||
+		    (rc = peer_push(p, "%.*s", (int)(len - !last), data)) < 0)
+			break;
+
+		data += len;
+		rest -= len;
+	}
+
+	p->is_replying = 0;
+
+	return rc;
+}
+
+/*
+ * PLUGIN-STATS [plugin]
+ */
+static int
+cmd_plugin_stats(struct peer *p, char *line)
+{
+	const char *args[1] = {0};
+	struct irc_plugin *plg = NULL;
+	struct irc_plugin_stats st;
+	char *out = NULL;
+	size_t outsz = 0, n = 0;
+	FILE *fp;
+	int rc;
+
+	if (parse(line, args, 1) == 1 && !(plg = require_plugin(p, args[0])))
+		return 0;
+	if (!(fp = open_memstream(&out, &outsz)))
+		return errno;
+
+	if (args[0]) {
+		/* Every event type that was invoked at least once. */
+		for (int i = 0; i < IRC_EVENT_NUM; ++i)
+			if (plg->stats[i].count)
+				n++;
+
+		fprintf(fp, "OK %zu", n);
+
+		for (int i = 0; i < IRC_EVENT_NUM; ++i)
+			if (plg->stats[i].count)
+				plugin_stats_print(fp, irc_event_name(i), &plg->stats[i]);
+	} else {
+		/* Summary of all event types for every plugin. */
+		LL_FOREACH(irccd->plugins, plg)
+			n++;
+
+		fprintf(fp, "OK %zu", n);
+
+		LL_FOREACH(irccd->plugins, plg) {
+			memset(&st, 0, sizeof (st));
+
+			for (int i = 0; i < IRC_EVENT_NUM; ++i)
+				irc_plugin_stats_merge(&st, &plg->stats[i]);
+
+			if (st.count)
+				plugin_stats_print(fp, plg->name, &st);
+			else
+				fprintf(fp, "\n%s 0 0 0 0 0 0 0", plg->name);
+
+			fprintf(fp, " %llu %zu %zu", plg->timeouts, plg->memory,
+			    plg->memory_peak);
+		}
+	}
+
+	if (fclose(fp) < 0) {
+		free(out);
+		return ENOMEM;
+	}
+
+	rc = reply(p, out);
+	free(out);
+
+	return rc < 0 ? -rc : 0;
+}
+
+/*
+ * PLUGIN-STATS-RESET [plugin]
+ */
+static int
+cmd_plugin_stats_reset(struct peer *p, char *line)
+{
+	const char *args[1] = {0};
+	struct irc_plugin *plg;
+
+	if (parse(line, args, 1) == 1) {
+		if (!(plg = require_plugin(p, args[0])))
+			return 0;
+
+		irc_plugin_stats_reset(plg);
+	} else
+		LL_FOREACH(irccd->plugins, plg)
+			irc_plugin_stats_reset(plg);
 
 	return ok(p);
 }
@@ -577,10 +773,11 @@ cmd_rule_list(struct peer *p, char *line)
 	DL_FOREACH(irccd->rules, rule)
 		rulesz++;
 
-	fprintf(fp, "OK %zu\n", rulesz);
+	/* Every line but the last is terminated, peer_push adds it. */
+	fprintf(fp, "OK %zu", rulesz);
 
 	DL_FOREACH(irccd->rules, rule) {
-		fprintf(fp, "%s\n", rule->action == IRC_RULE_ACCEPT ? "accept" : "drop");
+		fprintf(fp, "\n%s", rule->action == IRC_RULE_ACCEPT ? "accept" : "drop");
 		rule_list_to_string(fp, rule->servers);
 		rule_list_to_string(fp, rule->channels);
 		rule_list_to_string(fp, rule->origins);
@@ -960,14 +1157,204 @@ cmd_server_topic(struct peer *p, char *line)
 	return ok(p);
 }
 
+static char **
+watch_list_add(char **list, const char *value)
+{
+	size_t len = 0;
+
+	while (list && list[len])
+		++len;
+
+	list          = irc_util_reallocarray(list, len + 2, sizeof (char *));
+	list[len]     = irc_util_strdup(value);
+	list[len + 1] = NULL;
+
+	return list;
+}
+
+static char **
+watch_list_free(char **list)
+{
+	if (list) {
+		for (char **i = list; *i; ++i)
+			free(*i);
+
+		free(list);
+	}
+
+	return NULL;
+}
+
 static int
-cmd_watch(struct peer *p, char *line)
+watch_list_match(char **list, const char *value, int mask)
+{
+	if (!list)
+		return 1;
+	if (!value)
+		return 0;
+
+	for (char **i = list; *i; ++i) {
+		if (mask && fnmatch(*i, value, FNM_CASEFOLD) == 0)
+			return 1;
+		if (!mask && strcasecmp(*i, value) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+watch_clear(struct peer_watch *w)
+{
+	w->events = 0;
+	w->servers = watch_list_free(w->servers);
+	w->channels = watch_list_free(w->channels);
+	w->origins = watch_list_free(w->origins);
+}
+
+static int
+watch_add_event(struct peer_watch *w, const char *name)
+{
+	const char *str;
+
+	for (int type = 0; type < IRC_EVENT_NUM; ++type) {
+		if ((str = irc_event_name(type)) && strcasecmp(str, name) == 0) {
+			w->events |= 1U << type;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * STATS
+ */
+static int
+cmd_stats(struct peer *p, char *line)
 {
 	(void)line;
 
+	char *out = NULL;
+	size_t outsz = 0, n;
+	FILE *fp;
+	int rc;
+
+	if (!(fp = open_memstream(&out, &outsz)))
+		return errno;
+
+	n = irc_metrics_dump(fp, IRC_METRICS_FORMAT_PLAIN);
+
+	if (fclose(fp) < 0) {
+		free(out);
+		return ENOMEM;
+	}
+
+	/* Every metric line ends with a newline, the reply adds the last one. */
+	if (n) {
+		out[outsz - 1] = '\0';
+		rc = peer_push(p, "OK %zu", n);
+	} else
+		rc = peer_push(p, "OK 0");
+
+	if (rc == 0 && n)
+		rc = reply(p, out);
+
+	free(out);
+
+	return rc < 0 ? -rc : 0;
+}
+
+/*
+ * Parse a sequence number, either 0 or epoch:number.
+ */
+static int
+watch_since(const char *value, unsigned long long *epoch, unsigned long long *since)
+{
+	char *end;
+
+	*epoch = *since = 0;
+
+	if (strcmp(value, "0") == 0)
+		return 0;
+	if (!isdigit((unsigned char)*value))
+		return -1;
+
+	errno = 0;
+	*epoch = strtoull(value, &end, 10);
+
+	if (errno || *end != ':' || !isdigit((unsigned char)end[1]))
+		return -1;
+
+	*since = strtoull(end + 1, &end, 10);
+
+	return errno || *end ? -1 : 0;
+}
+
+/*
+ * WATCH [since=epoch:seq] [c=channel] [e=event] [o=origin] [s=server]...
+ */
+static int
+cmd_watch(struct peer *p, char *line)
+{
+	struct peer_watch *w = &p->watch;
+	unsigned long long epoch = 0, since = 0;
+	char *token, *ptr;
+	int sequenced = 0;
+
+	/* Skip command. */
+	line += strlen("WATCH");
+
+	/* A new WATCH replaces the previous filters. */
+	watch_clear(w);
+
+	for (ptr = line; (token = strtok_r(ptr, " ", &ptr)); ) {
+		if (strncmp(token, "since=", 6) == 0) {
+			if (watch_since(token + 6, &epoch, &since) < 0)
+				goto invalid;
+
+			sequenced = 1;
+			continue;
+		}
+		if (strlen(token) < 3 || token[1] != '=')
+			goto invalid;
+
+		switch (*token) {
+		case 'c':
+			w->channels = watch_list_add(w->channels, token + 2);
+			break;
+		case 'e':
+			if (watch_add_event(w, token + 2) < 0) {
+				watch_clear(w);
+				return error(p, "invalid event %s", token + 2);
+			}
+			break;
+		case 'o':
+			w->origins = watch_list_add(w->origins, token + 2);
+			break;
+		case 's':
+			w->servers = watch_list_add(w->servers, token + 2);
+			break;
+		default:
+			goto invalid;
+		}
+	}
+
 	p->is_watching = 1;
+	p->is_sequenced = sequenced;
 
-	return ok(p);
+	ok(p);
+
+	/* Past events are sent before any new one. */
+	if (sequenced && p->replay)
+		p->replay(p, epoch, since);
+
+	return 0;
+
+invalid:
+	watch_clear(w);
+
+	return EINVAL;
 }
 
 static const struct cmd {
@@ -977,12 +1364,15 @@ static const struct cmd {
 	{ "HOOK-ADD",           cmd_hook_add            },
 	{ "HOOK-LIST",          cmd_hook_list           },
 	{ "HOOK-REMOVE",        cmd_hook_remove         },
+	{ "LOG-LEVEL",          cmd_log_level           },
 	{ "PLUGIN-CONFIG",      cmd_plugin_config       },
 	{ "PLUGIN-INFO",        cmd_plugin_info         },
 	{ "PLUGIN-LIST",        cmd_plugin_list         },
 	{ "PLUGIN-LOAD",        cmd_plugin_load         },
 	{ "PLUGIN-PATH",        cmd_plugin_path         },
 	{ "PLUGIN-RELOAD",      cmd_plugin_reload       },
+	{ "PLUGIN-STATS",       cmd_plugin_stats        },
+	{ "PLUGIN-STATS-RESET", cmd_plugin_stats_reset  },
 	{ "PLUGIN-TEMPLATE",    cmd_plugin_template     },
 	{ "PLUGIN-UNLOAD",      cmd_plugin_unload       },
 	{ "RULE-ADD",           cmd_rule_add            },
@@ -1004,6 +1394,7 @@ static const struct cmd {
 	{ "SERVER-PART",        cmd_server_part         },
 	{ "SERVER-RECONNECT",   cmd_server_reconnect    },
 	{ "SERVER-TOPIC",       cmd_server_topic        },
+	{ "STATS",              cmd_stats               },
 	{ "WATCH",              cmd_watch               }
 };
 
@@ -1037,6 +1428,131 @@ invoke(struct peer *p, char *line)
 		peer_push(p, "%s", strerror(er));
 }
 
+/*
+ * Release every pending chunk, the peer won't write anything anymore.
+ */
+static void
+output_clear(struct peer *peer)
+{
+	struct peer_out *out = &peer->out;
+
+	ev_io_stop(&out->io);
+
+	for (; out->count; out->count--) {
+		peer_msg_unref(out->chunks[out->first].msg);
+		out->first = (out->first + 1) % out->cap;
+	}
+
+	out->first = 0;
+	out->sent = 0;
+	out->len = 0;
+}
+
+/*
+ * Wake up the peer coroutine so that it terminates.
+ */
+static void
+output_close(struct peer *peer)
+{
+	peer->is_closing = 1;
+	output_clear(peer);
+	nce_stream_clear(&peer->stream.stream, NCE_STREAM_CLEAR_INPUT);
+	nce_io_feed(&peer->stream.stream.io_fd, EV_READ);
+}
+
+static void
+output_append(struct peer *peer, struct peer_msg *msg, size_t off)
+{
+	struct peer_out *out = &peer->out;
+	struct peer_chunk *chunks;
+	size_t i;
+
+	/* Grow and move the chunks to the beginning. */
+	if (out->count == out->cap) {
+		chunks = irc_util_calloc(out->cap ? out->cap * 2 : 16, sizeof (*chunks));
+
+		for (i = 0; i < out->count; ++i)
+			chunks[i] = out->chunks[(out->first + i) % out->cap];
+
+		free(out->chunks);
+		out->chunks = chunks;
+		out->cap = out->cap ? out->cap * 2 : 16;
+		out->first = 0;
+	}
+
+	i = (out->first + out->count++) % out->cap;
+	out->chunks[i].msg = peer_msg_ref(msg);
+	out->chunks[i].off = off;
+	out->len += msg->len - off;
+
+	ev_io_start(&out->io);
+}
+
+/*
+ * Write as many pending chunks as the socket accepts, straight from the
+ * shared messages.
+ */
+static int
+output_write(struct peer *peer)
+{
+	struct peer_out *out = &peer->out;
+	struct peer_chunk *chunk;
+	struct iovec iov[PEER_IOV];
+	struct msghdr msg = {0};
+	size_t i, skip;
+	ssize_t nw;
+
+	while (out->count) {
+		skip = out->sent;
+
+		for (i = 0; i < out->count && i < PEER_IOV; ++i) {
+			chunk = &out->chunks[(out->first + i) % out->cap];
+			iov[i].iov_base = chunk->msg->data + chunk->off + skip;
+			iov[i].iov_len = chunk->msg->len - chunk->off - skip;
+			skip = 0;
+		}
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = i;
+
+		if ((nw = sendmsg(peer->fd, &msg, MSG_NOSIGNAL)) < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -errno;
+
+		out->len -= nw;
+
+		/* Release what was written entirely. */
+		for (i = 0; nw > 0; ++i) {
+			if ((size_t)nw < iov[i].iov_len) {
+				out->sent += nw;
+				break;
+			}
+
+			nw -= iov[i].iov_len;
+			chunk = &out->chunks[out->first];
+			peer_msg_unref(chunk->msg);
+			out->first = (out->first + 1) % out->cap;
+			out->count--;
+			out->sent = 0;
+		}
+	}
+
+	ev_io_stop(&out->io);
+
+	return 0;
+}
+
+static void
+output_cb(struct ev_io *w, int)
+{
+	struct peer *peer = PEER(w, out.io);
+	int rc;
+
+	if ((rc = output_write(peer)) < 0) {
+		DEBUG("peer: client (%d): %s", peer->fd, strerror(-rc));
+		output_close(peer);
+	}
+}
+
 static void
 peer_stream_entry(struct nce_coro *self)
 {
@@ -1045,7 +1561,6 @@ peer_stream_entry(struct nce_coro *self)
 	struct peer *peer;
 	size_t length;
 	int major, minor, patch;
-	int rc;
 
 	peer = PEER(self, stream.coro);
 	stream = &peer->stream.stream;
@@ -1055,13 +1570,11 @@ peer_stream_entry(struct nce_coro *self)
 	minor = IRCCD_VERSION_MINOR;
 	patch = IRCCD_VERSION_PATCH;
 
-	if ((rc = nce_stream_printf(&peer->stream.stream, "IRCCD %d.%d.%d\n", major, minor, patch)) < 0)
-		goto end;
-	if ((rc = nce_stream_flush(&peer->stream.stream)) < 0)
+	if (peer_push(peer, "IRCCD %d.%d.%d", major, minor, patch) < 0)
 		goto end;
 
-	for (;;) {
-		if ((rc = nce_stream_wait(&peer->stream.stream)) < 0)
+	while (!peer->is_closing) {
+		if (nce_stream_wait(&peer->stream.stream) < 0)
 			goto end;
 
 		while ((pos = memchr(stream->in, '\n', stream->in_len))) {
@@ -1078,17 +1591,67 @@ peer_stream_entry(struct nce_coro *self)
 
 end:
 	irc_log_warn("peer: connection closed");
+	output_clear(peer);
 	nce_stream_stop(stream);
 }
 
+static void
+peer_stream_finalizer(struct nce_coro *self)
+{
+	struct peer *peer;
+
+	peer = PEER(self, stream.coro);
+
+	/* The coroutine has been destroyed, the owner can release the peer. */
+	if (peer->reap)
+		peer->reap(peer);
+}
+
+struct peer_msg *
+peer_msg_new(size_t len)
+{
+	struct peer_msg *msg;
+
+	msg = irc_util_malloc(sizeof (*msg) + len);
+	msg->refs = 1;
+	msg->len = len;
+
+	return msg;
+}
+
+struct peer_msg *
+peer_msg_ref(struct peer_msg *msg)
+{
+	assert(msg);
+
+	msg->refs++;
+
+	return msg;
+}
+
+void
+peer_msg_unref(struct peer_msg *msg)
+{
+	assert(msg);
+	assert(msg->refs);
+
+	if (--msg->refs == 0)
+		free(msg);
+}
+
 struct peer *
-peer_new(int sockfd)
+peer_new(int sockfd, const struct peer_limits *limits, peer_reap_fn reap)
 {
+	assert(limits);
+	assert(limits->low < limits->high);
+
 	struct peer *peer;
-	int flags;
+	int flags, rc;
 
 	peer = irc_util_calloc(1, sizeof (*peer));
 	peer->fd = sockfd;
+	peer->limits = *limits;
+	peer->reap = reap;
 
 	if ((flags = fcntl(sockfd, F_GETFL)) < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
 		irc_util_die("fcntl: %s\n", strerror(errno));
@@ -1096,12 +1659,17 @@ peer_new(int sockfd)
 	peer->stream.coro.name = "peer.stream";
 	peer->stream.coro.entry = peer_stream_entry;
 	peer->stream.coro.terminate = nce_stream_coro_terminate;
+	peer->stream.coro.finalizer = peer_stream_finalizer;
 	peer->stream.stream.ops = &nce_stream_ops_socket;
 	peer->stream.stream.fd = sockfd;
 	peer->stream.stream.in_cap = 2048;
-	peer->stream.stream.out_cap = 2048;
 	peer->stream.stream.close = 1;
-	nce_stream_coro_spawn(&peer->stream);
+
+	/* Output does not go through the stream, see output_write. */
+	ev_io_init(&peer->out.io, output_cb, sockfd, EV_WRITE);
+
+	if ((rc = nce_stream_coro_spawn(&peer->stream)) < 0)
+		irc_util_die("peer: %s\n", strerror(-rc));
 
 	return peer;
 }
@@ -1112,28 +1680,210 @@ peer_push(struct peer *peer, const char *fmt, ...)
 	assert(peer);
 	assert(fmt);
 
+	struct peer_msg *msg;
 	va_list ap;
-	ssize_t rc;
+	int len;
+
+	if (peer->is_closing)
+		return -EBADF;
 
 	va_start(ap, fmt);
-	rc = nce_stream_vprintf(&peer->stream.stream, fmt, ap);
+	len = vsnprintf(NULL, 0, fmt, ap);
 	va_end(ap);
 
-	if (rc < 0)
-		return rc;
+	if (len < 0)
+		return -EINVAL;
+	if (peer->out.len + len + 1 > peer->limits.high)
+		return -ENOBUFS;
+
+	msg = peer_msg_new(len + 1);
+
+	va_start(ap, fmt);
+	vsnprintf(msg->data, len + 1, fmt, ap);
+	va_end(ap);
+
+	/* Replace the NUL with the message terminator. */
+	msg->data[len] = '\n';
+	output_append(peer, msg, 0);
+	peer_msg_unref(msg);
+
+	return 0;
+}
+
+/*
+ * Apply the overflow policy for an event that could not be queued.
+ */
+static int
+overflow(struct peer *peer)
+{
+	peer->dropped++;
+	irc_metric_inc(&peer_dropped);
+
+	if (peer->limits.overflow == PEER_OVERFLOW_DISCONNECT) {
+		irc_log_warn("peer: client (%d) too slow, disconnecting", peer->fd);
+
+		output_close(peer);
+
+		return -EPIPE;
+	}
+
+	if (peer->gap++ == 0)
+		DEBUG("peer: client (%d) too slow, dropping events", peer->fd);
+
+	return -ENOBUFS;
+}
+
+int
+peer_send(struct peer *peer, struct peer_msg *msg, size_t off)
+{
+	assert(peer);
+	assert(msg);
+	assert(off < msg->len);
+
+	struct peer_msg *marker;
+	char gap[64];
+	int gapsz = 0;
 
-	/* Add message terminator. */
-	if ((rc = nce_stream_push(&peer->stream.stream, "\n", 1)) < 0)
-		return rc;
+	if (peer->is_closing || !nce_stream_active(&peer->stream.stream))
+		return -EBADF;
+
+	/* Not in the middle of a reply, reported as a gap afterwards. */
+	if (peer->is_replying) {
+		peer->gap++;
+		peer->dropped++;
+		irc_metric_inc(&peer_dropped);
+
+		return -ENOBUFS;
+	}
+
+	/*
+	 * Once dropping, wait for the peer to catch up to the low watermark
+	 * and tell it how many events it missed before the next one.
+	 */
+	if (peer->gap) {
+		if (peer->out.len > peer->limits.low)
+			return overflow(peer);
+
+		gapsz = snprintf(gap, sizeof (gap), "EVENT-GAP %llu\n", peer->gap);
+	}
+
+	if (peer->out.len + gapsz + msg->len - off > peer->limits.high)
+		return overflow(peer);
+
+	if (gapsz) {
+		marker = peer_msg_new(gapsz);
+		memcpy(marker->data, gap, gapsz);
+		output_append(peer, marker, 0);
+		peer_msg_unref(marker);
+		peer->gap = 0;
+	}
+
+	/* Data is sent verbatim, it must already contain the terminator. */
+	output_append(peer, msg, off);
 
 	return 0;
 }
 
+int
+peer_wait(struct peer *peer, size_t len)
+{
+	assert(peer);
+
+	while (peer->out.len && peer->out.len + len > peer->limits.high) {
+		if (peer->is_closing)
+			return -EBADF;
+
+		nce_coro_yield();
+	}
+
+	return peer->is_closing ? -EBADF : 0;
+}
+
+void
+peer_match_init(struct peer_match *m, const struct irc_event *ev)
+{
+	assert(m);
+	assert(ev);
+
+	m->type = ev->type;
+	m->server = ev->server->name;
+	m->channel = NULL;
+	m->origin = NULL;
+
+	switch (ev->type) {
+	case IRC_EVENT_INVITE:
+		m->channel = ev->invite.channel;
+		m->origin = ev->invite.origin;
+		break;
+	case IRC_EVENT_JOIN:
+		m->channel = ev->join.channel;
+		m->origin = ev->join.origin;
+		break;
+	case IRC_EVENT_KICK:
+		m->channel = ev->kick.channel;
+		m->origin = ev->kick.origin;
+		break;
+	case IRC_EVENT_COMMAND:
+	case IRC_EVENT_ME:
+	case IRC_EVENT_MESSAGE:
+		m->channel = ev->message.channel;
+		m->origin = ev->message.origin;
+		break;
+	case IRC_EVENT_MODE:
+		m->channel = ev->mode.channel;
+		m->origin = ev->mode.origin;
+		break;
+	case IRC_EVENT_NAMES:
+		m->channel = ev->names.channel;
+		break;
+	case IRC_EVENT_NICK:
+		m->origin = ev->nick.origin;
+		break;
+	case IRC_EVENT_NOTICE:
+		m->channel = ev->notice.channel;
+		m->origin = ev->notice.origin;
+		break;
+	case IRC_EVENT_PART:
+		m->channel = ev->part.channel;
+		m->origin = ev->part.origin;
+		break;
+	case IRC_EVENT_TOPIC:
+		m->channel = ev->topic.channel;
+		m->origin = ev->topic.origin;
+		break;
+	default:
+		break;
+	}
+}
+
+int
+peer_matches(const struct peer *peer, const struct peer_match *m)
+{
+	assert(peer);
+	assert(m);
+
+	const struct peer_watch *w = &peer->watch;
+
+	if (!peer->is_watching)
+		return 0;
+	if (w->events && !(w->events & (1U << m->type)))
+		return 0;
+
+	return watch_list_match(w->servers, m->server, 0) &&
+	       watch_list_match(w->channels, m->channel, 0) &&
+	       watch_list_match(w->origins, m->origin, 1);
+}
+
 void
 peer_free(struct peer *p)
 {
 	assert(p);
 
+	/* Don't reap again if the coroutine is still running. */
+	p->stream.coro.finalizer = NULL;
+	output_clear(p);
 	nce_stream_coro_destroy(&p->stream);
+	watch_clear(&p->watch);
+	free(p->out.chunks);
 	free(p);
 }
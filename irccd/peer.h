@@ -19,27 +19,159 @@
 #ifndef IRCCD_PEER_H
 #define IRCCD_PEER_H
 
+#include <ev.h>
 #include <nce/stream.h>
 
 #include <irccd/attrs.h>
 #include <irccd/irccd.h>
+#include <irccd/metrics.h>
 
+struct irc_event;
 struct peer;
 
+/*
+ * Default output watermarks in bytes.
+ */
+#define PEER_HIGH 16384
+#define PEER_LOW 4096
+
+/*
+ * What to do when a watching peer does not read its events fast enough.
+ */
+enum peer_overflow {
+	PEER_OVERFLOW_DROP,             /* drop events and report a gap */
+	PEER_OVERFLOW_DISCONNECT        /* close the connection */
+};
+
+/*
+ * Output limits of a peer. The output buffer never grows past the high
+ * watermark, once an event does not fit the overflow policy applies until the
+ * peer reads enough to go below the low watermark.
+ */
+struct peer_limits {
+	size_t high;
+	size_t low;
+	enum peer_overflow overflow;
+};
+
+/*
+ * Events sent to a watching peer, every criterion must match. An empty list
+ * or mask matches everything.
+ */
+struct peer_watch {
+	unsigned int events;            /* mask of event types */
+	char **servers;                 /* server names */
+	char **channels;                /* channel names */
+	char **origins;                 /* origin masks */
+};
+
+/*
+ * Criteria of an event compared against the watch filters, strings are
+ * borrowed from the event.
+ */
+struct peer_match {
+	unsigned int type;              /* event type */
+	const char *server;             /* server name */
+	const char *channel;            /* channel or NULL */
+	const char *origin;             /* origin or NULL */
+};
+
+/*
+ * Line sent to one or more peers. Its text is not copied into the output of
+ * every peer, each of them keeps a reference until the line was written.
+ */
+struct peer_msg {
+	unsigned int refs;
+	size_t len;
+	char data[];
+};
+
+/*
+ * Part of a message pending in a peer output, from the given offset.
+ */
+struct peer_chunk {
+	struct peer_msg *msg;
+	size_t off;
+};
+
+/*
+ * Output of a peer, a queue of chunks written directly from the messages.
+ */
+struct peer_out {
+	struct peer_chunk *chunks;      /* circular array */
+	size_t cap;                     /* capacity of chunks */
+	size_t first;                   /* index of the oldest chunk */
+	size_t count;                   /* chunks pending */
+	size_t sent;                    /* bytes of the oldest one written */
+	size_t len;                     /* bytes pending */
+	struct ev_io io;
+};
+
+/*
+ * Function called once the peer connection has terminated, it must release
+ * the peer using peer_free.
+ */
+typedef void (*peer_reap_fn)(struct peer *);
+
+/*
+ * Function called when the peer starts watching with a sequence number and its
+ * epoch, both 0 for every past event. It must send the past events that follow
+ * it.
+ */
+typedef void (*peer_replay_fn)(struct peer *, unsigned long long, unsigned long long);
+
 struct peer {
 	int fd;
 	struct nce_stream_coro stream;
 	int is_watching;
+	int is_closing;
+	int is_sequenced;               /* events are tagged with their number */
+	int is_replaying;               /* past events are being sent */
+	int is_replying;                /* a long reply is being sent */
+	struct peer_watch watch;
+	struct peer_limits limits;
+	struct peer_out out;
+	unsigned long long gap;         /* events dropped since last gap marker */
+	unsigned long long dropped;     /* events dropped in total */
+	peer_reap_fn reap;
+	peer_replay_fn replay;          /* optional */
+	struct peer *prev;
 	struct peer *next;
 };
 
+/*
+ * Events dropped for all peers.
+ */
+extern struct irc_metric peer_dropped;
+
+struct peer_msg *
+peer_msg_new(size_t);
+
+struct peer_msg *
+peer_msg_ref(struct peer_msg *);
+
+void
+peer_msg_unref(struct peer_msg *);
+
 struct peer *
-peer_new(int sockfd);
+peer_new(int sockfd, const struct peer_limits *limits, peer_reap_fn reap);
 
 IRC_ATTR_PRINTF(2, 3)
 int
 peer_push(struct peer *, const char *, ...);
 
+int
+peer_send(struct peer *, struct peer_msg *, size_t);
+
+int
+peer_wait(struct peer *, size_t);
+
+void
+peer_match_init(struct peer_match *, const struct irc_event *);
+
+int
+peer_matches(const struct peer *, const struct peer_match *);
+
 void
 peer_free(struct peer *);
 
@@ -16,16 +16,19 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <utlist.h>
@@ -33,54 +36,205 @@
 #include <nce/io.h>
 
 #include <irccd/config.h>
+#include <irccd/event.h>
+#include <irccd/irccd.h>
 #include <irccd/log.h>
+#include <irccd/metrics.h>
 #include <irccd/util.h>
 
 #include "peer.h"
 #include "transport.h"
 
+#define DEBUG(...) IRC_LOG(IRC_LOG_SUBSYSTEM_TRANSPORT, IRC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define INFO(...)  IRC_LOG(IRC_LOG_SUBSYSTEM_TRANSPORT, IRC_LOG_LEVEL_INFO, __VA_ARGS__)
+
+/*
+ * An event kept for replay. The line is the one sent to the peers, tagged
+ * with its sequence number that untagged peers skip. The criteria are copied
+ * along so that the event can be filtered again when replayed.
+ */
+struct record {
+	struct peer_msg *msg;           /* line, NULL if it could not be encoded */
+	size_t off;                     /* start of the untagged line */
+	size_t size;                    /* memory accounted for the record */
+	struct peer_match match;
+	char criteria[];
+};
+
 static struct sockaddr_un addr;
 static int fd = -1;
 static struct nce_io_coro fd_co;
 static struct peer *peers;
+static struct peer_limits limits;
+
+/*
+ * Last events for replay, bounded by the memory they use. Records have
+ * consecutive sequence numbers, the last one is the current event.
+ */
+static struct {
+	struct record **records;        /* circular array */
+	size_t cap;
+	size_t first;
+	size_t count;
+	size_t bytes;
+	size_t max;
+} ring;
+
+/*
+ * Sequence numbers restart from 1 with every new epoch, that is the time at
+ * which the transport was started in microseconds.
+ */
+static unsigned long long epoch;
+static unsigned long long seq;
+
+static struct irc_metric peers_count = {
+	.name = "irccd_transport_peers",
+	.help = "Connected clients.",
+	.type = IRC_METRIC_GAUGE
+};
+static struct irc_metric peers_accepted = {
+	.name = "irccd_transport_accepted_total",
+	.help = "Clients accepted.",
+	.type = IRC_METRIC_COUNTER
+};
+
+static void
+reap(struct peer *peer)
+{
+	DEBUG("transport: reap client (%d)", peer->fd);
+
+	DL_DELETE(peers, peer);
+	irc_metric_sub(&peers_count, 1);
+	peer_free(peer);
+}
+
+/*
+ * Sequence number of the oldest event still in the ring.
+ */
+static inline unsigned long long
+oldest(void)
+{
+	return seq - ring.count + 1;
+}
+
+static inline struct record *
+lookup(unsigned long long s)
+{
+	return ring.records[(ring.first + (s - oldest())) % ring.cap];
+}
+
+static inline size_t
+offset(const struct peer *peer, size_t off)
+{
+	return peer->is_sequenced ? 0 : off;
+}
+
+/*
+ * Send every matching event past the given sequence number, every kept event
+ * if it belongs to another epoch. The peer output is flushed as needed rather
+ * than applying the overflow policy, new events broadcast meanwhile are
+ * appended to the ring and sent by this loop.
+ */
+static void
+replay(struct peer *peer, unsigned long long ep, unsigned long long since)
+{
+	const struct record *rec;
+	unsigned long long s, first;
+
+	/* The daemon restarted, the new epoch tells the client. */
+	if (ep != epoch)
+		since = 0;
+
+	peer->is_replaying = 1;
+
+	for (s = since + 1; s <= seq && !peer->is_closing; ) {
+		/* Events gone from the ring, possibly while flushing. */
+		if (s < (first = oldest())) {
+			if (peer_wait(peer, 32) < 0)
+				break;
+
+			peer_push(peer, "EVENT-GAP %llu", oldest() - s);
+			s = oldest();
+			continue;
+		}
+
+		rec = lookup(s++);
+
+		if (!rec->msg || !peer_matches(peer, &rec->match))
+			continue;
+		if (peer_wait(peer, rec->msg->len - offset(peer, rec->off)) < 0)
+			break;
+
+		/* Reported as a gap if the record was removed while flushing. */
+		if (s - 1 < oldest())
+			s--;
+		else
+			peer_send(peer, rec->msg, offset(peer, rec->off));
+	}
+
+	peer->is_replaying = 0;
+}
 
 static void
 transport_entry(struct nce_coro *)
 {
-	struct peer *peer, *tmp;
+	struct peer *peer;
 	int clt;
 
 	while (nce_io_wait(&fd_co.io)) {
-		if ((clt = accept(fd, NULL, 0)) < 0) {
-			switch (errno) {
-			case -EINTR:
-				irc_log_debug("transport: accept: %s", strerror(errno));
-				/* Ignore. */
-				break;
-			}
-		} else {
-			irc_log_debug("transport: new client (%d)", clt);
-			peer = peer_new(clt);
-			LL_APPEND(peers, peer);
+		/* Accept every pending client at once. */
+		while ((clt = accept(fd, NULL, 0)) >= 0) {
+			peer = peer_new(clt, &limits, reap);
+			peer->replay = replay;
+			DL_APPEND(peers, peer);
+
+			irc_metric_inc(&peers_count);
+			irc_metric_inc(&peers_accepted);
+			DEBUG("transport: new client (%d), %llu connected", clt, peers_count.value);
 		}
 
-		/* Cleanup zombies. */
-		LL_FOREACH_SAFE(peers, peer, tmp) {
-			if (!nce_stream_active(&peer->stream.stream)) {
-				irc_log_debug("transport: reap client (%d)", peer->fd);
-				LL_DELETE(peers, peer);
-				peer_free(peer);
-			}
+		switch (errno) {
+		case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+#endif
+		case EINTR:
+		case ECONNABORTED:
+			break;
+		default:
+			irc_log_warn("transport: accept: %s", strerror(errno));
+			break;
 		}
 	}
 }
 
 int
-transport_start(const char *path, long long uid, long long gid)
+transport_start(const char *path,
+                long long uid,
+                long long gid,
+                int backlog,
+                const struct peer_limits *lim,
+                size_t keep)
 {
 	assert(path);
+	assert(lim);
+
+	struct rlimit rl;
+	struct timespec ts;
+	int oldumask, flags;
+
+	limits = *lim;
+	ring.max = keep;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	epoch = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	seq = 0;
 
-	int oldumask;
+	/* Each peer requires a descriptor, allow as many as possible. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
 
 	addr.sun_family = AF_UNIX;
 
@@ -105,13 +259,21 @@ transport_start(const char *path, long long uid, long long gid)
 
 	umask(oldumask);
 
-	if (listen(fd, 16) < 0)
+	if (listen(fd, backlog) < 0)
+		goto err;
+	if ((flags = fcntl(fd, F_GETFL)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
 		goto err;
 
-	irc_log_info("transport: listening on %s", path);
+	INFO("transport: listening on %s", path);
 
 	if (uid != -1 && gid != -1)
-		irc_log_info("transport: uid=%lld, gid=%lld", uid, gid);
+		INFO("transport: uid=%lld, gid=%lld", uid, gid);
+	if (ring.max)
+		INFO("transport: keeping up to %zu bytes of events for replay", ring.max);
+
+	irc_metrics_register(&peers_count);
+	irc_metrics_register(&peers_accepted);
+	irc_metrics_register(&peer_dropped);
 
 	fd_co.coro.name = "transport.entry";
 	fd_co.coro.entry = transport_entry;
@@ -130,16 +292,175 @@ err:
 	return -1;
 }
 
+/*
+ * Convert the event into a line ready to be sent, including its terminator.
+ */
+static struct peer_msg *
+encode(const struct irc_event *ev, size_t *off)
+{
+	struct peer_msg *msg;
+	char buf[64 + IRC_BUF_LEN];
+	size_t len;
+	int n;
+
+	n = snprintf(buf, sizeof (buf), "@seq=%llu:%llu ", epoch, seq);
+
+	if (irc_event_str(ev, buf + n, IRC_BUF_LEN - 1) < 0)
+		return NULL;
+
+	len = n + strlen(buf + n);
+	buf[len++] = '\n';
+
+	msg = peer_msg_new(len);
+	memcpy(msg->data, buf, len);
+	*off = n;
+
+	return msg;
+}
+
+static const char *
+save(char **pos, const char *value)
+{
+	const char *ret = *pos;
+
+	if (!value)
+		return NULL;
+
+	*pos = stpcpy(*pos, value) + 1;
+
+	return ret;
+}
+
+static inline size_t
+length(const char *value)
+{
+	return value ? strlen(value) + 1 : 0;
+}
+
+static void
+record_free(struct record *rec)
+{
+	if (rec->msg)
+		peer_msg_unref(rec->msg);
+
+	free(rec);
+}
+
+/*
+ * Append the record, the oldest ones are removed until the ring fits within
+ * its memory limit again.
+ */
+static void
+push(struct record *rec)
+{
+	struct record **records;
+	size_t i;
+
+	/* Grow and move the records to the beginning. */
+	if (ring.count == ring.cap) {
+		records = irc_util_calloc(ring.cap ? ring.cap * 2 : 64, sizeof (*records));
+
+		for (i = 0; i < ring.count; ++i)
+			records[i] = ring.records[(ring.first + i) % ring.cap];
+
+		free(ring.records);
+		ring.records = records;
+		ring.cap = ring.cap ? ring.cap * 2 : 64;
+		ring.first = 0;
+	}
+
+	ring.records[(ring.first + ring.count++) % ring.cap] = rec;
+	ring.bytes += rec->size;
+
+	while (ring.count && ring.bytes > ring.max) {
+		rec = ring.records[ring.first];
+		ring.bytes -= rec->size;
+		ring.first = (ring.first + 1) % ring.cap;
+		ring.count--;
+		record_free(rec);
+	}
+}
+
+static void
+clear(void)
+{
+	while (ring.count) {
+		record_free(ring.records[ring.first]);
+		ring.first = (ring.first + 1) % ring.cap;
+		ring.count--;
+	}
+
+	free(ring.records);
+	memset(&ring, 0, sizeof (ring));
+}
+
+/*
+ * Encode the event and copy its criteria to keep it for replay, returns a new
+ * reference to the line. The event is recorded even if it can't be encoded
+ * so that sequence numbers of the ring stay consecutive.
+ */
+static struct peer_msg *
+store(const struct irc_event *ev, const struct peer_match *m, size_t *off)
+{
+	struct peer_msg *msg;
+	struct record *rec;
+	size_t len;
+	char *pos;
+
+	len = length(m->server) + length(m->channel) + length(m->origin);
+	rec = irc_util_calloc(1, sizeof (*rec) + len);
+	rec->size = sizeof (*rec) + len + sizeof (rec);
+	rec->match.type = m->type;
+
+	if ((rec->msg = encode(ev, &rec->off))) {
+		rec->size += sizeof (*rec->msg) + rec->msg->len;
+		pos = rec->criteria;
+		rec->match.server = save(&pos, m->server);
+		rec->match.channel = save(&pos, m->channel);
+		rec->match.origin = save(&pos, m->origin);
+	}
+
+	/* The record is removed at once if larger than the limit. */
+	msg = rec->msg ? peer_msg_ref(rec->msg) : NULL;
+	*off = rec->off;
+	push(rec);
+
+	return msg;
+}
+
 void
-transport_broadcast(const char *data)
+transport_broadcast(const struct irc_event *ev)
 {
-	assert(data);
+	assert(ev);
 
+	struct peer_match match;
+	struct peer_msg *msg = NULL;
 	struct peer *peer;
+	size_t off = 0;
+
+	if (fd == -1)
+		return;
+
+	++seq;
+	peer_match_init(&match, ev);
 
-	LL_FOREACH(peers, peer)
-		if (peer->is_watching)
-			peer_push(peer, "%s", data);
+	if (ring.max)
+		msg = store(ev, &match, &off);
+
+	DL_FOREACH(peers, peer) {
+		/* Replaying peers pick the event from the ring. */
+		if (peer->is_replaying || !peer_matches(peer, &match))
+			continue;
+
+		/* Encode lazily, most of the time nobody is watching. */
+		if (!msg && !(msg = encode(ev, &off)))
+			return;
+
+		peer_send(peer, msg, offset(peer, off));
+	}
+
+	if (msg)
+		peer_msg_unref(msg);
 }
 
 void
@@ -147,7 +468,7 @@ transport_stop(void)
 {
 	struct peer *peer, *tmp;
 
-	nce_coro_destroy(&fd_co.coro);
+	nce_io_coro_destroy(&fd_co);
 
 	/* Connection socket. */
 	if (fd != -1)
@@ -155,8 +476,16 @@ transport_stop(void)
 
 	unlink(addr.sun_path);
 
-	LL_FOREACH_SAFE(peers, peer, tmp) {
-		LL_DELETE(peers, peer);
+	DL_FOREACH_SAFE(peers, peer, tmp) {
+		DL_DELETE(peers, peer);
 		peer_free(peer);
 	}
+
+	fd = -1;
+	clear();
+
+	irc_metric_set(&peers_count, 0);
+	irc_metrics_unregister(&peers_count);
+	irc_metrics_unregister(&peers_accepted);
+	irc_metrics_unregister(&peer_dropped);
 }
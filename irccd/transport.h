@@ -19,30 +19,48 @@
 #ifndef IRCCD_TRANSPORT_H
 #define IRCCD_TRANSPORT_H
 
+#include <stddef.h>
+
 /**
  * \file transport.h
  * \brief Remote command support.
  */
 
+struct irc_event;
+struct peer_limits;
+
 /**
  * Open and bind transport for irccdctl and peers.
  *
  * \param path path to the socket (not NULL)
  * \param uid the uid to change owner (or -1 ignore)
  * \param gid the gid to change owner (or -1 ignore)
+ * \param backlog the maximum number of pending connections
+ * \param limits the output limits for every peer (not NULL)
+ * \param keep the memory in bytes used by past events kept for replay (0 to
+ * disable)
  * \return 0 on success
  * \return -E<*> on error
  */
 int
-transport_start(const char *path, long long uid, long long gid);
+transport_start(const char *path,
+                long long uid,
+                long long gid,
+                int backlog,
+                const struct peer_limits *limits,
+                size_t keep);
 
 /**
- * Transmit a message to every connected peer.
+ * Transmit an event to every watching peer.
+ *
+ * Every event is given a new sequence number within the current epoch. The
+ * event is converted to its textual form only once and only if at least one
+ * peer is watching or if it is kept for replay.
  *
- * \param data the string to send (not NULL)
+ * \param ev the event to send (not NULL)
  */
 void
-transport_broadcast(const char *data);
+transport_broadcast(const struct irc_event *ev);
 
 /**
  * Stop the transport and close all connected peers.
@@ -53,7 +53,8 @@ poll(void)
 		char buf[IRC_BUF_LEN] = {};
 		ssize_t nr;
 
-		if ((nr = recv(sock, buf, sizeof (buf) - 1, 0)) <= 0)
+		/* Don't read more than what can be appended. */
+		if ((nr = recv(sock, buf, sizeof (in) - strlen(in) - 1, 0)) <= 0)
 			irc_util_die("abort: recv: %s\n", strerror(nr == 0 ? ECONNRESET : errno));
 		if (irc_util_strlcat(in, buf, sizeof (in)) >= sizeof (in))
 			irc_util_die("abort: recv: %s\n", strerror(EMSGSIZE));
@@ -162,6 +163,15 @@ show_disconnect(char *line)
 	}
 }
 
+static void
+show_gap(char *line)
+{
+	const char *args[2] = {};
+
+	if (irc_util_split(line, args, 2, ' ') == 2)
+		printf("%-16s%s\n", "dropped:", args[1]);
+}
+
 static void
 show_invite(char *line)
 {
@@ -327,6 +337,7 @@ static const struct {
 } watchtable[] = {
 	{ "EVENT-CONNECT",      show_connect    },
 	{ "EVENT-DISCONNECT",   show_disconnect },
+	{ "EVENT-GAP",          show_gap        },
 	{ "EVENT-INVITE",       show_invite     },
 	{ "EVENT-JOIN",         show_join       },
 	{ "EVENT-KICK",         show_kick       },
@@ -343,6 +354,15 @@ static const struct {
 static void
 show(char *ev)
 {
+	char *seq;
+
+	/* Events are tagged with their sequence number when replaying. */
+	if (strncmp(ev, "@seq=", 5) == 0 && (seq = strchr(ev, ' '))) {
+		*seq++ = '\0';
+		printf("%-16s%s\n", "seq:", ev + 5);
+		ev = seq;
+	}
+
 	for (size_t i = 0; i < IRC_UTIL_SIZE(watchtable); ++i) {
 		if (strncmp(watchtable[i].event, ev, strlen(watchtable[i].event)) == 0) {
 			watchtable[i].show(ev);
@@ -352,12 +372,207 @@ show(char *ev)
 	}
 }
 
+/*
+ * Readers of the replies spanning several lines, they are given what follows
+ * the OK of the first line and the number of arguments of the request. They
+ * are shared by the commands and the batch mode.
+ *
+ * Response:
+ *
+ *     OK <n>
+ *     variable=value or value if only one was requested
+ *     (repeat for every line in <n>)
+ */
 static void
-plugin_list_set(int argc, char **argv, const char *cmd)
+read_variables(const char *reply, int single)
 {
 	char *line, *p, name[16];
 	size_t num = 0;
 
+	if (sscanf(reply, "%zu", &num) != 1)
+		irc_util_die("abort: could not retrieve list\n");
+
+	while (num-- != 0 && (line = poll())) {
+		if (single)
+			puts(line);
+		else if ((p = strchr(line, '='))) {
+			*p = '\0';
+			snprintf(name, sizeof (name), "%s:", line);
+			printf("%-16s%s\n", name, p + 1);
+		}
+	}
+}
+
+static void
+read_log_level(const char *reply, int argc)
+{
+	read_variables(reply, argc == 1);
+}
+
+static void
+read_plugin_variables(const char *reply, int argc)
+{
+	read_variables(reply, argc == 2);
+}
+
+/*
+ * Response:
+ *
+ *     OK name
+ *     summary
+ *     version
+ *     license
+ *     author
+ *     memory peak limit failures
+ */
+static void
+read_plugin_info(const char *reply, int)
+{
+	unsigned long long memory, peak, limit, failures;
+
+	printf("%-16s%s\n", "name:", reply);
+	printf("%-16s%s\n", "summary:", poll());
+	printf("%-16s%s\n", "version:", poll());
+	printf("%-16s%s\n", "license:", poll());
+	printf("%-16s%s\n", "author:", poll());
+
+	if (sscanf(poll(), "%llu %llu %llu %llu", &memory, &peak, &limit, &failures) != 4)
+		irc_util_die("abort: invalid plugin memory usage\n");
+
+	printf("%-16s%llu\n", "memory:", memory);
+	printf("%-16s%llu\n", "memory peak:", peak);
+
+	if (limit)
+		printf("%-16s%llu (%llu refused)\n", "memory limit:", limit, failures);
+	else
+		printf("%-16s%s\n", "memory limit:", "none");
+}
+
+/*
+ * Response:
+ *
+ *     OK <n>
+ *     name|event calls errors avg p50 p90 p99 max
+ *     (repeat for every line in <n>)
+ */
+static void
+read_plugin_stats(const char *reply, int argc)
+{
+	char name[32];
+	unsigned long long calls, errors, avg, p50, p90, p99, max;
+	unsigned long long timeouts = 0, memory = 0, peak = 0;
+	size_t num = 0;
+
+	if (sscanf(reply, "%zu", &num) != 1)
+		irc_util_die("abort: could not retrieve plugin statistics\n");
+
+	printf("%-16s %10s %8s %10s %10s %10s %10s %10s",
+	    argc == 1 ? "event" : "plugin",
+	    "calls", "errors", "avg(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+	printf(argc == 1 ? "\n" : " %8s %10s %10s\n", "timeouts", "mem(KiB)", "peak(KiB)");
+
+	while (num-- != 0) {
+		/* Only the summary has the timeouts and memory columns. */
+		if (sscanf(poll(), "%31s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu", name,
+		    &calls, &errors, &avg, &p50, &p90, &p99, &max, &timeouts, &memory, &peak) != 11 - 3 * (argc == 1))
+			irc_util_die("abort: invalid plugin statistics\n");
+
+		printf("%-16s %10llu %8llu %10llu %10llu %10llu %10llu %10llu",
+		    name, calls, errors, avg, p50, p90, p99, max);
+		printf(argc == 1 ? "\n" : " %8llu %10llu %10llu\n", timeouts, memory / 1024, peak / 1024);
+	}
+}
+
+/*
+ * Response:
+ *
+ *     OK <n>
+ *     accept
+ *     server1 server2 server3 ...
+ *     channel1 channel2 channel3 ...
+ *     origin1 origin2 origin3 ...
+ *     plugin1 plugin2 plugin3 ...
+ *     event1 event2 plugin3 ...
+ *     (repeat for every rule in <n>)
+ */
+static void
+read_rule_list(const char *reply, int)
+{
+	size_t num = 0;
+
+	if (sscanf(reply, "%zu", &num) != 1)
+		irc_util_die("abort: could not retrieve rule list\n");
+
+	for (size_t i = 0; i < num; ++i) {
+		printf("%-16s%zu\n", "index:", i);
+		printf("%-16s%s\n", "action:", poll());
+		printf("%-16s%s\n", "servers:", poll());
+		printf("%-16s%s\n", "channels:", poll());
+		printf("%-16s%s\n", "origins:", poll());
+		printf("%-16s%s\n", "plugins:", poll());
+		printf("%-16s%s\n", "events:", poll());
+
+		if (i + 1 < num)
+			printf("\n");
+	}
+}
+
+/*
+ * Response:
+ *
+ *     OK name
+ *     hostname port [ssl]
+ *     nickname username realname
+ *     chan1 chan2 chanN
+ */
+static void
+read_server_info(const char *reply, int)
+{
+	char *list;
+	const char *args[16] = {};
+
+	printf("%-16s%s\n", "name:", reply);
+
+	if (irc_util_split((list = poll()), args, 3, ' ') < 2)
+		irc_util_die("abort: malformed server connection\n");
+
+	printf("%-16s%s\n", "hostname:", args[0]);
+	printf("%-16s%s\n", "port:", args[1]);
+
+	if (args[2])
+		printf("%-16s%s\n", "ssl:", "true");
+
+	if (irc_util_split((list = poll()), args, 3, ' ') != 3)
+		irc_util_die("abort: malformed server ident\n");
+
+	printf("%-16s%s\n", "nickname:", args[0]);
+	printf("%-16s%s\n", "username:", args[1]);
+	printf("%-16s%s\n", "realname:", args[2]);
+	printf("%-16s%s\n", "channels:", poll());
+}
+
+/*
+ * Response:
+ *
+ *     OK <n>
+ *     name[{label="value"}] value
+ *     (repeat for every line in <n>)
+ */
+static void
+read_stats(const char *reply, int)
+{
+	size_t num = 0;
+
+	if (sscanf(reply, "%zu", &num) != 1)
+		irc_util_die("abort: could not retrieve metrics\n");
+
+	while (num-- != 0)
+		printf("%s\n", poll());
+}
+
+static void
+plugin_list_set(int argc, char **argv, const char *cmd)
+{
 	--argc;
 	++argv;
 
@@ -372,22 +587,7 @@ plugin_list_set(int argc, char **argv, const char *cmd)
 	else
 		req("%s %s", cmd, argv[0]);
 
-	if (sscanf(line = ok(), "%zu", &num) != 1)
-		irc_util_die("abort: could not retrieve list\n");
-
-	if (argc == 2)
-		puts(poll());
-	else {
-		while (num-- != 0 && (line = poll())) {
-			if (!(p = strchr(line, '=')))
-				continue;
-
-			*p = '\0';
-			name[0] = '\0';
-			snprintf(name, sizeof (name), "%s:", line);
-			printf("%-16s%s\n", name, p + 1);
-		}
-	}
+	read_plugin_variables(ok(), argc);
 }
 
 static void
@@ -429,36 +629,34 @@ cmd_hook_remove(int, char **argv)
 	ok();
 }
 
+static void
+cmd_log_level(int argc, char **argv)
+{
+	if (argc == 3) {
+		req("LOG-LEVEL %s %s", argv[1], argv[2]);
+		ok();
+		return;
+	}
+
+	if (argc == 2)
+		req("LOG-LEVEL %s", argv[1]);
+	else
+		req("LOG-LEVEL");
+
+	read_log_level(ok(), argc - 1);
+}
+
 static void
 cmd_plugin_config(int argc, char **argv)
 {
 	plugin_list_set(argc, argv, "PLUGIN-CONFIG");
 }
 
-/*
- * Response:
- *
- *     OK name
- *     summary
- *     version
- *     license
- *     author
- */
 static void
 cmd_plugin_info(int, char **argv)
 {
-	const char *response;
-
 	req("PLUGIN-INFO %s", argv[1]);
-
-	if (strncmp((response = poll()), "OK ", 3) != 0)
-		irc_util_die("abort: failed to retrieve plugin information\n");
-
-	printf("%-16s%s\n", "name:", response + 3);
-	printf("%-16s%s\n", "summary:", poll());
-	printf("%-16s%s\n", "version:", poll());
-	printf("%-16s%s\n", "license:", poll());
-	printf("%-16s%s\n", "author:", poll());
+	read_plugin_info(ok(), 1);
 }
 
 static void
@@ -491,6 +689,45 @@ cmd_plugin_reload(int argc, char **argv)
 	ok();
 }
 
+static void
+cmd_plugin_stats(int argc, char **argv)
+{
+	int ch, reset = 0;
+
+	while ((ch = getopt(argc, argv, "r")) != -1) {
+		switch (ch) {
+		case 'r':
+			reset = 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		irc_util_die("abort: invalid number of arguments\n");
+
+	if (reset) {
+		if (argc == 1)
+			req("PLUGIN-STATS-RESET %s", argv[0]);
+		else
+			req("PLUGIN-STATS-RESET");
+
+		ok();
+		return;
+	}
+
+	if (argc == 1)
+		req("PLUGIN-STATS %s", argv[0]);
+	else
+		req("PLUGIN-STATS");
+
+	read_plugin_stats(ok(), argc);
+}
+
 static void
 cmd_plugin_template(int argc, char **argv)
 {
@@ -569,40 +806,11 @@ cmd_rule_edit(int argc, char **argv)
 	ok();
 }
 
-/*
- * Response:
- *
- *     OK <n>
- *     accept
- *     server1 server2 server3 ...
- *     channel1 channel2 channel3 ...
- *     origin1 origin2 origin3 ...
- *     plugin1 plugin2 plugin3 ...
- *     event1 event2 plugin3 ...
- *     (repeat for every rule in <n>)
- */
 static void
 cmd_rule_list(int, char **)
 {
-	size_t num = 0;
-
 	req("RULE-LIST");
-
-	if (sscanf(ok(), "%zu", &num) != 1)
-		irc_util_die("abort: could not retrieve rule list\n");
-
-	for (size_t i = 0; i < num; ++i) {
-		printf("%-16s%zu\n", "index:", i);
-		printf("%-16s%s\n", "action:", poll());
-		printf("%-16s%s\n", "servers:", poll());
-		printf("%-16s%s\n", "channels:", poll());
-		printf("%-16s%s\n", "origins:", poll());
-		printf("%-16s%s\n", "plugins:", poll());
-		printf("%-16s%s\n", "events:", poll());
-
-		if (i + 1 < num)
-			printf("\n");
-	}
+	read_rule_list(ok(), 0);
 }
 
 static void
@@ -683,43 +891,11 @@ cmd_server_disconnect(int argc, char **argv)
 	ok();
 }
 
-/*
- * Response:
- *
- *     OK name
- *     hostname port [ssl]
- *     nickname username realname
- *     chan1 chan2 chanN
- */
 static void
 cmd_server_info(int, char **argv)
 {
-	char *list;
-	const char *args[16] = {};
-
-	req("SERVER-INFO %s", argv[0]);
-
-	if (strncmp(list = poll(), "OK ", 3) != 0)
-		irc_util_die("abort: failed to retrieve server information\n");
-
-	printf("%-16s%s\n", "name:", list + 3);
-
-	if (irc_util_split((list = poll()), args, 3, ' ') < 2)
-		irc_util_die("abort: malformed server connection\n");
-
-	printf("%-16s%s\n", "hostname:", args[0]);
-	printf("%-16s%s\n", "port:", args[1]);
-
-	if (args[2])
-		printf("%-16s%s\n", "ssl:", "true");
-
-	if (irc_util_split((list = poll()), args, 3, ' ') != 3)
-		irc_util_die("abort: malformed server ident\n");
-
-	printf("%-16s%s\n", "nickname:", args[0]);
-	printf("%-16s%s\n", "username:", args[0]);
-	printf("%-16s%s\n", "realname:", args[0]);
-	printf("%-16s%s\n", "channels:", poll());
+	req("SERVER-INFO %s", argv[1]);
+	read_server_info(ok(), 1);
 }
 
 static void
@@ -804,13 +980,47 @@ cmd_server_topic(int, char **argv)
 }
 
 static void
-cmd_watch(int, char **)
+cmd_stats(int, char **)
+{
+	req("STATS");
+	read_stats(ok(), 0);
+}
+
+static void
+cmd_watch(int argc, char **argv)
 {
 	struct timeval tv = {};
+	char out[IRC_BUF_LEN] = {};
 	char *ev;
+	FILE *fp;
+	int ch;
+
+	if (!(fp = fmemopen(out, sizeof (out) - 1, "w")))
+		irc_util_die("abort: fmemopen: %s\n", strerror(errno));
+
+	while ((ch = getopt(argc, argv, "c:e:o:r:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+		case 'e':
+		case 'o':
+		case 's':
+			fprintf(fp, " %c=%s", ch, optarg);
+			break;
+		case 'r':
+			fprintf(fp, " since=%s", optarg);
+			break;
+		default:
+			break;
+		}
+	}
 
-	/* Enable watch. */
-	req("WATCH");
+	if (ferror(fp) || feof(fp))
+		irc_util_die("abort: fprintf: %s\n", strerror(errno));
+
+	fclose(fp);
+
+	/* Enable watch, filtered on the server side. */
+	req("WATCH%s", out);
 	ok();
 
 	/* Turn off timeout to receive indefinitely. */
@@ -831,12 +1041,14 @@ static const struct cmd {
 	{ "hook-add",           2,      2,      cmd_hook_add            },
 	{ "hook-list",          0,      0,      cmd_hook_list           },
 	{ "hook-remove",        1,      1,      cmd_hook_remove         },
+	{ "log-level",          0,      2,      cmd_log_level           },
 	{ "plugin-config",      1,      3,      cmd_plugin_config       },
 	{ "plugin-info",        1,      1,      cmd_plugin_info         },
 	{ "plugin-list",        0,      0,      cmd_plugin_list         },
 	{ "plugin-load",        1,      1,      cmd_plugin_load         },
 	{ "plugin-path",        0,      3,      cmd_plugin_path         },
 	{ "plugin-reload",      0,      1,      cmd_plugin_reload       },
+	{ "plugin-stats",      -1,     -1,      cmd_plugin_stats        },
 	{ "plugin-template",    1,      3,      cmd_plugin_template     },
 	{ "plugin-unload",      0,      1,      cmd_plugin_unload       },
 	{ "rule-add",          -1,     -1,      cmd_rule_add            },
@@ -857,7 +1069,8 @@ static const struct cmd {
 	{ "server-part",        2,      3,      cmd_server_part         },
 	{ "server-reconnect",   0,      1,      cmd_server_reconnect    },
 	{ "server-topic",       3,      3,      cmd_server_topic        },
-	{ "watch",              0,      0,      cmd_watch               }
+	{ "stats",              0,      0,      cmd_stats               },
+	{ "watch",             -1,     -1,      cmd_watch               }
 };
 
 static int
@@ -889,15 +1102,155 @@ noreturn static void
 usage(void)
 {
 	fprintf(stderr, "usage: irccdctl [-v] [-s sock] command [options...] [arguments...]\n");
+	fprintf(stderr, "       irccdctl [-v] [-s sock] -b [file]\n");
 	exit(1);
 }
 
+/*
+ * Batch mode sends irccd-ipc(7) commands read line by line without waiting for
+ * each reply. Only a limited number of requests are in flight so that they
+ * always fit in the socket buffer while irccd waits for the longest replies to
+ * be read.
+ */
+#define BATCH_WINDOW 16
+
+struct batch {
+	size_t lineno;
+	const char *error;              /* local error, request not sent */
+	int argc;                       /* number of arguments of the request */
+	void (*read)(const char *, int);
+};
+
+/*
+ * Commands replying with several lines, they are read like the matching
+ * command would. The variables are only listed below a number of arguments,
+ * otherwise they are set with a one line reply.
+ */
+static const struct {
+	const char *name;
+	int argc;
+	void (*read)(const char *, int);
+} batch_readers[] = {
+	{ "LOG-LEVEL",          2,      read_log_level          },
+	{ "PLUGIN-CONFIG",      3,      read_plugin_variables   },
+	{ "PLUGIN-INFO",        2,      read_plugin_info        },
+	{ "PLUGIN-PATH",        3,      read_plugin_variables   },
+	{ "PLUGIN-STATS",       2,      read_plugin_stats       },
+	{ "PLUGIN-TEMPLATE",    3,      read_plugin_variables   },
+	{ "RULE-LIST",          1,      read_rule_list          },
+	{ "SERVER-INFO",        2,      read_server_info        },
+	{ "STATS",              1,      read_stats              }
+};
+
+static const char *
+batch_check(struct batch *b, const char *line)
+{
+	size_t len;
+
+	b->read = NULL;
+	b->argc = 0;
+
+	if (strlen(line) >= IRC_BUF_LEN - 1)
+		return strerror(EMSGSIZE);
+
+	len = strcspn(line, " ");
+
+	/* Events are sent until the connection is closed. */
+	if (len == 5 && strncmp(line, "WATCH", len) == 0)
+		return "command not supported in batch mode";
+
+	for (const char *p = line + len; *(p += strspn(p, " ")); p += strcspn(p, " "))
+		b->argc++;
+
+	for (size_t i = 0; i < IRC_UTIL_SIZE(batch_readers); ++i) {
+		if (strlen(batch_readers[i].name) == len &&
+		    strncmp(batch_readers[i].name, line, len) == 0 &&
+		    b->argc < batch_readers[i].argc)
+			b->read = batch_readers[i].read;
+	}
+
+	return NULL;
+}
+
+/*
+ * Show the status of the oldest request, return non-zero on success.
+ */
+static int
+batch_reply(const struct batch *b)
+{
+	char reply[IRC_BUF_LEN];
+
+	if (b->error) {
+		printf("%zu: ERROR %s\n", b->lineno, b->error);
+		return 0;
+	}
+
+	/* Kept aside, the reader polls the next lines in the same buffer. */
+	snprintf(reply, sizeof (reply), "%s", poll());
+	printf("%zu: %s\n", b->lineno, reply);
+
+	if (strncmp(reply, "OK", 2) != 0)
+		return 0;
+	if (b->read)
+		b->read(reply + 2 + strspn(reply + 2, " "), b->argc);
+
+	return 1;
+}
+
+noreturn static void
+batch(int argc, char **argv)
+{
+	struct batch queue[BATCH_WINDOW], *b;
+	size_t head = 0, len = 0, lineno = 0, linesz = 0;
+	char *line = NULL;
+	int failed = 0;
+	FILE *fp = stdin;
+
+	if (argc > 1)
+		usage();
+	if (argc == 1 && strcmp(argv[0], "-") != 0 && !(fp = fopen(argv[0], "r")))
+		irc_util_die("abort: %s: %s\n", argv[0], strerror(errno));
+
+	while (getline(&line, &linesz, fp) >= 0) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		/* Empty lines and comments. */
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		/* Wait for the oldest reply once the window is full. */
+		if (len == BATCH_WINDOW) {
+			failed |= !batch_reply(&queue[head]);
+			head = (head + 1) % BATCH_WINDOW;
+			len--;
+		}
+
+		b = &queue[(head + len++) % BATCH_WINDOW];
+		b->lineno = lineno;
+
+		if (!(b->error = batch_check(b, line)))
+			req("%s", line);
+	}
+
+	if (ferror(fp))
+		irc_util_die("abort: %s\n", strerror(errno));
+
+	for (; len; --len, head = (head + 1) % BATCH_WINDOW)
+		failed |= !batch_reply(&queue[head]);
+
+	free(line);
+	fclose(fp);
+	exit(failed);
+}
+
 noreturn static void
 help(void)
 {
 	fprintf(stderr, "usage: irccdctl hook-add name path\n");
 	fprintf(stderr, "       irccdctl hook-list\n");
 	fprintf(stderr, "       irccdctl hook-remove id\n");
+	fprintf(stderr, "       irccdctl log-level [subsystem [level]]\n");
 	fprintf(stderr, "       irccdctl plugin-config id [variable [value]]\n");
 	fprintf(stderr, "       irccdctl plugin-info id\n");
 	fprintf(stderr, "       irccdctl plugin-list\n");
@@ -905,6 +1258,7 @@ help(void)
 	fprintf(stderr, "       irccdctl plugin-path id [variable [value]]\n");
 	fprintf(stderr, "       irccdctl plugin-template id [variable [value]]\n");
 	fprintf(stderr, "       irccdctl plugin-reload [id]\n");
+	fprintf(stderr, "       irccdctl plugin-stats [-r] [id]\n");
 	fprintf(stderr, "       irccdctl plugin-unload [id]\n");
 	fprintf(stderr, "       irccdctl rule-add [-c channel] [-e event] [-i index] [-o origin] [-p plugin] [-s server] accept|drop\n");
 	fprintf(stderr, "       irccdctl rule-edit [-a accept|drop] [-c|C channel] [-e|E event] [-o|O origin] [-s|S server] index\n");
@@ -926,19 +1280,23 @@ help(void)
 	fprintf(stderr, "       irccdctl server-part server channel [reason]\n");
 	fprintf(stderr, "       irccdctl server-reconnect [server]\n");
 	fprintf(stderr, "       irccdctl server-topic server channel topic\n");
-	fprintf(stderr, "       irccdctl watch\n");
+	fprintf(stderr, "       irccdctl stats\n");
+	fprintf(stderr, "       irccdctl watch [-c channel] [-e event] [-o origin] [-r seq] [-s server]\n");
 	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-	int ch;
+	int ch, batched = 0;
 
 	putenv("POSIXLY_CORRECT=1");
 
-	while ((ch = getopt(argc, argv, "s:v")) != -1) {
+	while ((ch = getopt(argc, argv, "bs:v")) != -1) {
 		switch (ch) {
+		case 'b':
+			batched = 1;
+			break;
 		case 's':
 			irc_util_strlcpy(sockaddr.sun_path, optarg, sizeof (sockaddr.sun_path));
 			break;
@@ -957,6 +1315,12 @@ main(int argc, char **argv)
 	/* Reset options for subcommands. */
 	optind = 1;
 
+	if (batched) {
+		dial();
+		check();
+		batch(argc, argv);
+	}
+
 	if (argc < 1)
 		usage();
 	else if (strcmp(argv[0], "help") == 0)
@@ -26,6 +26,8 @@
 #include "channel.h"
 #include "util.h"
 
+unsigned long long irc_channel_removals;
+
 static inline struct irc_channel_user *
 find(const struct irc_channel *ch, const char *nickname)
 {
@@ -112,6 +114,9 @@ irc_channel_clear(struct irc_channel *ch)
 		free(user);
 	}
 
+	if (ch->users)
+		irc_channel_removals++;
+
 	ch->users = NULL;
 	ch->flags = IRC_CHANNEL_FLAGS_NONE;
 }
@@ -142,6 +147,7 @@ irc_channel_remove(struct irc_channel *ch, const char *nickname)
 		LL_DELETE(ch->users, user);
 		free(user->nickname);
 		free(user);
+		irc_channel_removals++;
 	}
 }
 
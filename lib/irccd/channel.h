@@ -136,6 +136,12 @@ struct irc_channel {
 	 */
 };
 
+/**
+ * Incremented every time users are removed from any channel, a user obtained
+ * while the value is unchanged is still valid.
+ */
+extern unsigned long long irc_channel_removals;
+
 /**
  * Create a new IRC channel.
  *
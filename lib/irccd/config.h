@@ -0,0 +1,79 @@
+/*
+ * config.h.h -- irccd configuration
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IRCCD_CONFIG_H
+#define IRCCD_CONFIG_H
+
+#define IRCCD_MESSAGE_LEN 512
+
+/**
+ * \brief Irccd major version number.
+ */
+#define IRCCD_VERSION_MAJOR 5
+
+/**
+ * \brief Irccd minor version number.
+ */
+#define IRCCD_VERSION_MINOR 0
+
+/**
+ * \brief Irccd patch version number.
+ */
+#define IRCCD_VERSION_PATCH 0
+
+/**
+ * \brief Irccd version as a string.
+ */
+#define IRCCD_VERSION "5.0.0"
+
+/**
+ * \brief Default system-wide location for cache files.
+ */
+#define IRCCD_CACHEDIR "/usr/local/var/cache/irccd"
+
+/**
+ * \brief Default system-wide location for configuration files.
+ */
+#define IRCCD_SYSCONFDIR "/usr/local/etc"
+
+/**
+ * \brief Default system-wide location for plugins.
+ */
+#define IRCCD_LIBDIR "/usr/local/lib"
+
+/**
+ * \brief Default system-wide location for additional data files.
+ */
+#define IRCCD_DATADIR "/irccd"
+
+/**
+ * \brief Defined if HTTP support is enabled.
+ */
+#define IRCCD_WITH_HTTP
+
+/**
+ * \brief Defined if Javascript support is enabled.
+ */
+#define IRCCD_WITH_JS
+
+/**
+ * \brief Defined if SSL/TLS support is enabled.
+ */
+#undef IRCCD_WITH_SSL
+
+#endif /* !IRCCD_CONFIG_H */
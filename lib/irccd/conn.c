@@ -50,17 +50,15 @@
 #define CONN(Ptr, Field) \
         (IRC_UTIL_CONTAINER_OF(Ptr, struct conn, Field))
 
-#define DEBUG(...) LOG(irc_log_debug, __VA_ARGS__)
-#define INFO(...)  LOG(irc_log_info, __VA_ARGS__)
-#define WARN(...)  LOG(irc_log_warn, __VA_ARGS__)
+#define DEBUG(...) LOG(IRC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define INFO(...)  LOG(IRC_LOG_LEVEL_INFO, __VA_ARGS__)
+#define WARN(...)  LOG(IRC_LOG_LEVEL_WARN, __VA_ARGS__)
 
-#define LOG(Fn, ...)                                                            \
+#define LOG(Level, ...)                                                         \
 do {                                                                            \
-        char line[256] = {};                                                    \
-                                                                                \
-        snprintf(line, sizeof (line), __VA_ARGS__);                             \
-                                                                                \
-        Fn("server %s: %s", conn->parent->name, line);                          \
+        if (irc_log_enabled_in(IRC_LOG_SUBSYSTEM_CONN, (Level)))                \
+                irc_log_write(IRC_LOG_SUBSYSTEM_CONN, (Level),                  \
+                    conn->parent->name, __VA_ARGS__);                           \
 } while (0)
 
 /*
@@ -371,8 +369,10 @@ conn_recv(struct conn *conn, int *events)
 
 	limit = sizeof (conn->in) - conn->insz;
 
-	if ((nr = conn->recv(conn, &conn->in[conn->insz], limit, events)) > 0)
+	if ((nr = conn->recv(conn, &conn->in[conn->insz], limit, events)) > 0) {
 		conn->insz += nr;
+		irc_metric_add(&conn->parent->metrics.bytes_in, nr);
+	}
 
 	return nr;
 }
@@ -399,6 +399,9 @@ conn_send(struct conn *conn, int *events)
 			memmove(conn->out, conn->out + ns, sizeof (conn->out) - ns);
 			conn->outsz -= ns;
 		}
+
+		irc_metric_add(&conn->parent->metrics.bytes_out, ns);
+		irc_metric_set(&conn->parent->metrics.send_queue, conn->outsz);
 	}
 
 	return ns;
@@ -432,22 +435,34 @@ conn_wait(struct conn *conn)
 static int
 conn_next(struct conn *conn, struct conn_msg *msg)
 {
+	struct irc_server_metrics *metrics = &conn->parent->metrics;
 	size_t length;
 	char *pos;
+	int valid;
 
-	if (!(pos = memmem(conn->in, conn->insz, "\r\n", 2)))
-		return 0;
+	while ((pos = memmem(conn->in, conn->insz, "\r\n", 2))) {
+		length = pos - conn->in;
+		valid = length > 0 && length < IRCCD_MESSAGE_LEN;
+
+		irc_metric_inc(&metrics->lines_in);
+
+		if (valid && irc__conn_msg_parse(msg, conn->in, length) < 0) {
+			irc__conn_msg_finish(msg);
+			valid = 0;
+		}
 
-	length = pos - conn->in;
+		/* (Re)move the first message received. */
+		memmove(conn->in, pos + 2, sizeof (conn->in) - (length + 2));
+		conn->insz -= length + 2;
 
-	if (length > 0 && length < IRCCD_MESSAGE_LEN)
-		irc__conn_msg_parse(msg, conn->in, length);
+		if (valid)
+			return 1;
 
-	/* (Re)move the first message received. */
-	memmove(conn->in, pos + 2, sizeof (conn->in) - (length + 2));
-	conn->insz -= length + 2;
+		/* Skip invalid lines rather than passing them to the server. */
+		irc_metric_inc(&metrics->parse_errors);
+	}
 
-	return 1;
+	return 0;
 }
 
 /*
@@ -602,6 +617,7 @@ conn_timer_resurrect(struct conn *conn)
 	}
 
 	nce_coro_destroy(&conn->io_fd.coro);
+	irc_metric_inc(&conn->parent->metrics.reconnects);
 
 	/* Now reschedule ourself to reconnect later. */
 	nce_timer_stop(&conn->timer.timer);
@@ -712,6 +728,9 @@ irc__conn_push(struct conn *conn, const char *data, size_t datasz)
 	memcpy(&conn->out[conn->outsz], "\r\n", 2);
 	conn->outsz += 2;
 
+	irc_metric_inc(&conn->parent->metrics.lines_out);
+	irc_metric_set(&conn->parent->metrics.send_queue, conn->outsz);
+
 	nce_io_reset(&conn->io_fd.io, conn->fd, EV_READ | EV_WRITE);
 
 	return 0;
@@ -734,6 +753,9 @@ irc__conn_destroy(struct conn *conn)
 	nce_coro_destroy(&conn->producer);
 	nce_coro_destroy(&conn->io_fd.coro);
 	nce_coro_destroy(&conn->timer.coro);
+
+	/* Pending output is lost. */
+	irc_metric_set(&conn->parent->metrics.send_queue, 0);
 }
 
 static inline void
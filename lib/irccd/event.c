@@ -26,6 +26,33 @@
 #include "server.h"
 #include "util.h"
 
+static const char * const names[] = {
+	[IRC_EVENT_COMMAND]     = "onCommand",
+	[IRC_EVENT_CONNECT]     = "onConnect",
+	[IRC_EVENT_DISCONNECT]  = "onDisconnect",
+	[IRC_EVENT_INVITE]      = "onInvite",
+	[IRC_EVENT_JOIN]        = "onJoin",
+	[IRC_EVENT_KICK]        = "onKick",
+	[IRC_EVENT_ME]          = "onMe",
+	[IRC_EVENT_MESSAGE]     = "onMessage",
+	[IRC_EVENT_MODE]        = "onMode",
+	[IRC_EVENT_NAMES]       = "onNames",
+	[IRC_EVENT_NICK]        = "onNick",
+	[IRC_EVENT_NOTICE]      = "onNotice",
+	[IRC_EVENT_PART]        = "onPart",
+	[IRC_EVENT_TOPIC]       = "onTopic",
+	[IRC_EVENT_WHOIS]       = "onWhois"
+};
+
+const char *
+irc_event_name(enum irc_event_type type)
+{
+	if (type >= IRC_UTIL_SIZE(names))
+		return NULL;
+
+	return names[type];
+}
+
 int
 irc_event_str(const struct irc_event *ev, char *str, size_t strsz)
 {
@@ -106,6 +133,106 @@ irc_event_str(const struct irc_event *ev, char *str, size_t strsz)
 	return written <= 0 ? -1 : 0;
 }
 
+static inline char *
+dup(const char *str)
+{
+	return str ? irc_util_strdup(str) : NULL;
+}
+
+void
+irc_event_copy(struct irc_event *dst, const struct irc_event *src)
+{
+	assert(dst);
+	assert(src);
+
+	size_t n = 0;
+
+	memcpy(dst, src, sizeof (*src));
+
+	switch (src->type) {
+	case IRC_EVENT_INVITE:
+		dst->invite.origin = dup(src->invite.origin);
+		dst->invite.channel = dup(src->invite.channel);
+		break;
+	case IRC_EVENT_JOIN:
+		dst->join.origin = dup(src->join.origin);
+		dst->join.channel = dup(src->join.channel);
+		break;
+	case IRC_EVENT_KICK:
+		dst->kick.origin = dup(src->kick.origin);
+		dst->kick.channel = dup(src->kick.channel);
+		dst->kick.target = dup(src->kick.target);
+		dst->kick.reason = dup(src->kick.reason);
+		break;
+	case IRC_EVENT_COMMAND:
+	case IRC_EVENT_ME:
+	case IRC_EVENT_MESSAGE:
+		dst->message.origin = dup(src->message.origin);
+		dst->message.channel = dup(src->message.channel);
+		dst->message.message = dup(src->message.message);
+		break;
+	case IRC_EVENT_MODE:
+		dst->mode.origin = dup(src->mode.origin);
+		dst->mode.channel = dup(src->mode.channel);
+		dst->mode.mode = dup(src->mode.mode);
+
+		if (src->mode.args) {
+			while (src->mode.args[n])
+				n++;
+
+			dst->mode.args = irc_util_calloc(n + 1, sizeof (char *));
+
+			for (size_t i = 0; i < n; ++i)
+				dst->mode.args[i] = irc_util_strdup(src->mode.args[i]);
+		}
+		break;
+	case IRC_EVENT_NAMES:
+		dst->names.channel = dup(src->names.channel);
+		dst->names.users = irc_util_calloc(src->names.usersz + 1,
+		    sizeof (*src->names.users));
+
+		for (size_t i = 0; i < src->names.usersz; ++i) {
+			dst->names.users[i].nickname = dup(src->names.users[i].nickname);
+			dst->names.users[i].modes = src->names.users[i].modes;
+		}
+		break;
+	case IRC_EVENT_NICK:
+		dst->nick.origin = dup(src->nick.origin);
+		dst->nick.nickname = dup(src->nick.nickname);
+		break;
+	case IRC_EVENT_NOTICE:
+		dst->notice.origin = dup(src->notice.origin);
+		dst->notice.channel = dup(src->notice.channel);
+		dst->notice.notice = dup(src->notice.notice);
+		break;
+	case IRC_EVENT_PART:
+		dst->part.origin = dup(src->part.origin);
+		dst->part.channel = dup(src->part.channel);
+		dst->part.reason = dup(src->part.reason);
+		break;
+	case IRC_EVENT_TOPIC:
+		dst->topic.origin = dup(src->topic.origin);
+		dst->topic.channel = dup(src->topic.channel);
+		dst->topic.topic = dup(src->topic.topic);
+		break;
+	case IRC_EVENT_WHOIS:
+		dst->whois.nickname = dup(src->whois.nickname);
+		dst->whois.username = dup(src->whois.username);
+		dst->whois.realname = dup(src->whois.realname);
+		dst->whois.hostname = dup(src->whois.hostname);
+		dst->whois.channels = irc_util_calloc(src->whois.channelsz + 1,
+		    sizeof (*src->whois.channels));
+
+		for (size_t i = 0; i < src->whois.channelsz; ++i) {
+			dst->whois.channels[i].name = dup(src->whois.channels[i].name);
+			dst->whois.channels[i].modes = src->whois.channels[i].modes;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
 void
 irc_event_finish(struct irc_event *ev)
 {
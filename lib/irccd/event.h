@@ -158,7 +158,12 @@ enum irc_event_type {
 	 *
 	 * Use with ::irc_event_whois (and ::irc_event::whois).
 	 */
-	IRC_EVENT_WHOIS
+	IRC_EVENT_WHOIS,
+
+	/**
+	 * Number of event types, not a valid event type.
+	 */
+	IRC_EVENT_NUM
 };
 
 /**
@@ -604,6 +609,16 @@ struct irc_event {
 	};
 };
 
+/**
+ * Get the event type name as used in rules and Javascript plugins (e.g.
+ * onMessage).
+ *
+ * \param type the event type
+ * \return the name or NULL if type is not a valid event
+ */
+const char *
+irc_event_name(enum irc_event_type type);
+
 /**
  * Convert an event into a human readable string.
  *
@@ -617,6 +632,20 @@ struct irc_event {
 int
 irc_event_str(const struct irc_event *ev, char *str, size_t strsz);
 
+/**
+ * Deep copy an event, every string and array is duplicated so that the copy
+ * can outlive the original. The server reference is copied as is.
+ *
+ * The copy must be destroyed using ::irc_event_finish.
+ *
+ * \pre dst != NULL
+ * \pre src != NULL
+ * \param dst the destination event
+ * \param src the event to copy
+ */
+void
+irc_event_copy(struct irc_event *dst, const struct irc_event *src);
+
 /**
  * Destroy the event.
  *
@@ -143,6 +143,12 @@ irc_hook_new(const char *name, const char *path)
 	h->name = irc_util_strdup(name);
 	h->path = irc_util_strdup(path);
 
+	h->spawns.name = "irccd_hook_spawns_total";
+	h->spawns.help = "Hook processes spawned.";
+	h->spawns.type = IRC_METRIC_COUNTER;
+	h->spawns.label = "hook";
+	h->spawns.label_value = h->name;
+
 	return h;
 }
 
@@ -169,6 +175,8 @@ irc_hook_invoke(struct irc_hook *h, const struct irc_event *ev)
 		_exit(1);
 		break;
 	default:
+		irc_metric_inc(&h->spawns);
+
 		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
 			continue;
 
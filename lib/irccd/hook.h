@@ -29,6 +29,8 @@
 
 #include <ev.h>
 
+#include "metrics.h"
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -53,6 +55,14 @@ struct irc_hook {
 	 */
 	char *path;
 
+	/**
+	 * (read-only)
+	 *
+	 * Number of processes spawned, registered while the hook is added to
+	 * the bot.
+	 */
+	struct irc_metric spawns;
+
 	/**
 	 * \cond IRC_PRIVATE
 	 */
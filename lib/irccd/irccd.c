@@ -22,17 +22,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <utlist.h>
 
 #include <ev.h>
 
+#include <nce/nce.h>
+
 #include "config.h"
 #include "event.h"
 #include "hook.h"
 #include "irccd.h"
 #include "log.h"
+#include "metrics.h"
 #include "plugin.h"
 #include "rule.h"
 #include "server.h"
@@ -43,21 +47,169 @@ static struct irccd bot = {};
 
 const struct irccd *irccd = &bot;
 
-static int
-is_command(const struct irc_plugin *p, const struct irc_event *ev)
+/* Dispatch metrics. */
+static struct {
+	struct irc_metric count;
+	struct irc_metric duration;
+} dispatch = {
+	.count = {
+		.name = "irccd_dispatch_total",
+		.help = "Events dispatched.",
+		.type = IRC_METRIC_COUNTER
+	},
+	.duration = {
+		.name = "irccd_dispatch_microseconds_total",
+		.help = "Time spent dispatching events.",
+		.type = IRC_METRIC_COUNTER
+	}
+};
+
+/*
+ * Plugins subscribed to every event type, this avoids invoking plugins that
+ * have no interest in an event.
+ *
+ * As plugins may be added or removed while an event is being dispatched, the
+ * tables are only rebuilt when no dispatch is in progress. In the meantime,
+ * removed plugins are simply cleared from the tables.
+ */
+static struct {
+	struct irc_plugin **plugins[IRC_EVENT_NUM];
+	size_t pluginsz[IRC_EVENT_NUM];
+	unsigned int depth;
+	unsigned int removed;
+	int dirty;
+} subscribers;
+
+static void
+subscribers_build(void)
+{
+	struct irc_plugin *p;
+	size_t n;
+
+	for (int i = 0; i < IRC_EVENT_NUM; ++i) {
+		n = 0;
+
+		LL_FOREACH(bot.plugins, p)
+			if (p->events & IRC_PLUGIN_EVENT(i))
+				n++;
+
+		subscribers.plugins[i] = irc_util_reallocarray(subscribers.plugins[i],
+		    n, sizeof (*subscribers.plugins[i]));
+		subscribers.pluginsz[i] = 0;
+
+		LL_FOREACH(bot.plugins, p)
+			if (p->events & IRC_PLUGIN_EVENT(i))
+				subscribers.plugins[i][subscribers.pluginsz[i]++] = p;
+	}
+
+	subscribers.dirty = 0;
+}
+
+static void
+subscribers_clear(const struct irc_plugin *p)
+{
+	for (int i = 0; i < IRC_EVENT_NUM; ++i)
+		for (size_t s = 0; s < subscribers.pluginsz[i]; ++s)
+			if (subscribers.plugins[i][s] == p)
+				subscribers.plugins[i][s] = NULL;
+
+	subscribers.removed++;
+	subscribers.dirty = 1;
+}
+
+static void
+subscribers_finish(void)
+{
+	for (int i = 0; i < IRC_EVENT_NUM; ++i) {
+		subscribers.plugins[i] = irc_util_free(subscribers.plugins[i]);
+		subscribers.pluginsz[i] = 0;
+	}
+
+	subscribers.dirty = 0;
+}
+
+/*
+ * Plugins indexed by name, to find the plugin invoked by a command without
+ * comparing the message against every plugin.
+ */
+#define PLUGINS_BUCKETS 64
+
+static struct irc_plugin *plugins[PLUGINS_BUCKETS];
+
+static inline unsigned int
+plugins_hash(const char *name, size_t namesz)
+{
+	unsigned int h = 2166136261U;
+
+	/* FNV-1a. */
+	for (size_t i = 0; i < namesz; ++i) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619U;
+	}
+
+	return h % PLUGINS_BUCKETS;
+}
+
+static struct irc_plugin *
+plugins_find(const char *name, size_t namesz)
 {
-	const char *cc;
-	size_t ccsz;
+	struct irc_plugin *p;
+
+	for (p = plugins[plugins_hash(name, namesz)]; p; p = p->hnext)
+		if (strncmp(p->name, name, namesz) == 0 && p->name[namesz] == '\0')
+			return p;
+
+	return NULL;
+}
+
+static void
+plugins_insert(struct irc_plugin *p)
+{
+	unsigned int h = plugins_hash(p->name, strlen(p->name));
+
+	p->hnext = plugins[h];
+	plugins[h] = p;
+}
+
+static void
+plugins_delete(struct irc_plugin *p)
+{
+	unsigned int h = plugins_hash(p->name, strlen(p->name));
+	struct irc_plugin **pp;
+
+	for (pp = &plugins[h]; *pp; pp = &(*pp)->hnext) {
+		if (*pp == p) {
+			*pp = p->hnext;
+			break;
+		}
+	}
+
+	p->hnext = NULL;
+}
+
+static struct irc_plugin *
+find_command(const struct irc_event *ev)
+{
+	const char *cc, *cmd;
+	size_t ccsz, cmdsz = 0;
 
 	if (ev->type != IRC_EVENT_MESSAGE)
-		return 0;
+		return NULL;
 
 	/* Get the command prefix (e.g !)*/
 	cc = ev->server->prefix;
 	ccsz = strlen(cc);
 
-	return strncmp(ev->message.message, cc, ccsz) == 0 &&
-	       strncmp(ev->message.message + ccsz, p->name, strlen(p->name)) == 0;
+	if (strncmp(ev->message.message, cc, ccsz) != 0)
+		return NULL;
+
+	/* Extract the plugin name up to the first space (e.g. !ask). */
+	cmd = ev->message.message + ccsz;
+
+	while (cmd[cmdsz] && !isspace((unsigned char)cmd[cmdsz]))
+		++cmdsz;
+
+	return cmdsz ? plugins_find(cmd, cmdsz) : NULL;
 }
 
 static struct irc_event *
@@ -131,6 +283,296 @@ invokable(const struct irc_plugin *p, const struct irc_event *ev)
 	}
 }
 
+static int
+is_loaded(const struct irc_plugin *p)
+{
+	const struct irc_plugin *iter;
+
+	LL_FOREACH(bot.plugins, iter)
+		if (iter == p)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Invoke the plugin and record the time spent into its statistics.
+ */
+static void
+invoke(struct irc_plugin *p, const struct irc_event *ev)
+{
+	struct timespec start, end;
+	unsigned long long duration;
+	unsigned int removed;
+	int rc;
+
+	removed = subscribers.removed;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = irc_plugin_handle(p, ev);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* The plugin may have removed itself. */
+	if (removed != subscribers.removed && !is_loaded(p))
+		return;
+
+	/* Handled later, the plugin records it then. */
+	if (rc > 0)
+		return;
+
+	duration = (end.tv_sec - start.tv_sec) * 1000000ULL;
+	duration += end.tv_nsec / 1000;
+	duration -= start.tv_nsec / 1000;
+
+	irc_plugin_stats_record(&p->stats[ev->type], duration, rc < 0);
+}
+
+/*
+ * Plugin event queues.
+ *
+ * When a coroutine scheduler is running, every plugin gets a worker coroutine
+ * that processes a copy of the events dispatched to it so that servers never
+ * wait for plugins. A worker spends at most the plugin time budget per loop
+ * iteration, the idle watcher keeps the loop spinning while events are
+ * pending.
+ *
+ * A plugin may be removed while its worker is running (e.g. unloading itself),
+ * workers are thus never destroyed on removal but detached and destroyed
+ * later once terminated.
+ */
+struct pending {
+	struct irc_event ev;
+	struct pending *next;
+	struct pending *prev;
+};
+
+struct irc_plugin_worker {
+	struct irc_plugin *plugin;
+	struct pending *events;
+	struct nce_coro coro;
+	struct irc_plugin_worker *next;
+};
+
+static struct {
+	struct irc_plugin_worker *graveyard;
+	struct ev_idle idle;
+	size_t pending;
+} workers;
+
+static void workers_reap(void);
+
+static void
+workers_idle_cb(struct ev_idle *, int)
+{
+	/* Outside of any coroutine, detached workers can be destroyed. */
+	workers_reap();
+
+	if (!workers.pending)
+		ev_idle_stop(&workers.idle);
+}
+
+static inline void
+workers_wakeup(void)
+{
+	if (!ev_cb(&workers.idle))
+		ev_idle_init(&workers.idle, workers_idle_cb);
+
+	ev_idle_start(&workers.idle);
+}
+
+static inline unsigned long long
+workers_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000ULL +
+	    now.tv_nsec / 1000000 - start->tv_nsec / 1000000;
+}
+
+static void
+pending_free(struct pending *pe)
+{
+	if (pe->ev.server)
+		irc_server_decref(pe->ev.server);
+
+	irc_event_finish(&pe->ev);
+	free(pe);
+}
+
+static void
+pending_remove(struct irc_plugin_worker *w, struct pending *pe)
+{
+	DL_DELETE(w->events, pe);
+	w->plugin->queue.pending--;
+	workers.pending--;
+}
+
+/*
+ * Make room for a new event according to the plugin overflow policy, return
+ * -1 if the new event must be discarded instead.
+ */
+static int
+worker_overflow(struct irc_plugin_worker *w, const struct irc_event *ev)
+{
+	struct irc_plugin_queue *q = &w->plugin->queue;
+	struct pending *pe;
+
+	switch (q->overflow) {
+	case IRC_PLUGIN_OVERFLOW_BLOCK:
+		q->spilled++;
+		return 0;
+	case IRC_PLUGIN_OVERFLOW_DROP_TYPE:
+		DL_FOREACH(w->events, pe)
+			if (q->droppable & IRC_PLUGIN_EVENT(pe->ev.type))
+				break;
+
+		if (!pe) {
+			if (q->droppable & IRC_PLUGIN_EVENT(ev->type))
+				return -1;
+
+			q->spilled++;
+			return 0;
+		}
+		break;
+	default:
+		pe = w->events;
+		break;
+	}
+
+	pending_remove(w, pe);
+	pending_free(pe);
+	q->dropped++;
+
+	return 0;
+}
+
+static void
+worker_push(struct irc_plugin_worker *w, const struct irc_event *ev)
+{
+	struct irc_plugin_queue *q = &w->plugin->queue;
+	struct pending *pe;
+
+	if (q->pending >= q->max && worker_overflow(w, ev) < 0) {
+		q->dropped++;
+		return;
+	}
+
+	pe = irc_util_calloc(1, sizeof (*pe));
+	irc_event_copy(&pe->ev, ev);
+
+	if (pe->ev.server)
+		irc_server_incref(pe->ev.server);
+
+	DL_APPEND(w->events, pe);
+
+	if (++q->pending > q->peak)
+		q->peak = q->pending;
+
+	q->queued++;
+	workers.pending++;
+	workers_wakeup();
+}
+
+static void
+worker_entry(struct nce_coro *self)
+{
+	struct irc_plugin_worker *w;
+	struct irc_plugin_queue *q;
+	struct pending *pe;
+	struct timespec start;
+
+	w = IRC_UTIL_CONTAINER_OF(self, struct irc_plugin_worker, coro);
+
+	while (w->plugin) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		while (w->plugin && (pe = w->events)) {
+			pending_remove(w, pe);
+			invoke(w->plugin, &pe->ev);
+			pending_free(pe);
+
+			/* The plugin may have been removed meanwhile. */
+			if (!(q = w->plugin ? &w->plugin->queue : NULL))
+				break;
+
+			/* Always catch up when the queue went past its limit. */
+			if (q->budget && q->pending <= q->max &&
+			    workers_elapsed(&start) >= q->budget)
+				break;
+		}
+
+		if (w->plugin)
+			nce_coro_yield();
+	}
+}
+
+static void
+worker_new(struct irc_plugin *p)
+{
+	struct irc_plugin_worker *w;
+
+	w = irc_util_calloc(1, sizeof (*w));
+	w->plugin = p;
+	w->coro.name = "plugin.worker";
+	w->coro.entry = worker_entry;
+	w->coro.flags = NCE_IMMORTAL;
+
+	p->worker = w;
+	nce_coro_spawn(&w->coro);
+}
+
+static void
+worker_detach(struct irc_plugin *p)
+{
+	struct irc_plugin_worker *w = p->worker;
+	struct pending *pe;
+
+	if (!w)
+		return;
+
+	while ((pe = w->events)) {
+		pending_remove(w, pe);
+		pending_free(pe);
+	}
+
+	w->plugin = NULL;
+	p->worker = NULL;
+	LL_PREPEND(workers.graveyard, w);
+	workers_wakeup();
+}
+
+/*
+ * Destroy detached workers, must not be called from a coroutine as the
+ * scheduler may be iterating over them.
+ */
+static void
+workers_reap(void)
+{
+	struct irc_plugin_worker *w, *tmp;
+
+	LL_FOREACH_SAFE(workers.graveyard, w, tmp) {
+		nce_coro_destroy(&w->coro);
+		free(w);
+	}
+
+	workers.graveyard = NULL;
+}
+
+/*
+ * Hand the event to the plugin worker if it has one, otherwise invoke the
+ * plugin directly.
+ */
+static inline void
+deliver(struct irc_plugin *p, const struct irc_event *ev)
+{
+	if (p->worker)
+		worker_push(p->worker, ev);
+	else
+		invoke(p, ev);
+}
+
 static struct irc_plugin *
 try_plugin(struct irc_plugin_loader *ldr, const char *base, const char *name, const char *ext)
 {
@@ -203,10 +645,35 @@ is_extension_valid(const struct irc_plugin_loader *ldr, const char *path)
 	return valid;
 }
 
+static void
+server_metrics(struct irc_server *s, void (*fn)(struct irc_metric *))
+{
+	fn(&s->metrics.lines_in);
+	fn(&s->metrics.lines_out);
+	fn(&s->metrics.bytes_in);
+	fn(&s->metrics.bytes_out);
+	fn(&s->metrics.parse_errors);
+	fn(&s->metrics.reconnects);
+	fn(&s->metrics.send_queue);
+}
+
+static inline unsigned long long
+dispatch_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000ULL +
+	    now.tv_nsec / 1000 - start->tv_nsec / 1000;
+}
+
 void
 irc_bot_init(void)
 {
 	irc_log_to_console();
+	irc_metrics_register(&dispatch.count);
+	irc_metrics_register(&dispatch.duration);
 }
 
 int
@@ -223,6 +690,7 @@ irc_bot_server_add(struct irc_server *s)
 
 	irc_server_incref(s);
 	irc_server_connect(s);
+	server_metrics(s, irc_metrics_register);
 
 	LL_APPEND(bot.servers, s);
 
@@ -258,7 +726,9 @@ irc_bot_server_remove(const char *name)
 	});
 
 	LL_DELETE(bot.servers, s);
+	server_metrics(s, irc_metrics_unregister);
 	irc_server_decref(s);
+	bot.server_removals++;
 }
 
 void
@@ -286,6 +756,13 @@ irc_bot_plugin_add(struct irc_plugin *p)
 
 	if ((rc = irc_plugin_load(p)) == 0) {
 		LL_PREPEND(bot.plugins, p);
+		plugins_insert(p);
+		subscribers.dirty = 1;
+
+		/* Without scheduler, plugins are invoked synchronously. */
+		if (p->queue.max && nce_sched_default)
+			worker_new(p);
+
 		irc_log_info("irccd: add new plugin: %s (%s)", p->name, p->description);
 		irc_log_info("irccd: %s: version %s, from %s (%s license)", p->name,
 		    p->version, p->author, p->license);
@@ -354,13 +831,25 @@ irc_bot_plugin_search(const char *name, const char *path)
 struct irc_plugin *
 irc_bot_plugin_get(const char *name)
 {
+	assert(name);
+
+	return plugins_find(name, strlen(name));
+}
+
+int
+irc_bot_plugin_reload(const char *name)
+{
+	assert(name);
+
 	struct irc_plugin *p;
 
-	LL_FOREACH(bot.plugins, p)
-		if (strcmp(p->name, name) == 0)
-			return p;
+	if (!(p = irc_bot_plugin_get(name)))
+		return -1;
 
-	return NULL;
+	irc_plugin_reload(p);
+	subscribers.dirty = 1;
+
+	return 0;
 }
 
 void
@@ -372,6 +861,9 @@ irc_bot_plugin_remove(const char *name)
 		return;
 
 	LL_DELETE(bot.plugins, p);
+	plugins_delete(p);
+	subscribers_clear(p);
+	worker_detach(p);
 	irc_plugin_unload(p);
 	irc_plugin_finish(p);
 }
@@ -501,6 +993,7 @@ irc_bot_hook_add(struct irc_hook *h)
 	}
 
 	LL_PREPEND(bot.hooks, h);
+	irc_metrics_register(&h->spawns);
 
 	return 0;
 }
@@ -526,6 +1019,7 @@ irc_bot_hook_remove(const char *name)
 
 	if ((h = irc_bot_hook_get(name))) {
 		LL_DELETE(bot.hooks, h);
+		irc_metrics_unregister(&h->spawns);
 		irc_hook_free(h);
 	}
 }
@@ -535,8 +1029,10 @@ irc_bot_hook_clear(void)
 {
 	struct irc_hook *h, *tmp;
 
-	LL_FOREACH_SAFE(bot.hooks, h, tmp)
+	LL_FOREACH_SAFE(bot.hooks, h, tmp) {
+		irc_metrics_unregister(&h->spawns);
 		irc_hook_free(h);
+	}
 
 	bot.hooks = NULL;
 }
@@ -544,12 +1040,22 @@ irc_bot_hook_clear(void)
 void
 irc_bot_dispatch(const struct irc_event *ev)
 {
-	struct irc_plugin *p, *ptmp, *plgcmd = NULL;
+	assert(ev);
+	assert(ev->type < IRC_EVENT_NUM);
+
+	struct irc_plugin *p, *plgcmd;
 	struct irc_hook *h, *htmp;
+	struct timespec start;
+	unsigned int removed;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	LL_FOREACH_SAFE(bot.hooks, h, htmp)
 		irc_hook_invoke(h, ev);
 
+	if (subscribers.dirty && subscribers.depth == 0)
+		subscribers_build();
+
 	/*
 	 * Invoke for every plugin the event verbatim. Then, the event may match
 	 * a plugin name command in that case we need to modify the event but
@@ -563,19 +1069,34 @@ irc_bot_dispatch(const struct irc_event *ev)
 	 * If the message is "!ask will I be reach?" then it will invoke
 	 * onMessage for hangman and logger but onCommand for ask. As such call
 	 * hangman and logger first and modify event before ask.
+	 *
+	 * Only plugins subscribed to the event type are considered.
 	 */
-	LL_FOREACH_SAFE(bot.plugins, p, ptmp) {
-		if (is_command(p, ev))
-			plgcmd = p;
-		else if (invokable(p, ev))
-			irc_plugin_handle(p, ev);
+	plgcmd = find_command(ev);
+	removed = subscribers.removed;
+	subscribers.depth++;
+
+	for (size_t i = 0; i < subscribers.pluginsz[ev->type]; ++i) {
+		if (!(p = subscribers.plugins[ev->type][i]) || p == plgcmd)
+			continue;
+		if (invokable(p, ev))
+			deliver(p, ev);
 	}
 
-	if (plgcmd && invokable(plgcmd, ev))
-		irc_plugin_handle(plgcmd, to_command(plgcmd, ev));
+	/* The command plugin may have been removed in the meantime. */
+	if (removed != subscribers.removed)
+		plgcmd = find_command(ev);
+	if (plgcmd && (plgcmd->events & IRC_PLUGIN_EVENT(IRC_EVENT_COMMAND)) &&
+	    invokable(plgcmd, ev))
+		deliver(plgcmd, to_command(plgcmd, ev));
+
+	subscribers.depth--;
 
 	if (irccd->observer)
 		irccd->observer(ev);
+
+	irc_metric_inc(&dispatch.count);
+	irc_metric_add(&dispatch.duration, dispatch_elapsed(&start));
 }
 
 void
@@ -602,4 +1123,11 @@ irc_bot_finish(void)
 	irc_bot_plugin_clear();
 	irc_bot_hook_clear();
 	irc_bot_rule_clear();
+
+	subscribers_finish();
+
+	workers_reap();
+
+	if (ev_cb(&workers.idle))
+		ev_idle_stop(&workers.idle);
 }
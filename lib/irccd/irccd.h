@@ -43,6 +43,9 @@ struct irccd {
 	struct irc_rule *rules;
 	struct irc_hook *hooks;
 	irc_observer_t observer;
+
+	/* Incremented every time a server is removed. */
+	unsigned long long server_removals;
 };
 
 /**
@@ -132,6 +135,19 @@ irc_bot_plugin_search(const char *name, const char *path);
 struct irc_plugin *
 irc_bot_plugin_get(const char *name);
 
+/**
+ * Reload a plugin specified by name.
+ *
+ * Invoke the plugin "reload" callback and refresh the list of events the
+ * plugin is subscribed to.
+ *
+ * \pre name != NULL
+ * \param name the plugin name to reload
+ * \return 0 on success or -1 if not found
+ */
+int
+irc_bot_plugin_reload(const char *name);
+
 /**
  * Remove a plugin specified by name.
  *
@@ -16,34 +16,76 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "log.h"
+#include "metrics.h"
 #include "subst.h"
 #include "util.h"
 
 #define DEFAULT_TEMPLATE "#{message}"
 
-enum level {
-	LEVEL_INFO,
-	LEVEL_WARN,
-	LEVEL_DEBUG
+/*
+ * Lines logged into a file are queued into a ring with a single producer (the
+ * event loop) and a single consumer (the writer thread) so that the daemon
+ * never waits for the disk. The writer is woken up once the pending data
+ * reaches FILE_FLUSH_SIZE and writes at least every FILE_FLUSH_DELAY
+ * milliseconds otherwise.
+ */
+#define FILE_RING_SIZE          (256 * 1024)    /* must be a power of two */
+#define FILE_FLUSH_SIZE         (16 * 1024)
+#define FILE_FLUSH_DELAY        250
+
+static struct {
+	char ring[FILE_RING_SIZE];
+	atomic_size_t head;             /* total bytes queued, producer only */
+	atomic_size_t tail;             /* total bytes written, writer only */
+	atomic_ulong dropped;           /* lines lost since last report */
+	atomic_int reopen;
+	atomic_int stop;
+	int forked;                     /* in a child process, write directly */
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	pthread_cond_t flushed;
+	unsigned int flush_req;         /* flushes requested, under mtx */
+	unsigned int flush_done;        /* flushes completed, under mtx */
+	char *path;
+	int fd;
+	size_t size;                    /* current file size */
+	size_t rotate_size;
+	unsigned int rotate_count;
+} file = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.flushed = PTHREAD_COND_INITIALIZER,
+	.fd = -1
 };
 
 static FILE *out, *err;
-static int verbosity;
-static char tmpl[512] = DEFAULT_TEMPLATE;
+static struct irc_subst_template *tmpl;
+static size_t rotate_size;
+static unsigned int rotate_count;
 
 static void
-handler_files(enum level level, const char *line)
+handler_console(enum irc_log_level level, const char *line)
 {
 	switch (level) {
-	case LEVEL_WARN:
+	case IRC_LOG_LEVEL_WARN:
 		fprintf(err, "%s\n", line);
 		fflush(err);
 		break;
@@ -54,23 +96,245 @@ handler_files(enum level level, const char *line)
 	}
 }
 
+/*
+ * Write every vector entirely, retrying on short writes.
+ */
+static void
+file_writev(struct iovec *iov, int iovcnt)
+{
+	ssize_t nw;
+
+	while (iovcnt > 0) {
+		if ((nw = writev(file.fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* Nowhere to report, the data is lost. */
+			return;
+		}
+
+		file.size += nw;
+
+		for (; iovcnt > 0 && (size_t)nw >= iov->iov_len; --iovcnt)
+			nw -= (iov++)->iov_len;
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + nw;
+			iov->iov_len -= nw;
+		}
+	}
+}
+
+static void
+file_open(void)
+{
+	struct stat st;
+
+	if (file.fd != -1)
+		close(file.fd);
+
+	file.fd = open(file.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	file.size = file.fd != -1 && fstat(file.fd, &st) == 0 ? st.st_size : 0;
+}
+
+/*
+ * Shift the previous files as path.1 to path.<count> and start a new one.
+ */
+static void
+file_rotate(void)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	for (unsigned int i = file.rotate_count; i > 1; --i) {
+		snprintf(from, sizeof (from), "%s.%u", file.path, i - 1);
+		snprintf(to, sizeof (to), "%s.%u", file.path, i);
+		rename(from, to);
+	}
+
+	if (file.rotate_count) {
+		snprintf(to, sizeof (to), "%s.1", file.path);
+		rename(file.path, to);
+	} else
+		unlink(file.path);
+
+	file_open();
+}
+
+/*
+ * Write everything queued so far in one system call.
+ */
+static void
+file_drain(void)
+{
+	struct iovec iov[3];
+	char notice[64];
+	size_t head, tail, start, len;
+	unsigned long dropped;
+	int iovcnt = 0;
+
+	tail = atomic_load_explicit(&file.tail, memory_order_relaxed);
+	head = atomic_load_explicit(&file.head, memory_order_acquire);
+
+	if ((dropped = atomic_exchange(&file.dropped, 0))) {
+		iov[iovcnt].iov_base = notice;
+		iov[iovcnt++].iov_len = snprintf(notice, sizeof (notice),
+		    "log: %lu lines dropped\n", dropped);
+	}
+
+	if (head != tail) {
+		start = tail & (FILE_RING_SIZE - 1);
+		len = head - tail;
+
+		iov[iovcnt].iov_base = &file.ring[start];
+
+		if (start + len > FILE_RING_SIZE) {
+			iov[iovcnt++].iov_len = FILE_RING_SIZE - start;
+			iov[iovcnt].iov_base = file.ring;
+			iov[iovcnt++].iov_len = len - (FILE_RING_SIZE - start);
+		} else
+			iov[iovcnt++].iov_len = len;
+	}
+
+	if (iovcnt && file.fd != -1)
+		file_writev(iov, iovcnt);
+
+	atomic_store_explicit(&file.tail, head, memory_order_release);
+
+	if (file.rotate_size && file.size >= file.rotate_size)
+		file_rotate();
+}
+
+static void *
+file_writer(void *data)
+{
+	struct timespec ts;
+	size_t pending;
+	unsigned int req;
+	int stop;
+
+	(void)data;
+
+	do {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += FILE_FLUSH_DELAY * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+
+		pthread_mutex_lock(&file.mtx);
+
+		for (;;) {
+			pending = atomic_load(&file.head) - atomic_load(&file.tail);
+
+			if (atomic_load(&file.stop) || atomic_load(&file.reopen) || pending >= FILE_FLUSH_SIZE)
+				break;
+			if (file.flush_req != file.flush_done)
+				break;
+			if (pthread_cond_timedwait(&file.cond, &file.mtx, &ts) == ETIMEDOUT)
+				break;
+		}
+
+		/* Everything queued before this request is written below. */
+		req = file.flush_req;
+		pthread_mutex_unlock(&file.mtx);
+
+		/* Lines queued before stopping are still written. */
+		stop = atomic_load(&file.stop);
+
+		/* Lines queued before reopening still go to the previous file. */
+		if (atomic_exchange(&file.reopen, 0)) {
+			file_drain();
+			file_open();
+		}
+
+		file_drain();
+
+		pthread_mutex_lock(&file.mtx);
+		file.flush_done = req;
+		pthread_cond_broadcast(&file.flushed);
+		pthread_mutex_unlock(&file.mtx);
+	} while (!stop);
+
+	return NULL;
+}
+
+static void
+file_wakeup(void)
+{
+	pthread_mutex_lock(&file.mtx);
+	pthread_cond_signal(&file.cond);
+	pthread_mutex_unlock(&file.mtx);
+}
+
+static void
+handler_file(enum irc_log_level level, const char *line)
+{
+	size_t len, head, tail, start, first;
+
+	(void)level;
+
+	len = strlen(line);
+
+	/* No writer thread in a forked child. */
+	if (file.forked) {
+		file_writev((struct iovec []) {
+			{ .iov_base = (char *)line, .iov_len = len },
+			{ .iov_base = "\n", .iov_len = 1 }
+		}, 2);
+		return;
+	}
+
+	head = atomic_load_explicit(&file.head, memory_order_relaxed);
+	tail = atomic_load_explicit(&file.tail, memory_order_acquire);
+
+	if (FILE_RING_SIZE - (head - tail) < len + 1) {
+		atomic_fetch_add(&file.dropped, 1);
+		return;
+	}
+
+	start = head & (FILE_RING_SIZE - 1);
+	first = len < FILE_RING_SIZE - start ? len : FILE_RING_SIZE - start;
+
+	memcpy(&file.ring[start], line, first);
+	memcpy(file.ring, line + first, len - first);
+	file.ring[(head + len) & (FILE_RING_SIZE - 1)] = '\n';
+
+	atomic_store_explicit(&file.head, head + len + 1, memory_order_release);
+
+	/* Wake up the writer only when crossing the threshold. */
+	if (head - tail < FILE_FLUSH_SIZE && head + len + 1 - tail >= FILE_FLUSH_SIZE)
+		file_wakeup();
+}
+
 static void
-finalizer_files(void)
+file_atfork(void)
 {
-	/* Out and err are the same. */
-	if (out)
-		fclose(out);
+	file.forked = 1;
+}
 
-	out = err = NULL;
+static void
+finalizer_file(void)
+{
+	atomic_store(&file.stop, 1);
+	file_wakeup();
+	pthread_join(file.thread, NULL);
+
+	if (file.fd != -1)
+		close(file.fd);
+
+	free(file.path);
+	file.path = NULL;
+	file.fd = -1;
+	atomic_store(&file.stop, 0);
+	atomic_store(&file.reopen, 0);
 }
 
 static void
-handler_syslog(enum level level, const char *line)
+handler_syslog(enum irc_log_level level, const char *line)
 {
 	static const int table[] = {
-		[LEVEL_INFO] = LOG_INFO,
-		[LEVEL_WARN] = LOG_WARNING,
-		[LEVEL_DEBUG] = LOG_DEBUG
+		[IRC_LOG_LEVEL_INFO] = LOG_INFO,
+		[IRC_LOG_LEVEL_WARN] = LOG_WARNING,
+		[IRC_LOG_LEVEL_DEBUG] = LOG_DEBUG
 	};
 
 	syslog(table[level], "%s", line);
@@ -82,17 +346,186 @@ finalizer_syslog(void)
 	closelog();
 }
 
-static void (*handler)(enum level, const char *);
+static void (*handler)(enum irc_log_level, const char *);
 static void (*finalizer)(void);
 
+enum irc_log_level irc_log_levels[IRC_LOG_SUBSYSTEM_NUM];
+
 static const char *levelstr[] = {
-	[LEVEL_DEBUG]   = "debug",
-	[LEVEL_INFO]    = "info",
-	[LEVEL_WARN]    = "warning"
+	[IRC_LOG_LEVEL_DEBUG]           = "debug",
+	[IRC_LOG_LEVEL_INFO]            = "info",
+	[IRC_LOG_LEVEL_WARN]            = "warning"
 };
 
+static const char *substr[] = {
+	[IRC_LOG_SUBSYSTEM_CORE]        = "core",
+	[IRC_LOG_SUBSYSTEM_CONN]        = "conn",
+	[IRC_LOG_SUBSYSTEM_SERVER]      = "server",
+	[IRC_LOG_SUBSYSTEM_PLUGIN]      = "plugin",
+	[IRC_LOG_SUBSYSTEM_TRANSPORT]   = "transport"
+};
+
+/*
+ * One message kept out of every rate for each subsystem, count is the number
+ * of messages seen since the last one kept.
+ */
+static struct {
+	unsigned int rate;
+	unsigned int count;
+	struct irc_metric sampled;
+} samples[IRC_LOG_SUBSYSTEM_NUM];
+
+/* Write JSON objects rather than the template. */
+static int json;
+
+static int
+sample(enum irc_log_subsystem sub, enum irc_log_level level)
+{
+	if (level == IRC_LOG_LEVEL_WARN || samples[sub].rate <= 1)
+		return 1;
+
+	if (samples[sub].count++ == 0)
+		return 1;
+	if (samples[sub].count == samples[sub].rate)
+		samples[sub].count = 0;
+
+	irc_metric_inc(&samples[sub].sampled);
+
+	return 0;
+}
+
+/*
+ * Return the length of the UTF-8 sequence at str or 0 if it is invalid, that
+ * is truncated, overlong, a surrogate or past U+10FFFF.
+ */
+static size_t
+utf8_len(const unsigned char *str)
+{
+	unsigned int cp;
+	size_t len;
+
+	if (str[0] < 0x80)
+		return 1;
+	else if ((str[0] & 0xe0) == 0xc0) {
+		len = 2;
+		cp = str[0] & 0x1f;
+	} else if ((str[0] & 0xf0) == 0xe0) {
+		len = 3;
+		cp = str[0] & 0x0f;
+	} else if ((str[0] & 0xf8) == 0xf0) {
+		len = 4;
+		cp = str[0] & 0x07;
+	} else
+		return 0;
+
+	/* The terminator is not a continuation byte either. */
+	for (size_t i = 1; i < len; ++i) {
+		if ((str[i] & 0xc0) != 0x80)
+			return 0;
+
+		cp = (cp << 6) | (str[i] & 0x3f);
+	}
+
+	if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000))
+		return 0;
+	if ((cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+		return 0;
+
+	return len;
+}
+
+/*
+ * Append the string as JSON, truncated silently. Bytes that are not valid
+ * UTF-8 are replaced with U+FFFD so that the line is always valid JSON.
+ */
+static void
+json_escape(char **out, size_t *outsz, const char *str)
+{
+	size_t len;
+	int n;
+
+	for (; *str && *outsz > 1; str += len) {
+		len = 1;
+
+		switch (*str) {
+		case '"':
+		case '\\':
+			n = snprintf(*out, *outsz, "\\%c", *str);
+			break;
+		case '\n':
+			n = snprintf(*out, *outsz, "\\n");
+			break;
+		case '\t':
+			n = snprintf(*out, *outsz, "\\t");
+			break;
+		default:
+			if ((unsigned char)*str < 0x20)
+				n = snprintf(*out, *outsz, "\\u%04x", *str);
+			else if (!(len = utf8_len((const unsigned char *)str))) {
+				n = snprintf(*out, *outsz, "\\ufffd");
+				len = 1;
+			} else
+				n = snprintf(*out, *outsz, "%.*s", (int)len, str);
+			break;
+		}
+
+		/* Never write half of an escape sequence or character. */
+		if ((size_t)n >= *outsz) {
+			**out = '\0';
+			break;
+		}
+
+		*out += n;
+		*outsz -= n;
+	}
+}
+
 static void
-wrap(enum level level, const char *fmt, va_list ap)
+json_format(char *out,
+            size_t outsz,
+            enum irc_log_subsystem sub,
+            enum irc_log_level level,
+            const char *server,
+            const char *message)
+{
+	struct timespec ts;
+	struct tm tm;
+	char date[32];
+	int n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	gmtime_r(&ts.tv_sec, &tm);
+	strftime(date, sizeof (date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	n = snprintf(out, outsz, "{\"time\":\"%s.%03ldZ\",\"level\":\"%s\",\"subsystem\":\"%s\"",
+	    date, ts.tv_nsec / 1000000, levelstr[level], substr[sub]);
+	out += n;
+	outsz -= n;
+
+	if (server) {
+		n = snprintf(out, outsz, ",\"server\":\"");
+		out += n;
+		outsz -= n;
+		json_escape(&out, &outsz, server);
+		n = snprintf(out, outsz, "\"");
+		out += n;
+		outsz -= n;
+	}
+
+	/* Keep room for the end of the object whatever the message. */
+	n = snprintf(out, outsz, ",\"message\":\"");
+	out += n;
+	outsz -= n + 2;
+	json_escape(&out, &outsz, message);
+	snprintf(out, outsz + 2, "\"}");
+}
+
+static void
+wrap(enum irc_log_subsystem sub,
+     enum irc_log_level level,
+     const char *server,
+     const char *fmt,
+     va_list ap)
 {
 	char formatted[1024] = {}, line[1024] = {};
 	struct irc_subst_keyword kw[] = {
@@ -105,16 +538,54 @@ wrap(enum level level, const char *fmt, va_list ap)
 		         IRC_SUBST_KEYWORDS |
 		         IRC_SUBST_ENV |
 		         IRC_SUBST_SHELL |
+		         IRC_SUBST_SHELL_CACHE |
 		         IRC_SUBST_SHELL_ATTRS,
 		.keywords = kw,
 		.keywordsz = IRC_UTIL_SIZE(kw)
 	};
+	int n = 0;
+
+	if (!sample(sub, level))
+		return;
+
+	if (json) {
+		vsnprintf(line, sizeof (line), fmt, ap);
+		json_format(formatted, sizeof (formatted), sub, level, server, line);
+		handler(level, formatted);
+		return;
+	}
+
+	/* The default template is always valid. */
+	if (!tmpl)
+		tmpl = irc_subst_compile(DEFAULT_TEMPLATE);
+
+	if (server)
+		n = snprintf(line, sizeof (line), "server %s: ", server);
+	if (n >= 0 && (size_t)n < sizeof (line))
+		vsnprintf(line + n, sizeof (line) - n, fmt, ap);
 
-	vsnprintf(line, sizeof (line), fmt, ap);
-	irc_subst(formatted, sizeof (formatted), tmpl, &subst);
+	irc_subst_exec(tmpl, formatted, sizeof (formatted), &subst);
 	handler(level, formatted);
 }
 
+const char *
+irc_log_level_name(enum irc_log_level level)
+{
+	if (level >= IRC_UTIL_SIZE(levelstr))
+		return NULL;
+
+	return levelstr[level];
+}
+
+const char *
+irc_log_subsystem_name(enum irc_log_subsystem sub)
+{
+	if (sub >= IRC_UTIL_SIZE(substr))
+		return NULL;
+
+	return substr[sub];
+}
+
 void
 irc_log_to_syslog(void)
 {
@@ -134,20 +605,85 @@ irc_log_to_console(void)
 	out = stdout;
 	err = stderr;
 
-	handler = handler_files;
+	handler = handler_console;
 	finalizer = NULL;
 }
 
 void
-irc_log_to_file(const char *file)
+irc_log_to_file(const char *path)
 {
+	assert(path);
+
+	static int registered;
+	int rc;
+
 	irc_log_finish();
 
-	if (!(out = err = fopen(file, "a")))
-		irc_log_warn("%s: %s", file, strerror(errno));
+	file.path = irc_util_strdup(path);
+	file.rotate_size = rotate_size;
+	file.rotate_count = rotate_count;
+	file_open();
+
+	if (file.fd < 0) {
+		rc = errno;
+		free(file.path);
+		file.path = NULL;
+		irc_log_to_console();
+		irc_log_warn("%s: %s", path, strerror(rc));
+		return;
+	}
 
-	handler = handler_files;
-	finalizer = finalizer_files;
+	if ((rc = pthread_create(&file.thread, NULL, file_writer, NULL)) != 0)
+		irc_util_die("abort: pthread_create: %s\n", strerror(rc));
+
+	/* Never lose the last lines, even when exiting abruptly. */
+	if (!registered) {
+		pthread_atfork(NULL, NULL, file_atfork);
+		atexit(irc_log_finish);
+		registered = 1;
+	}
+
+	handler = handler_file;
+	finalizer = finalizer_file;
+}
+
+void
+irc_log_to_json(const char *path)
+{
+	assert(path);
+
+	irc_log_to_file(path);
+
+	/* Not if it went back to the console. */
+	json = handler == handler_file;
+}
+
+void
+irc_log_reopen(void)
+{
+	if (handler != handler_file)
+		return;
+
+	atomic_store(&file.reopen, 1);
+	file_wakeup();
+}
+
+void
+irc_log_flush(void)
+{
+	unsigned int req;
+
+	if (handler != handler_file || file.forked)
+		return;
+
+	pthread_mutex_lock(&file.mtx);
+	req = ++file.flush_req;
+	pthread_cond_signal(&file.cond);
+
+	while ((int)(file.flush_done - req) < 0)
+		pthread_cond_wait(&file.flushed, &file.mtx);
+
+	pthread_mutex_unlock(&file.mtx);
 }
 
 void
@@ -162,13 +698,48 @@ irc_log_to_null(void)
 void
 irc_log_set_verbose(int mode)
 {
-	verbosity = mode;
+	for (size_t i = 0; i < IRC_LOG_SUBSYSTEM_NUM; ++i)
+		irc_log_levels[i] = mode ? IRC_LOG_LEVEL_INFO : IRC_LOG_LEVEL_WARN;
+}
+
+void
+irc_log_set_level(enum irc_log_subsystem sub, enum irc_log_level level)
+{
+	assert(sub < IRC_LOG_SUBSYSTEM_NUM);
+
+	irc_log_levels[sub] = level;
+}
+
+void
+irc_log_set_sampling(enum irc_log_subsystem sub, unsigned int rate)
+{
+	assert(sub < IRC_LOG_SUBSYSTEM_NUM);
+
+	samples[sub].rate = rate;
+	samples[sub].count = 0;
+	samples[sub].sampled.name = "irccd_log_sampled_total";
+	samples[sub].sampled.help = "Log messages dropped by sampling.";
+	samples[sub].sampled.type = IRC_METRIC_COUNTER;
+	samples[sub].sampled.label = "subsystem";
+	samples[sub].sampled.label_value = substr[sub];
+	irc_metrics_register(&samples[sub].sampled);
+}
+
+void
+irc_log_set_rotate(size_t size, unsigned int count)
+{
+	rotate_size = size;
+	rotate_count = count;
 }
 
 void
 irc_log_set_template(const char *fmt)
 {
-	irc_util_strlcpy(tmpl, fmt ? fmt : DEFAULT_TEMPLATE, sizeof (tmpl));
+	irc_subst_free(tmpl);
+
+	/* Keep the default template if the new one is invalid. */
+	if (!(tmpl = irc_subst_compile(fmt ? fmt : DEFAULT_TEMPLATE)))
+		tmpl = irc_subst_compile(DEFAULT_TEMPLATE);
 }
 
 void
@@ -178,11 +749,11 @@ irc_log_info(const char *fmt, ...)
 
 	va_list ap;
 
-	va_start(ap, fmt);
-
-	if (verbosity && handler)
-		wrap(LEVEL_INFO, fmt, ap);
+	if (!irc_log_enabled(IRC_LOG_LEVEL_INFO) || !handler)
+		return;
 
+	va_start(ap, fmt);
+	wrap(IRC_LOG_SUBSYSTEM_CORE, IRC_LOG_LEVEL_INFO, NULL, fmt, ap);
 	va_end(ap);
 }
 
@@ -193,31 +764,45 @@ irc_log_warn(const char *fmt, ...)
 
 	va_list ap;
 
-	va_start(ap, fmt);
-
-	if (handler)
-		wrap(LEVEL_WARN, fmt, ap);
+	if (!handler)
+		return;
 
+	va_start(ap, fmt);
+	wrap(IRC_LOG_SUBSYSTEM_CORE, IRC_LOG_LEVEL_WARN, NULL, fmt, ap);
 	va_end(ap);
 }
 
 void
 irc_log_debug(const char *fmt, ...)
 {
-#if !defined(NDEBUG)
 	assert(fmt);
 
 	va_list ap;
 
+	if (!irc_log_enabled(IRC_LOG_LEVEL_DEBUG) || !handler)
+		return;
+
 	va_start(ap, fmt);
+	wrap(IRC_LOG_SUBSYSTEM_CORE, IRC_LOG_LEVEL_DEBUG, NULL, fmt, ap);
+	va_end(ap);
+}
+
+void
+irc_log_write(enum irc_log_subsystem sub,
+              enum irc_log_level level,
+              const char *server,
+              const char *fmt, ...)
+{
+	assert(fmt);
 
-	if (handler)
-		wrap(LEVEL_DEBUG, fmt, ap);
+	va_list ap;
 
+	if (!handler)
+		return;
+
+	va_start(ap, fmt);
+	wrap(sub, level, server, fmt, ap);
 	va_end(ap);
-#else
-	(void)fmt;
-#endif
 }
 
 void
@@ -228,4 +813,5 @@ irc_log_finish(void)
 
 	handler = NULL;
 	finalizer = NULL;
+	json = 0;
 }
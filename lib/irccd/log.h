@@ -24,12 +24,142 @@
  * \brief Logging API.
  */
 
+#include <stddef.h>
+
 #include "attrs.h"
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/**
+ * Most verbose level compiled in, debug messages are removed from release
+ * builds.
+ */
+#if defined(NDEBUG)
+#define IRC_LOG_LEVEL_MAX IRC_LOG_LEVEL_INFO
+#else
+#define IRC_LOG_LEVEL_MAX IRC_LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Write a message for a subsystem, the arguments are not even evaluated if
+ * the level is disabled.
+ *
+ * \param Sub the subsystem (enum irc_log_subsystem)
+ * \param Level the message level (enum irc_log_level)
+ * \param ... the printf(3) format style and its arguments
+ */
+#define IRC_LOG(Sub, Level, ...)                                                \
+do {                                                                            \
+        if (irc_log_enabled_in((Sub), (Level)))                                 \
+                irc_log_write((Sub), (Level), NULL, __VA_ARGS__);               \
+} while (0)
+
+/**
+ * \brief Message level, from the least to the most verbose.
+ */
+enum irc_log_level {
+	/**
+	 * Warnings, always enabled.
+	 */
+	IRC_LOG_LEVEL_WARN,
+
+	/**
+	 * General information, enabled in verbose mode.
+	 */
+	IRC_LOG_LEVEL_INFO,
+
+	/**
+	 * Debugging messages, only in debug builds.
+	 */
+	IRC_LOG_LEVEL_DEBUG
+};
+
+/**
+ * \brief Parts of irccd whose level can be changed independently.
+ */
+enum irc_log_subsystem {
+	/**
+	 * Everything else, used by ::irc_log_info and ::irc_log_debug.
+	 */
+	IRC_LOG_SUBSYSTEM_CORE,
+
+	/**
+	 * Low level server connections.
+	 */
+	IRC_LOG_SUBSYSTEM_CONN,
+
+	/**
+	 * IRC protocol.
+	 */
+	IRC_LOG_SUBSYSTEM_SERVER,
+
+	/**
+	 * Plugins.
+	 */
+	IRC_LOG_SUBSYSTEM_PLUGIN,
+
+	/**
+	 * Transport clients.
+	 */
+	IRC_LOG_SUBSYSTEM_TRANSPORT,
+
+	/**
+	 * Number of subsystems.
+	 */
+	IRC_LOG_SUBSYSTEM_NUM
+};
+
+/**
+ * Current level of every subsystem, use ::irc_log_set_level to change them.
+ */
+extern enum irc_log_level irc_log_levels[IRC_LOG_SUBSYSTEM_NUM];
+
+/**
+ * Tell if a message would be written, this is meant to be used before doing
+ * any formatting.
+ *
+ * \param sub the subsystem
+ * \param level the message level
+ * \return non-zero if enabled
+ */
+static inline int
+irc_log_enabled_in(enum irc_log_subsystem sub, enum irc_log_level level)
+{
+	return level <= IRC_LOG_LEVEL_MAX && level <= irc_log_levels[sub];
+}
+
+/**
+ * Shortcut for ::irc_log_enabled_in with ::IRC_LOG_SUBSYSTEM_CORE.
+ *
+ * \param level the message level
+ * \return non-zero if enabled
+ */
+static inline int
+irc_log_enabled(enum irc_log_level level)
+{
+	return irc_log_enabled_in(IRC_LOG_SUBSYSTEM_CORE, level);
+}
+
+/**
+ * Get the level name (e.g. warning).
+ *
+ * \param level the level
+ * \return the name or NULL if level is not valid
+ */
+const char *
+irc_log_level_name(enum irc_log_level level);
+
+/**
+ * Get the subsystem name (e.g. server).
+ *
+ * \param sub the subsystem
+ * \return the name or NULL if sub is not valid
+ */
+const char *
+irc_log_subsystem_name(enum irc_log_subsystem sub);
+
 /**
  * Setup logging to syslog.
  */
@@ -45,12 +175,46 @@ irc_log_to_console(void);
 /**
  * Setup logging to a file.
  *
+ * Lines are queued in memory and written by a dedicated thread in batches,
+ * lines that do not fit in the queue are dropped and their number is written
+ * once there is room again. The queue is written entirely when the logger is
+ * closed or when the process exits.
+ *
+ * If the file can't be opened, logging is redirected to the console.
+ *
  * \pre path != NULL
  * \param path the filename to logs
  */
 void
 irc_log_to_file(const char *path);
 
+/**
+ * Setup logging to a file as JSON lines, one object per message with the
+ * time, level, subsystem, server if any and message fields. The template is
+ * not used.
+ *
+ * The file is written like ::irc_log_to_file.
+ *
+ * \pre path != NULL
+ * \param path the filename to logs
+ */
+void
+irc_log_to_json(const char *path);
+
+/**
+ * Close and open again the log file, to be used once it has been moved by an
+ * external tool. Does nothing if not logging to a file.
+ */
+void
+irc_log_reopen(void);
+
+/**
+ * Wait until every line logged so far, including a pending reopen, has been
+ * written. Does nothing if not logging to a file.
+ */
+void
+irc_log_flush(void);
+
 /**
  * Disable logging entirely.
  */
@@ -58,13 +222,48 @@ void
 irc_log_to_null(void);
 
 /**
- * Change logging verbosity.
+ * Change logging verbosity of every subsystem.
  *
  * \param mode set to non-zero to be more verbose
  */
 void
 irc_log_set_verbose(int mode);
 
+/**
+ * Change the level of a subsystem.
+ *
+ * \pre sub < IRC_LOG_SUBSYSTEM_NUM
+ * \param sub the subsystem
+ * \param level the new level
+ */
+void
+irc_log_set_level(enum irc_log_subsystem sub, enum irc_log_level level);
+
+/**
+ * Write only one information or debug message of a subsystem out of every
+ * rate, starting with the first one. The others are dropped before being
+ * formatted and counted in the irccd_log_sampled_total metric. Warnings are
+ * never dropped.
+ *
+ * \pre sub < IRC_LOG_SUBSYSTEM_NUM
+ * \param sub the subsystem
+ * \param rate keep one message out of rate (0 or 1 to keep them all)
+ */
+void
+irc_log_set_sampling(enum irc_log_subsystem sub, unsigned int rate);
+
+/**
+ * Rotate the log file once it grows past a size, previous files are renamed
+ * with a numeric suffix from path.1 (the most recent) up to path.count.
+ *
+ * Only applies to the next call to ::irc_log_to_file.
+ *
+ * \param size the maximum file size in bytes (0 to disable)
+ * \param count the number of previous files to keep
+ */
+void
+irc_log_set_rotate(size_t size, unsigned int count);
+
 /**
  * Change the template format for logging.
  *
@@ -106,8 +305,8 @@ irc_log_warn(const char *fmt, ...);
 /**
  * Write a debug message.
  *
- * The message will only be shown when irccd is build in debug mode and no
- * matter if verbosity is set or not.
+ * The message will only be shown when irccd is build in debug mode and the
+ * core subsystem level is set to debug.
  *
  * \pre fmt != NULL
  * \param fmt the printf(3) format style
@@ -116,6 +315,23 @@ IRC_ATTR_PRINTF(1, 2)
 void
 irc_log_debug(const char *fmt, ...);
 
+/**
+ * Write a message without checking the level, it is usually called through
+ * ::IRC_LOG once the level has been checked.
+ *
+ * \pre fmt != NULL
+ * \param sub the subsystem
+ * \param level the message level
+ * \param server the server name the message is about (may be NULL)
+ * \param fmt the printf(3) format style
+ */
+IRC_ATTR_PRINTF(4, 5)
+void
+irc_log_write(enum irc_log_subsystem sub,
+              enum irc_log_level level,
+              const char *server,
+              const char *fmt, ...);
+
 /**
  * Close the opened logger.
  */
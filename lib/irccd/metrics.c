@@ -0,0 +1,136 @@
+/*
+ * metrics.c -- runtime counters and gauges
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <utlist.h>
+
+#include "metrics.h"
+
+/*
+ * Registered metrics sorted by name then label value so that metrics sharing
+ * a name are adjacent.
+ */
+static struct irc_metric *metrics;
+
+static int
+cmp(const struct irc_metric *a, const struct irc_metric *b)
+{
+	int rc;
+
+	if ((rc = strcmp(a->name, b->name)) != 0)
+		return rc;
+
+	return strcmp(a->label_value ? a->label_value : "",
+	              b->label_value ? b->label_value : "");
+}
+
+static const char *
+type_name(enum irc_metric_type type)
+{
+	return type == IRC_METRIC_COUNTER ? "counter" : "gauge";
+}
+
+/*
+ * Label values may contain any character, escape the ones that would break the
+ * line.
+ */
+static void
+print_label(FILE *fp, const char *value)
+{
+	for (; *value; ++value) {
+		switch (*value) {
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		default:
+			fputc(*value, fp);
+			break;
+		}
+	}
+}
+
+void
+irc_metrics_register(struct irc_metric *m)
+{
+	assert(m);
+	assert(m->name);
+
+	struct irc_metric *it;
+
+	LL_FOREACH(metrics, it)
+		if (it == m)
+			return;
+
+	LL_INSERT_INORDER(metrics, m, cmp);
+}
+
+void
+irc_metrics_unregister(struct irc_metric *m)
+{
+	assert(m);
+
+	struct irc_metric *it;
+
+	LL_FOREACH(metrics, it) {
+		if (it == m) {
+			LL_DELETE(metrics, m);
+			m->next = NULL;
+			break;
+		}
+	}
+}
+
+size_t
+irc_metrics_dump(FILE *fp, enum irc_metrics_format fmt)
+{
+	assert(fp);
+
+	const struct irc_metric *m, *prev = NULL;
+	size_t n = 0;
+
+	LL_FOREACH(metrics, m) {
+		if (fmt == IRC_METRICS_FORMAT_PROMETHEUS && (!prev || strcmp(prev->name, m->name) != 0)) {
+			if (m->help)
+				fprintf(fp, "# HELP %s %s\n", m->name, m->help);
+
+			fprintf(fp, "# TYPE %s %s\n", m->name, type_name(m->type));
+		}
+
+		fputs(m->name, fp);
+
+		if (m->label && m->label_value) {
+			fprintf(fp, "{%s=\"", m->label);
+			print_label(fp, m->label_value);
+			fputs("\"}", fp);
+		}
+
+		fprintf(fp, " %llu\n", m->value);
+		prev = m;
+		n++;
+	}
+
+	return n;
+}
@@ -0,0 +1,209 @@
+/*
+ * metrics.h -- runtime counters and gauges
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IRCCD_METRICS_H
+#define IRCCD_METRICS_H
+
+/**
+ * \file metrics.h
+ * \brief Runtime counters and gauges.
+ *
+ * Metrics are plain structures embedded in the objects they describe, they
+ * are only linked into a registry to be enumerated. Updating a metric is a
+ * simple arithmetic operation on its value.
+ *
+ * Metrics are written in the Prometheus text exposition format, metrics
+ * sharing the same name are grouped under a single description.
+ */
+
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * \brief Metric kind.
+ */
+enum irc_metric_type {
+	/**
+	 * Value that only increases.
+	 */
+	IRC_METRIC_COUNTER,
+
+	/**
+	 * Value that can go up and down.
+	 */
+	IRC_METRIC_GAUGE
+};
+
+/**
+ * \brief Output format for ::irc_metrics_dump.
+ */
+enum irc_metrics_format {
+	/**
+	 * One `name{label="value"} value` line per metric.
+	 */
+	IRC_METRICS_FORMAT_PLAIN,
+
+	/**
+	 * Same as plain with `# HELP` and `# TYPE` descriptions.
+	 */
+	IRC_METRICS_FORMAT_PROMETHEUS
+};
+
+/**
+ * \brief A single metric.
+ */
+struct irc_metric {
+	/**
+	 * (read-write)
+	 *
+	 * Metric name, must be set before registration.
+	 */
+	const char *name;
+
+	/**
+	 * (read-write)
+	 *
+	 * One line description.
+	 */
+	const char *help;
+
+	/**
+	 * (read-write)
+	 *
+	 * Metric kind.
+	 */
+	enum irc_metric_type type;
+
+	/**
+	 * (read-write, optional)
+	 *
+	 * Label name and its value to distinguish metrics with the same name,
+	 * the value is escaped when written.
+	 */
+	const char *label;
+	const char *label_value;
+
+	/**
+	 * (read-write)
+	 *
+	 * Current value.
+	 */
+	unsigned long long value;
+
+	/**
+	 * \cond IRC_PRIVATE
+	 */
+
+	struct irc_metric *next;
+
+	/**
+	 * \endcond IRC_PRIVATE
+	 */
+};
+
+/**
+ * Increment the metric by one.
+ *
+ * \pre m != NULL
+ * \param m the metric
+ */
+static inline void
+irc_metric_inc(struct irc_metric *m)
+{
+	m->value++;
+}
+
+/**
+ * Add a value to the metric.
+ *
+ * \pre m != NULL
+ * \param m the metric
+ * \param n the value to add
+ */
+static inline void
+irc_metric_add(struct irc_metric *m, unsigned long long n)
+{
+	m->value += n;
+}
+
+/**
+ * Subtract a value from a gauge.
+ *
+ * \pre m != NULL
+ * \param m the metric
+ * \param n the value to subtract
+ */
+static inline void
+irc_metric_sub(struct irc_metric *m, unsigned long long n)
+{
+	m->value -= n;
+}
+
+/**
+ * Set the gauge value.
+ *
+ * \pre m != NULL
+ * \param m the metric
+ * \param n the new value
+ */
+static inline void
+irc_metric_set(struct irc_metric *m, unsigned long long n)
+{
+	m->value = n;
+}
+
+/**
+ * Add the metric into the registry.
+ *
+ * The registry does not take ownership of the metric which must stay valid
+ * until unregistered, registering the same metric twice has no effect.
+ *
+ * \pre m != NULL
+ * \param m the metric to register
+ */
+void
+irc_metrics_register(struct irc_metric *m);
+
+/**
+ * Remove the metric from the registry, does nothing if not registered.
+ *
+ * \pre m != NULL
+ * \param m the metric to remove
+ */
+void
+irc_metrics_unregister(struct irc_metric *m);
+
+/**
+ * Write every registered metric into the stream.
+ *
+ * \pre fp != NULL
+ * \param fp the output stream
+ * \param fmt the output format
+ * \return the number of metrics written
+ */
+size_t
+irc_metrics_dump(FILE *fp, enum irc_metrics_format fmt);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !IRCCD_METRICS_H */
@@ -36,6 +36,13 @@ irc_plugin_init(struct irc_plugin *plg, const char *name)
 	plg->version     = irc_util_strdup(IRC_PLUGIN_DEFAULT_VERSION);
 	plg->author      = irc_util_strdup(IRC_PLUGIN_DEFAULT_AUTHOR);
 	plg->description = irc_util_strdup(IRC_PLUGIN_DEFAULT_DESCRIPTION);
+	plg->events      = IRC_PLUGIN_EVENT_ALL;
+	plg->timeout     = IRC_PLUGIN_DEFAULT_TIMEOUT;
+	plg->gc_threshold = IRC_PLUGIN_DEFAULT_GC;
+
+	plg->queue.max       = IRC_PLUGIN_DEFAULT_QUEUE;
+	plg->queue.droppable = IRC_PLUGIN_DEFAULT_DROPPABLE;
+	plg->queue.budget    = IRC_PLUGIN_DEFAULT_BUDGET;
 }
 
 void
@@ -188,14 +195,135 @@ irc_plugin_unload(struct irc_plugin *plg)
 		plg->unload(plg);
 }
 
-void
+int
 irc_plugin_handle(struct irc_plugin *plg, const struct irc_event *ev)
 {
 	assert(plg);
 	assert(ev);
 
 	if (plg->handle)
-		plg->handle(plg, ev);
+		return plg->handle(plg, ev);
+
+	return 0;
+}
+
+/*
+ * Convert a duration to its histogram bucket, durations below 4 have their own
+ * bucket then each power of two 2^e is split into 4 buckets using the two bits
+ * following the most significant one.
+ */
+static inline size_t
+stats_bucket(unsigned long long duration)
+{
+	unsigned int e = 0;
+	size_t bucket;
+
+	if (duration < 4)
+		return duration;
+
+	for (unsigned long long v = duration; v >>= 1; )
+		++e;
+
+	bucket = (e - 1) * 4 + ((duration >> (e - 2)) & 3);
+
+	if (bucket >= IRC_PLUGIN_STATS_BUCKETS)
+		bucket = IRC_PLUGIN_STATS_BUCKETS - 1;
+
+	return bucket;
+}
+
+/*
+ * Return the first duration not included in the bucket.
+ */
+static inline unsigned long long
+stats_bucket_limit(size_t bucket)
+{
+	unsigned int e;
+
+	if (bucket < 4)
+		return bucket + 1;
+
+	e = bucket / 4 + 1;
+
+	return (4ULL + bucket % 4 + 1) << (e - 2);
+}
+
+void
+irc_plugin_stats_reset(struct irc_plugin *plg)
+{
+	assert(plg);
+
+	memset(plg->stats, 0, sizeof (plg->stats));
+	plg->timeouts = 0;
+	plg->memory_peak = plg->memory;
+	plg->memory_failures = 0;
+	plg->queue.peak = plg->queue.pending;
+	plg->queue.queued = 0;
+	plg->queue.dropped = 0;
+	plg->queue.spilled = 0;
+}
+
+void
+irc_plugin_stats_record(struct irc_plugin_stats *st,
+                        unsigned long long duration,
+                        int error)
+{
+	assert(st);
+
+	st->count++;
+	st->total += duration;
+	st->histogram[stats_bucket(duration)]++;
+
+	if (error)
+		st->errors++;
+	if (duration > st->max)
+		st->max = duration;
+}
+
+void
+irc_plugin_stats_merge(struct irc_plugin_stats *dst,
+                       const struct irc_plugin_stats *src)
+{
+	assert(dst);
+	assert(src);
+
+	dst->count += src->count;
+	dst->errors += src->errors;
+	dst->total += src->total;
+
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	for (size_t i = 0; i < IRC_PLUGIN_STATS_BUCKETS; ++i)
+		dst->histogram[i] += src->histogram[i];
+}
+
+unsigned long long
+irc_plugin_stats_percentile(const struct irc_plugin_stats *st, double percent)
+{
+	assert(st);
+	assert(percent >= 0 && percent <= 100);
+
+	unsigned long long wanted, seen = 0, limit;
+	double rank;
+
+	if (st->count == 0)
+		return 0;
+
+	/* Number of calls to include rounded up, at least one. */
+	rank = st->count * percent / 100;
+
+	if ((wanted = rank) < rank || wanted == 0)
+		wanted++;
+
+	for (size_t i = 0; i < IRC_PLUGIN_STATS_BUCKETS; ++i) {
+		if ((seen += st->histogram[i]) >= wanted) {
+			limit = stats_bucket_limit(i);
+			return limit < st->max ? limit : st->max;
+		}
+	}
+
+	return st->max;
 }
 
 void
@@ -28,12 +28,14 @@
  */
 
 #include "config.h"
+#include "event.h"
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
 struct irc_event;
+struct irc_plugin_worker;
 
 /**
  * \brief Default plugin license.
@@ -55,6 +57,204 @@ struct irc_event;
  */
 #define IRC_PLUGIN_DEFAULT_DESCRIPTION "no description"
 
+/**
+ * \brief Default maximum duration of a plugin call in milliseconds.
+ */
+#define IRC_PLUGIN_DEFAULT_TIMEOUT 5000
+
+/**
+ * \brief Default maximum number of events pending for a plugin, plugins are
+ * invoked synchronously unless they opt in.
+ */
+#define IRC_PLUGIN_DEFAULT_QUEUE 0
+
+/**
+ * \brief Default time in milliseconds a plugin may spend on its pending
+ * events per loop iteration.
+ */
+#define IRC_PLUGIN_DEFAULT_BUDGET 20
+
+/**
+ * \brief Default number of bytes a plugin may allocate before its garbage is
+ * collected while the daemon is idle.
+ */
+#define IRC_PLUGIN_DEFAULT_GC (1024 * 1024)
+
+/**
+ * \brief Convert an ::irc_event_type into a ::irc_plugin::events bit.
+ */
+#define IRC_PLUGIN_EVENT(Type) (1U << (Type))
+
+/**
+ * \brief Events that may be discarded by ::IRC_PLUGIN_OVERFLOW_DROP_TYPE by
+ * default.
+ */
+#define IRC_PLUGIN_DEFAULT_DROPPABLE                                    \
+	(IRC_PLUGIN_EVENT(IRC_EVENT_ME) |                               \
+	 IRC_PLUGIN_EVENT(IRC_EVENT_MESSAGE) |                          \
+	 IRC_PLUGIN_EVENT(IRC_EVENT_NOTICE) |                           \
+	 IRC_PLUGIN_EVENT(IRC_EVENT_NAMES) |                            \
+	 IRC_PLUGIN_EVENT(IRC_EVENT_WHOIS))
+
+/**
+ * \brief Mask of all events, default value of ::irc_plugin::events.
+ */
+#define IRC_PLUGIN_EVENT_ALL (~0U)
+
+/**
+ * \brief Number of buckets in ::irc_plugin_stats::histogram.
+ */
+#define IRC_PLUGIN_STATS_BUCKETS 104
+
+/**
+ * \brief What to do when a plugin event queue is full.
+ */
+enum irc_plugin_overflow {
+	/**
+	 * Discard the oldest pending event.
+	 */
+	IRC_PLUGIN_OVERFLOW_DROP_OLDEST,
+
+	/**
+	 * Discard the oldest pending event which type is in
+	 * ::irc_plugin_queue::droppable. If there is none, the new event is
+	 * discarded if droppable or queued anyway otherwise.
+	 */
+	IRC_PLUGIN_OVERFLOW_DROP_TYPE,
+
+	/**
+	 * Never discard events, the queue grows past its limit and the plugin
+	 * ignores its time budget until it has caught up. The server is never
+	 * blocked.
+	 */
+	IRC_PLUGIN_OVERFLOW_BLOCK
+};
+
+/**
+ * \brief Plugin event queue.
+ *
+ * When the bot runs within a coroutine scheduler, events are not handled
+ * directly by the plugin but queued and processed by a dedicated coroutine
+ * within a time budget so that servers are never delayed by plugins.
+ */
+struct irc_plugin_queue {
+	/**
+	 * (read-write)
+	 *
+	 * Maximum number of pending events, 0 to invoke the plugin
+	 * synchronously instead.
+	 *
+	 * It is set to ::IRC_PLUGIN_DEFAULT_QUEUE by ::irc_plugin_init and
+	 * only considered when the plugin is added to the bot.
+	 */
+	size_t max;
+
+	/**
+	 * (read-write)
+	 *
+	 * Policy once ::irc_plugin_queue::max is reached.
+	 */
+	enum irc_plugin_overflow overflow;
+
+	/**
+	 * (read-write)
+	 *
+	 * Mask of event types that can be discarded with
+	 * ::IRC_PLUGIN_OVERFLOW_DROP_TYPE.
+	 */
+	unsigned int droppable;
+
+	/**
+	 * (read-write)
+	 *
+	 * Time in milliseconds the plugin may spend on its events before giving
+	 * control back to the event loop, 0 means unlimited.
+	 */
+	unsigned int budget;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of events currently pending.
+	 */
+	size_t pending;
+
+	/**
+	 * (read-only)
+	 *
+	 * Highest number of pending events.
+	 */
+	size_t peak;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of events queued.
+	 */
+	unsigned long long queued;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of events discarded because of the overflow policy.
+	 */
+	unsigned long long dropped;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of events queued past ::irc_plugin_queue::max.
+	 */
+	unsigned long long spilled;
+};
+
+/**
+ * \brief Plugin invocation statistics.
+ *
+ * All durations are expressed in microseconds.
+ *
+ * The histogram is log-linear: durations below 4 have their own bucket, then
+ * every power of two is split into 4 buckets which gives a precision of 25%
+ * in the worst case. The last bucket also receives every call longer than
+ * about two minutes.
+ */
+struct irc_plugin_stats {
+	/**
+	 * (read-only)
+	 *
+	 * Number of calls.
+	 */
+	unsigned long long count;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of calls that reported an error.
+	 */
+	unsigned long long errors;
+
+	/**
+	 * (read-only)
+	 *
+	 * Cumulated duration of all calls.
+	 */
+	unsigned long long total;
+
+	/**
+	 * (read-only)
+	 *
+	 * Longest call.
+	 */
+	unsigned long long max;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of calls per duration bucket.
+	 */
+	unsigned int histogram[IRC_PLUGIN_STATS_BUCKETS];
+};
+
 /**
  * \brief Abstract plugin interface.
  *
@@ -97,6 +297,101 @@ struct irc_plugin {
 	 */
 	char *description;
 
+	/**
+	 * (read-write)
+	 *
+	 * Mask of events the plugin is interested in, built using
+	 * ::IRC_PLUGIN_EVENT for every ::irc_event_type handled. The bot only
+	 * calls ::irc_plugin::handle for events present in this mask.
+	 *
+	 * It is set to ::IRC_PLUGIN_EVENT_ALL by ::irc_plugin_init, loaders
+	 * should narrow it when the plugin is opened, loaded or reloaded.
+	 */
+	unsigned int events;
+
+	/**
+	 * (read-write)
+	 *
+	 * Maximum duration in milliseconds of a single call into the plugin
+	 * before it gets aborted, 0 means unlimited. Only honored by loaders
+	 * able to interrupt the plugin code.
+	 *
+	 * It is set to ::IRC_PLUGIN_DEFAULT_TIMEOUT by ::irc_plugin_init.
+	 */
+	unsigned int timeout;
+
+	/**
+	 * (read-write)
+	 *
+	 * Number of aborted calls after which the plugin is unloaded, 0 to keep
+	 * it loaded no matter what.
+	 */
+	unsigned int strikes;
+
+	/**
+	 * (read-write)
+	 *
+	 * Maximum number of bytes the plugin may have allocated, allocations
+	 * beyond fail within the plugin code. 0 means unlimited (default).
+	 * Only honored by loaders managing the plugin memory.
+	 */
+	size_t memory_limit;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of bytes currently allocated by the plugin, 0 if unknown.
+	 */
+	size_t memory;
+
+	/**
+	 * (read-only)
+	 *
+	 * Highest value of ::irc_plugin::memory.
+	 */
+	size_t memory_peak;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of allocations refused because of
+	 * ::irc_plugin::memory_limit.
+	 */
+	unsigned long long memory_failures;
+
+	/**
+	 * (read-write)
+	 *
+	 * Number of bytes allocated by the plugin after which its garbage is
+	 * collected the next time the daemon is idle, 0 leaves it to the
+	 * plugin runtime. Only honored by loaders with a garbage collector.
+	 *
+	 * It is set to ::IRC_PLUGIN_DEFAULT_GC by ::irc_plugin_init.
+	 */
+	size_t gc_threshold;
+
+	/**
+	 * (read-only)
+	 *
+	 * Number of calls aborted because they exceeded ::irc_plugin::timeout.
+	 */
+	unsigned long long timeouts;
+
+	/**
+	 * (read-only)
+	 *
+	 * Statistics about ::irc_plugin::handle calls for every event type,
+	 * updated by the bot.
+	 */
+	struct irc_plugin_stats stats[IRC_EVENT_NUM];
+
+	/**
+	 * (read-write)
+	 *
+	 * Event queue settings and counters.
+	 */
+	struct irc_plugin_queue queue;
+
 	/**
 	 * (read-write, optional)
 	 *
@@ -240,8 +535,11 @@ struct irc_plugin {
 	 *
 	 * \param self this plugin
 	 * \param ev the IRC event
+	 * \return 0 on success, -1 if the plugin failed to handle it or 1 if
+	 *         it is handled later, the plugin then records the
+	 *         statistics itself
 	 */
-	void (*handle)(struct irc_plugin *self, const struct irc_event *ev);
+	int (*handle)(struct irc_plugin *self, const struct irc_event *ev);
 
 	/**
 	 * (read-write, optional)
@@ -267,6 +565,20 @@ struct irc_plugin {
 	 */
 	struct irc_plugin *next;
 
+	/**
+	 * (private)
+	 *
+	 * Next plugin in the same bucket of the bot plugin table.
+	 */
+	struct irc_plugin *hnext;
+
+	/**
+	 * (private)
+	 *
+	 * Coroutine processing the plugin event queue, if any.
+	 */
+	struct irc_plugin_worker *worker;
+
 	/**
 	 * \endcond IRC_PRIVATE
 	 */
@@ -460,9 +772,59 @@ irc_plugin_unload(struct irc_plugin *self);
 /**
  * \copydoc ::irc_plugin::handle
  */
-void
+int
 irc_plugin_handle(struct irc_plugin *self, const struct irc_event *ev);
 
+/**
+ * Reset all statistics of the plugin, including its timeouts, memory peak
+ * and queue counters.
+ *
+ * \pre plg != NULL
+ * \param plg the plugin
+ */
+void
+irc_plugin_stats_reset(struct irc_plugin *plg);
+
+/**
+ * Record a call into the statistics.
+ *
+ * \pre st != NULL
+ * \param st the statistics to update
+ * \param duration the call duration in microseconds
+ * \param error non-zero if the call failed
+ */
+void
+irc_plugin_stats_record(struct irc_plugin_stats *st,
+                        unsigned long long duration,
+                        int error);
+
+/**
+ * Add statistics from src into dst.
+ *
+ * \pre dst != NULL
+ * \pre src != NULL
+ * \param dst the statistics to update
+ * \param src the statistics to add
+ */
+void
+irc_plugin_stats_merge(struct irc_plugin_stats *dst,
+                       const struct irc_plugin_stats *src);
+
+/**
+ * Compute the duration under which the given percentage of calls completed.
+ *
+ * The value returned is the upper bound of the matching histogram bucket
+ * limited to ::irc_plugin_stats::max.
+ *
+ * \pre st != NULL
+ * \pre percent <= 100
+ * \param st the statistics
+ * \param percent the percentile wanted (e.g. 99)
+ * \return the duration in microseconds or 0 if there was no call
+ */
+unsigned long long
+irc_plugin_stats_percentile(const struct irc_plugin_stats *st, double percent);
+
 /**
  * Finalize the plugin and invoke ::irc_plugin::finish function if not NULL.
  */
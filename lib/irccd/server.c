@@ -36,17 +36,15 @@
 #include "server.h"
 #include "util.h"
 
-#define DEBUG(...) LOG(irc_log_debug, __VA_ARGS__)
-#define INFO(...)  LOG(irc_log_info, __VA_ARGS__)
-#define WARN(...)  LOG(irc_log_warn, __VA_ARGS__)
+#define DEBUG(...) LOG(IRC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define INFO(...)  LOG(IRC_LOG_LEVEL_INFO, __VA_ARGS__)
+#define WARN(...)  LOG(IRC_LOG_LEVEL_WARN, __VA_ARGS__)
 
-#define LOG(Fn, ...)                                                            \
+#define LOG(Level, ...)                                                         \
 do {                                                                            \
-        char line[256] = {};                                                    \
-                                                                                \
-        snprintf(line, sizeof (line), __VA_ARGS__);                             \
-                                                                                \
-        Fn("server %s: %s", server->name, line);                                \
+        if (irc_log_enabled_in(IRC_LOG_SUBSYSTEM_SERVER, (Level)))              \
+                irc_log_write(IRC_LOG_SUBSYSTEM_SERVER, (Level),                \
+                    server->name, __VA_ARGS__);                                 \
 } while (0)
 
 /*
@@ -189,6 +187,41 @@ irc_server_clear(struct irc_server *server)
 	server->prefixesz = 0;
 }
 
+static void
+irc_server_metric_init(struct irc_server *server,
+                       struct irc_metric *m,
+                       enum irc_metric_type type,
+                       const char *name,
+                       const char *help)
+{
+	m->name = name;
+	m->help = help;
+	m->type = type;
+	m->label = "server";
+	m->label_value = server->name;
+}
+
+static void
+irc_server_metrics_init(struct irc_server *server)
+{
+	struct irc_server_metrics *m = &server->metrics;
+
+	irc_server_metric_init(server, &m->lines_in, IRC_METRIC_COUNTER,
+	    "irccd_server_lines_received_total", "Lines received from the server.");
+	irc_server_metric_init(server, &m->lines_out, IRC_METRIC_COUNTER,
+	    "irccd_server_lines_sent_total", "Lines queued to the server.");
+	irc_server_metric_init(server, &m->bytes_in, IRC_METRIC_COUNTER,
+	    "irccd_server_bytes_received_total", "Bytes received from the server.");
+	irc_server_metric_init(server, &m->bytes_out, IRC_METRIC_COUNTER,
+	    "irccd_server_bytes_sent_total", "Bytes sent to the server.");
+	irc_server_metric_init(server, &m->parse_errors, IRC_METRIC_COUNTER,
+	    "irccd_server_parse_errors_total", "Invalid lines discarded.");
+	irc_server_metric_init(server, &m->reconnects, IRC_METRIC_COUNTER,
+	    "irccd_server_reconnects_total", "Automatic reconnections.");
+	irc_server_metric_init(server, &m->send_queue, IRC_METRIC_GAUGE,
+	    "irccd_server_send_queue_bytes", "Bytes waiting to be sent.");
+}
+
 static void
 irc_server_free(struct irc_server *s)
 {
@@ -757,6 +790,8 @@ irc_server_new(const char *name)
 	server->ctcp_version = irc_util_strdup(IRC_SERVER_DEFAULT_CTCP_VERSION);
 	server->ctcp_source  = irc_util_strdup(IRC_SERVER_DEFAULT_CTCP_SOURCE);
 
+	irc_server_metrics_init(server);
+
 	return server;
 }
 
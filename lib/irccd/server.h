@@ -30,6 +30,7 @@
 #include "attrs.h"
 #include "channel.h"
 #include "event.h"
+#include "metrics.h"
 
 #if defined(__cplusplus)
 extern "C" {
@@ -113,6 +114,49 @@ struct irc_server_umode {
 	char symbol;
 };
 
+/**
+ * \brief IRC server runtime metrics.
+ *
+ * Every metric is labelled with the server name and registered while the
+ * server is added to the bot.
+ */
+struct irc_server_metrics {
+	/**
+	 * Lines received from the server.
+	 */
+	struct irc_metric lines_in;
+
+	/**
+	 * Lines queued to the server.
+	 */
+	struct irc_metric lines_out;
+
+	/**
+	 * Bytes received from the server.
+	 */
+	struct irc_metric bytes_in;
+
+	/**
+	 * Bytes sent to the server.
+	 */
+	struct irc_metric bytes_out;
+
+	/**
+	 * Lines discarded because they were empty, too long or malformed.
+	 */
+	struct irc_metric parse_errors;
+
+	/**
+	 * Automatic reconnections after a failure or a timeout.
+	 */
+	struct irc_metric reconnects;
+
+	/**
+	 * Bytes waiting in the output queue.
+	 */
+	struct irc_metric send_queue;
+};
+
 /**
  * \brief IRC server connection
  *
@@ -278,6 +322,13 @@ struct irc_server {
 	 */
 	size_t prefixesz;
 
+	/**
+	 * (read-only)
+	 *
+	 * Runtime metrics.
+	 */
+	struct irc_server_metrics metrics;
+
 	/**
 	 * \cond IRC_PRIVATE
 	 */
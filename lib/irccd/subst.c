@@ -18,14 +18,31 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <utlist.h>
+
+#include <nce/child.h>
+#include <nce/io.h>
+#include <nce/nce.h>
+
+#include "metrics.h"
 #include "subst.h"
 #include "util.h"
 
+#define SHELL(Ptr, Field) \
+        (IRC_UTIL_CONTAINER_OF(Ptr, struct shell, Field))
+
+/*
+ * Maximum number of distinct commands cached, others are run synchronously.
+ */
+#define SHELL_MAX 32
+
 struct pair {
 	const char *key;
 	const char *value;
@@ -38,6 +55,70 @@ struct attributes {
 	size_t attrsz;
 };
 
+enum op_type {
+	OP_TEXT,
+	OP_KEYWORD,
+	OP_ENV,
+	OP_SHELL,
+	OP_ATTRS
+};
+
+/*
+ * A compiled template is a list of literal texts and tokens, attributes are
+ * rendered in both flavors at compile time.
+ */
+struct op {
+	enum op_type type;
+	char token;                     /* reserved character of a token */
+	int date;                       /* text contains strftime(3) specifiers */
+	char *text;                     /* literal text or token key */
+	char irc[32];
+	char shell[32];
+};
+
+struct irc_subst_template {
+	struct op *ops;
+	size_t opsz;
+};
+
+/*
+ * Last output of a shell command, once expired the command is run again in a
+ * coroutine while the previous value is still being used.
+ */
+struct shell {
+	char *cmd;
+	char value[512];
+	long long updated;              /* monotonic time of the last run */
+	int refreshing;
+	int fd;
+	struct nce_coro coro;
+	struct nce_io io;
+	struct nce_child child;
+	struct shell *next;
+};
+
+static struct shell *shells;
+static size_t shellsz;
+static unsigned int shell_ttl = IRC_SUBST_SHELL_TTL;
+
+static struct irc_metric shell_hits = {
+	.name = "irccd_subst_shell_hits_total",
+	.help = "Shell substitutions served from the cache.",
+	.type = IRC_METRIC_COUNTER
+};
+
+static struct irc_metric shell_misses = {
+	.name = "irccd_subst_shell_misses_total",
+	.help = "Shell substitutions that waited for the command.",
+	.type = IRC_METRIC_COUNTER
+};
+
+static struct irc_metric shell_refreshes = {
+	.name = "irccd_subst_shell_refreshes_total",
+	.help = "Shell commands run in the background.",
+	.type = IRC_METRIC_COUNTER
+};
+
 static const struct pair irc_colors[] = {
 	{ "white",      "0"     },
 	{ "black",      "1"     },
@@ -237,6 +318,200 @@ subst_shell(const char *key, char **out, size_t *outsz)
 	pclose(fp);
 }
 
+static long long
+shell_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+/*
+ * Keep only the first line of the output, like subst_shell.
+ */
+static void
+shell_store(struct shell *sh, const char *output)
+{
+	irc_util_strlcpy(sh->value, output, sizeof (sh->value));
+	sh->value[strcspn(sh->value, "\r\n")] = '\0';
+	sh->updated = shell_now();
+}
+
+static void
+shell_run(struct shell *sh)
+{
+	char *out = sh->value;
+	size_t outsz = sizeof (sh->value);
+
+	subst_shell(sh->cmd, &out, &outsz);
+	*out = '\0';
+	sh->updated = shell_now();
+}
+
+static void
+shell_entry(struct nce_coro *self)
+{
+	struct shell *sh = SHELL(self, coro);
+	char buf[sizeof (sh->value)];
+	size_t len = 0;
+	ssize_t nr;
+	pid_t pid;
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return;
+
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	if ((pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		execl("/bin/sh", "sh", "-c", sh->cmd, (char *)NULL);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	sh->fd = fds[0];
+
+	/* Watch the child right away, libev reaps unwatched children. */
+	nce_child_set(&sh->child, pid, 0);
+	nce_child_start(&sh->child);
+	nce_io_reset(&sh->io, sh->fd, EV_READ);
+
+	/* Stop at end of file or when no more output can be kept. */
+	while (len < sizeof (buf) - 1) {
+		nce_io_wait(&sh->io);
+
+		while (len < sizeof (buf) - 1 && (nr = read(sh->fd, buf + len, sizeof (buf) - 1 - len)) > 0)
+			len += nr;
+
+		if (nr == 0 || (nr < 0 && errno != EAGAIN && errno != EINTR))
+			break;
+	}
+
+	nce_io_stop(&sh->io);
+	close(sh->fd);
+	sh->fd = -1;
+
+	nce_child_wait(&sh->child);
+	nce_child_stop(&sh->child);
+
+	buf[len] = '\0';
+	shell_store(sh, buf);
+	irc_metric_inc(&shell_refreshes);
+}
+
+static void
+shell_finalizer(struct nce_coro *self)
+{
+	struct shell *sh = SHELL(self, coro);
+
+	nce_io_stop(&sh->io);
+	nce_child_stop(&sh->child);
+
+	if (sh->fd != -1) {
+		close(sh->fd);
+		sh->fd = -1;
+	}
+
+	sh->refreshing = 0;
+}
+
+static void
+shell_refresh(struct shell *sh)
+{
+	if (sh->refreshing)
+		return;
+
+	sh->refreshing = 1;
+	sh->coro.name = "subst.shell";
+	sh->coro.entry = shell_entry;
+	sh->coro.finalizer = shell_finalizer;
+
+	if (nce_coro_spawn(&sh->coro) < 0)
+		sh->refreshing = 0;
+}
+
+static struct shell *
+shell_find(const char *cmd)
+{
+	struct shell *sh;
+
+	LL_FOREACH(shells, sh)
+		if (strcmp(sh->cmd, cmd) == 0)
+			return sh;
+
+	return NULL;
+}
+
+static struct shell *
+shell_new(const char *cmd)
+{
+	struct shell *sh;
+
+	if (shellsz >= SHELL_MAX)
+		return NULL;
+
+	if (!shells) {
+		irc_metrics_register(&shell_hits);
+		irc_metrics_register(&shell_misses);
+		irc_metrics_register(&shell_refreshes);
+	}
+
+	sh = irc_util_calloc(1, sizeof (*sh));
+	sh->cmd = irc_util_strdup(cmd);
+	sh->fd = -1;
+	LL_PREPEND(shells, sh);
+	shellsz++;
+
+	/* Nothing to show yet, the first run has to be waited for. */
+	shell_run(sh);
+
+	return sh;
+}
+
+static void
+subst_shell_cached(const char *key, char **out, size_t *outsz)
+{
+	struct shell *sh;
+	size_t len;
+
+	if (!(sh = shell_find(key))) {
+		irc_metric_inc(&shell_misses);
+
+		if (!(sh = shell_new(key))) {
+			subst_shell(key, out, outsz);
+			return;
+		}
+	} else if (sh->updated + shell_ttl > shell_now())
+		irc_metric_inc(&shell_hits);
+	else if (nce_sched_default) {
+		shell_refresh(sh);
+		irc_metric_inc(&shell_hits);
+	} else {
+		/* Nothing would run the command in the background. */
+		shell_run(sh);
+		irc_metric_inc(&shell_misses);
+	}
+
+	/* Truncated silently, like subst_shell. */
+	if ((len = strlen(sh->value)) >= *outsz)
+		len = *outsz - 1;
+
+	memcpy(*out, sh->value, len);
+	*out += len;
+	*outsz -= len;
+}
+
 static int
 subst_irc_attrs(const char *key, char **out, size_t *outsz)
 {
@@ -385,7 +660,9 @@ substitute(const char **p, char **out, size_t *outsz, const struct irc_subst *su
 		break;
 	case '!':
 		/* shell */
-		if (subst->flags & IRC_SUBST_SHELL)
+		if ((subst->flags & IRC_SUBST_SHELL) && (subst->flags & IRC_SUBST_SHELL_CACHE))
+			subst_shell_cached(key, out, outsz);
+		else if (subst->flags & IRC_SUBST_SHELL)
 			subst_shell(key, out, outsz);
 		else
 			replaced = 0;
@@ -492,3 +769,232 @@ err:
 
 	return rc;
 }
+
+static void
+compile_op(struct irc_subst_template *tpl, char token, const char *text, size_t textsz)
+{
+	struct op *op;
+	char *o;
+	size_t osz;
+
+	tpl->ops = irc_util_reallocarray(tpl->ops, tpl->opsz + 1, sizeof (*tpl->ops));
+	op = memset(&tpl->ops[tpl->opsz++], 0, sizeof (*op));
+	op->token = token;
+	op->text = irc_util_strndup(text, textsz);
+	op->date = strchr(op->text, '%') != NULL;
+
+	switch (token) {
+	case '#':
+		op->type = OP_KEYWORD;
+		break;
+	case '$':
+		op->type = OP_ENV;
+		break;
+	case '!':
+		op->type = OP_SHELL;
+		break;
+	case '@':
+		op->type = OP_ATTRS;
+
+		/* Both fit, otherwise the attribute is left empty. */
+		o = op->irc;
+		osz = sizeof (op->irc);
+
+		if (subst_irc_attrs(op->text, &o, &osz) == 0)
+			*o = '\0';
+
+		o = op->shell;
+		osz = sizeof (op->shell);
+
+		if (subst_shell_attrs(op->text, &o, &osz) == 0)
+			*o = '\0';
+		break;
+	default:
+		op->type = OP_TEXT;
+		break;
+	}
+}
+
+struct irc_subst_template *
+irc_subst_compile(const char *in)
+{
+	assert(in);
+
+	struct irc_subst_template *tpl;
+	const char *end;
+	char *text;
+	size_t textsz = 0;
+	int rc;
+
+	tpl = irc_util_calloc(1, sizeof (*tpl));
+	text = irc_util_malloc(strlen(in) + 1);
+
+	/* Same rules as irc_subst, see there for the details. */
+	for (const char *i = in; *i; ) {
+		if (!is_reserved(*i)) {
+			text[textsz++] = *i++;
+			continue;
+		}
+
+		if (*++i != '{') {
+			if (*i == i[-1])
+				++i;
+
+			text[textsz++] = i[-1];
+			continue;
+		}
+
+		if (!*++i)
+			break;
+
+		if (!(end = strchr(i, '}'))) {
+			rc = EINVAL;
+			goto err;
+		}
+		if ((size_t)(end - i) >= 64) {
+			rc = ENOMEM;
+			goto err;
+		}
+
+		if (textsz) {
+			compile_op(tpl, 0, text, textsz);
+			textsz = 0;
+		}
+
+		compile_op(tpl, i[-2], i, end - i);
+		i = end + 1;
+	}
+
+	if (textsz)
+		compile_op(tpl, 0, text, textsz);
+
+	free(text);
+
+	return tpl;
+
+err:
+	free(text);
+	irc_subst_free(tpl);
+	errno = rc;
+
+	return NULL;
+}
+
+ssize_t
+irc_subst_exec(const struct irc_subst_template *tpl,
+               char *out,
+               size_t outsz,
+               const struct irc_subst *subst)
+{
+	assert(tpl);
+	assert(out);
+	assert(subst);
+
+	const struct op *op;
+	const char *text;
+	char *o = out, key[256];
+	struct tm tm;
+	size_t written;
+	int rc = 0;
+
+	if (!outsz)
+		return 0;
+	if (subst->flags & IRC_SUBST_DATE)
+		localtime_r(&subst->time, &tm);
+
+	for (size_t i = 0; i < tpl->opsz && rc == 0; ++i) {
+		op = &tpl->ops[i];
+		text = op->text;
+
+		if (op->date && (subst->flags & IRC_SUBST_DATE)) {
+			/* Literal text goes straight into the output. */
+			if (op->type == OP_TEXT) {
+				if ((written = strftime(o, outsz, text, &tm)) == 0)
+					rc = -ENOMEM;
+
+				o += written;
+				outsz -= written;
+				continue;
+			}
+
+			if (strftime(key, sizeof (key), text, &tm) == 0) {
+				rc = -ENOMEM;
+				break;
+			}
+
+			text = key;
+		}
+
+		switch (op->type) {
+		case OP_KEYWORD:
+			if (subst->flags & IRC_SUBST_KEYWORDS)
+				rc = subst_keyword(text, &o, &outsz, subst);
+			else
+				goto verbatim;
+			break;
+		case OP_ENV:
+			if (subst->flags & IRC_SUBST_ENV)
+				rc = subst_env(text, &o, &outsz);
+			else
+				goto verbatim;
+			break;
+		case OP_SHELL:
+			if ((subst->flags & IRC_SUBST_SHELL) && (subst->flags & IRC_SUBST_SHELL_CACHE))
+				subst_shell_cached(text, &o, &outsz);
+			else if (subst->flags & IRC_SUBST_SHELL)
+				subst_shell(text, &o, &outsz);
+			else
+				goto verbatim;
+			break;
+		case OP_ATTRS:
+			if (subst->flags & IRC_SUBST_IRC_ATTRS)
+				rc = scat(&o, &outsz, op->irc);
+			else if (subst->flags & IRC_SUBST_SHELL_ATTRS)
+				rc = scat(&o, &outsz, op->shell);
+			else
+				goto verbatim;
+			break;
+		default:
+			rc = scat(&o, &outsz, text);
+			break;
+		}
+
+		continue;
+
+	verbatim:
+		if ((rc = ccat(&o, &outsz, op->token)) == 0 &&
+		    (rc = ccat(&o, &outsz, '{')) == 0 &&
+		    (rc = scat(&o, &outsz, text)) == 0)
+			rc = ccat(&o, &outsz, '}');
+	}
+
+	if (rc == 0 && outsz < 1)
+		rc = -ENOMEM;
+	if (rc < 0) {
+		out[0] = '\0';
+		return rc;
+	}
+
+	*o = '\0';
+
+	return o - out;
+}
+
+void
+irc_subst_free(struct irc_subst_template *tpl)
+{
+	if (!tpl)
+		return;
+
+	for (size_t i = 0; i < tpl->opsz; ++i)
+		free(tpl->ops[i].text);
+
+	free(tpl->ops);
+	free(tpl);
+}
+
+void
+irc_subst_set_shell_ttl(unsigned int ttl)
+{
+	shell_ttl = ttl;
+}
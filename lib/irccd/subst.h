@@ -32,6 +32,11 @@
 extern "C" {
 #endif
 
+/**
+ * Default number of seconds before a cached shell output expires.
+ */
+#define IRC_SUBST_SHELL_TTL 60
+
 /**
  * \brief Substitution flags.
  */
@@ -68,7 +73,16 @@ enum irc_subst_flags {
 	/**
 	 * Allow shell attribute (escape sequence) for color and style.
 	 */
-	IRC_SUBST_SHELL_ATTRS = (1 << 5)
+	IRC_SUBST_SHELL_ATTRS = (1 << 5),
+
+	/**
+	 * Reuse the output of ::IRC_SUBST_SHELL commands, once expired the
+	 * command is run again in the background and the previous output is
+	 * used until it completes.
+	 *
+	 * Hits and misses are reported as metrics.
+	 */
+	IRC_SUBST_SHELL_CACHE = (1 << 6)
 };
 
 /**
@@ -123,6 +137,13 @@ struct irc_subst {
 	size_t keywordsz;
 };
 
+/**
+ * \brief Compiled template.
+ *
+ * Opaque list of literal texts and tokens produced by ::irc_subst_compile.
+ */
+struct irc_subst_template;
+
 /**
  * Perform a template substitution.
  *
@@ -139,6 +160,56 @@ struct irc_subst {
 ssize_t
 irc_subst(char *out, size_t outsz, const char *in, const struct irc_subst *subst);
 
+/**
+ * Parse a template once to render it many times with ::irc_subst_exec.
+ *
+ * \pre in != NULL
+ * \param in the template string
+ * \return the compiled template to free with ::irc_subst_free
+ * \return NULL on error and errno is set to ENOMEM if a token is too long or
+ *         EINVAL if the input string is invalid
+ */
+struct irc_subst_template *
+irc_subst_compile(const char *in);
+
+/**
+ * Render a compiled template, like ::irc_subst but without parsing nor
+ * allocating.
+ *
+ * Date conversion specifiers are replaced in literal text and token names
+ * only rather than in the whole template beforehand.
+ *
+ * \pre tpl != NULL
+ * \pre out != NULL
+ * \param tpl the compiled template
+ * \param out the output string
+ * \param outsz maximum number of bytes to write in out
+ * \param subst the substitution parameters
+ * \return the number of bytes written (excluding NUL) on success
+ * \return -ENOMEM if the output buffer was too small
+ */
+ssize_t
+irc_subst_exec(const struct irc_subst_template *tpl,
+               char *out,
+               size_t outsz,
+               const struct irc_subst *subst);
+
+/**
+ * Destroy a compiled template, does nothing if tpl is NULL.
+ *
+ * \param tpl the compiled template (may be NULL)
+ */
+void
+irc_subst_free(struct irc_subst_template *tpl);
+
+/**
+ * Change the number of seconds before a cached shell output expires.
+ *
+ * \param ttl the new lifetime (0 to run the command again on every use)
+ */
+void
+irc_subst_set_shell_ttl(unsigned int ttl);
+
 #if defined(__cplusplus)
 }
 #endif
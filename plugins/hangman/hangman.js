@@ -273,7 +273,7 @@ function propose(server, channel, origin, game, proposition)
 {
 	var kw = {
 		channel: channel,
-		command: server.info().prefix + Plugin.info().name,
+		command: server.prefix + Plugin.info().name,
 		nickname: Util.splituser(origin),
 		origin: origin,
 		plugin: Plugin.info().name,
@@ -320,7 +320,7 @@ function onCommand(server, origin, channel, message)
 	var game = Hangman.find(server, channel);
 	var kw = {
 		channel: channel,
-		command: server.info().prefix + Plugin.info().name,
+		command: server.prefix + Plugin.info().name,
 		nickname: Util.splituser(origin),
 		origin: origin,
 		plugin: Plugin.info().name,
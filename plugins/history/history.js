@@ -43,12 +43,12 @@ Plugin.templates = {
 
 function isSelf(server, origin)
 {
-	return server.info().nickname === Util.splituser(origin);
+	return server.nickname === Util.splituser(origin);
 }
 
 function command(server)
 {
-	return server.info().prefix + "history";
+	return server.prefix + "history";
 }
 
 function path(server, channel)
@@ -220,7 +220,7 @@ function onLoad()
 	var table = Server.list();
 
 	for (var k in table) {
-		var channels = table[k].info().channels;
+		var channels = table[k].channels();
 
 		for (var i = 0; i < channels.length; ++i) {
 			if (channels[i].joined)
@@ -172,7 +172,7 @@ function onCommand(server, origin, channel, message)
 			Logger.warning(e.message);
 			server.message(channel, Util.format(Plugin.templates.error, {
 				plugin: Plugin.info().name,
-				command: server.info().prefix + Plugin.info().name,
+				command: server.prefix + Plugin.info().name,
 				server: server.toString(),
 				channel: channel,
 				origin: origin,
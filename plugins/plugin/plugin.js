@@ -45,7 +45,7 @@ var commands = {
 	{
 		return {
 			channel: channel,
-			command: server.info().prefix + Plugin.info().name,
+			command: server.prefix + Plugin.info().name,
 			nickname: Util.splituser(origin),
 			origin: origin,
 			plugin: Plugin.info().name,
@@ -96,7 +96,7 @@ function onCommand(server, origin, channel)
 
 	var kw = {
 		channel: channel,
-		command: server.info().commandChar + Plugin.info().name,
+		command: server.prefix + Plugin.info().name,
 		nickname: Util.splituser(origin),
 		origin: origin,
 		server: server.toString(),
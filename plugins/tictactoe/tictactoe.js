@@ -107,9 +107,9 @@ Game.keywords = function (server, channel, origin)
 {
 	var kw = {
 		channel: channel,
-		command: server.info().prefix + Plugin.info().name,
+		command: server.prefix + Plugin.info().name,
 		plugin: Plugin.info().name,
-		server: server.info().name
+		server: server.name
 	};
 
 	if (origin) {
@@ -172,21 +172,11 @@ Game.clear = function (server, user, channel)
  */
 Game.isValid = function (server, channel, nickname, target)
 {
-	if (target === "" || target === nickname || target === server.info().nickname)
+	if (target === "" || target === nickname || target === server.nickname)
 		return false;
 
-	var channels = server.info().channels;
-	var ch;
-
-	for (var i = 0; i < channels.length; ++i) {
-		if (channels[i].name === channel) {
-			ch = channels[i];
-			break;
-		}
-	}
-
-	for (var i = 0; i < ch.users.length; ++i)
-		if (ch.users[i].nickname === target)
+	for (var it = server.users(channel), u = it.next(); !u.done; u = it.next())
+		if (u.value.nickname === target)
 			return true;
 
 	return false;
@@ -0,0 +1,225 @@
+/*
+ * bench-js-plugin.c -- benchmark CPU bound Javascript plugins
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Dispatch message events to several Javascript plugins counting primes in
+ * their handler and measure the throughput with the plugins running on the
+ * main thread (javascript isolated) then on their own thread (javascript
+ * threaded). The time the dispatch loop is held by the plugins is reported as
+ * well.
+ *
+ * Usage: bench-js-plugin [-e events] [-p plugins] [-w work]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ev.h>
+
+#include <irccd/event.h>
+#include <irccd/irccd.h>
+#include <irccd/js-plugin.h>
+#include <irccd/log.h>
+#include <irccd/plugin.h>
+#include <irccd/server.h>
+
+static char dir[] = "/tmp/irccd-bench-XXXXXX";
+static char path[64];
+static unsigned int nevents = 50;
+static unsigned int nplugins = 4;
+static unsigned int work = 5000;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+die(const char *what)
+{
+	fprintf(stderr, "abort: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench-js-plugin [-e events] [-p plugins] [-w work]\n");
+	exit(1);
+}
+
+static void
+script(void)
+{
+	FILE *fp;
+
+	snprintf(path, sizeof (path), "%s/bench.js", dir);
+
+	if (!(fp = fopen(path, "w")))
+		die(path);
+
+	fprintf(fp,
+		"var found = 0;\n"
+		"function onMessage() {\n"
+		"  for (var n = 2; n < %u; ++n) {\n"
+		"    var prime = true;\n"
+		"    for (var d = 2; d * d <= n && prime; ++d)\n"
+		"      prime = n %% d !== 0;\n"
+		"    if (prime)\n"
+		"      ++found;\n"
+		"  }\n"
+		"}\n",
+		work
+	);
+
+	fclose(fp);
+}
+
+static int
+done(void)
+{
+	struct irc_plugin *p;
+	char name[32];
+
+	for (unsigned int i = 0; i < nplugins; ++i) {
+		snprintf(name, sizeof (name), "bench%u", i);
+		p = irc_bot_plugin_get(name);
+
+		if (p->stats[IRC_EVENT_MESSAGE].count + p->queue.dropped < nevents)
+			return 0;
+	}
+
+	return 1;
+}
+
+static double
+run(const char *mode, int threaded, struct irc_server *server)
+{
+	struct irc_plugin *p;
+	char name[32];
+	double begin, dispatched, elapsed;
+	unsigned long long dropped = 0;
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#bench",
+			.message = "hello"
+		}
+	};
+
+	js_plugin_set_threaded(threaded);
+
+	for (unsigned int i = 0; i < nplugins; ++i) {
+		snprintf(name, sizeof (name), "bench%u", i);
+
+		if (!(p = js_plugin_open(name, path)))
+			die(name);
+
+		p->timeout = 0;
+		irc_bot_plugin_add(p);
+	}
+
+	js_plugin_set_threaded(0);
+
+	begin = now();
+
+	for (unsigned int i = 0; i < nevents; ++i) {
+		irc_bot_dispatch(&ev);
+		ev_run(EVRUN_NOWAIT);
+	}
+
+	dispatched = now() - begin;
+
+	while (!done())
+		ev_run(EVRUN_ONCE);
+
+	elapsed = now() - begin;
+
+	for (unsigned int i = 0; i < nplugins; ++i) {
+		snprintf(name, sizeof (name), "bench%u", i);
+		dropped += irc_bot_plugin_get(name)->queue.dropped;
+		irc_bot_plugin_remove(name);
+	}
+
+	printf("%-8s %u plugins, %u events each, %llu dropped, dispatch %.3f s, "
+	    "total %.3f s, %.1f events/s\n", mode, nplugins, nevents, dropped,
+	    dispatched / 1000.0, elapsed / 1000.0,
+	    (double)nplugins * nevents / (elapsed / 1000.0));
+
+	return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct irc_server *server;
+	double inline_ms, threaded_ms;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "e:p:w:")) != -1) {
+		switch (ch) {
+		case 'e':
+			nevents = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			nplugins = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			work = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (optind != argc || nplugins == 0)
+		usage();
+	if (!mkdtemp(dir))
+		die("mkdtemp");
+
+	script();
+	irc_log_to_null();
+	ev_default_loop(0);
+	irc_bot_init();
+
+	server = irc_server_new("bench");
+	irc_server_incref(server);
+
+	inline_ms = run("isolated", 0, server);
+	threaded_ms = run("threaded", 1, server);
+
+	printf("speedup  %.2fx\n", inline_ms / threaded_ms);
+
+	irc_server_decref(server);
+	remove(path);
+	rmdir(dir);
+
+	return 0;
+}
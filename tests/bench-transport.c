@@ -0,0 +1,319 @@
+/*
+ * bench-transport.c -- benchmark irccd transport with many clients
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Open many concurrent clients on a running irccd transport and measure the
+ * time until irccd greets them (accept latency) and the round trip time of
+ * SERVER-LIST and PLUGIN-LIST requests.
+ *
+ * Usage: bench-transport [-c clients] [-r requests] socket
+ */
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum state {
+	STATE_CONNECT,
+	STATE_HELLO,
+	STATE_REPLY,
+	STATE_DONE
+};
+
+struct client {
+	int fd;
+	enum state state;
+	unsigned int requests;
+	double start;
+	char in[4096];
+	size_t in_len;
+};
+
+struct samples {
+	double *values;
+	size_t len;
+};
+
+static struct sockaddr_un addr;
+static struct client *clients;
+static struct pollfd *fds;
+static struct samples accepts;
+static struct samples rtts;
+static unsigned int nclients = 1000;
+static unsigned int nrequests = 10;
+static unsigned int errors;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+die(const char *what)
+{
+	fprintf(stderr, "abort: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench-transport [-c clients] [-r requests] socket\n");
+	exit(1);
+}
+
+static void
+sample(struct samples *s, double value)
+{
+	s->values[s->len++] = value;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, struct samples *s)
+{
+	double sum = 0;
+
+	if (s->len == 0) {
+		printf("%-8s no samples\n", name);
+		return;
+	}
+
+	qsort(s->values, s->len, sizeof (*s->values), cmp);
+
+	for (size_t i = 0; i < s->len; ++i)
+		sum += s->values[i];
+
+	printf("%-8s n=%-8zu min=%.3f avg=%.3f p50=%.3f p99=%.3f max=%.3f (ms)\n",
+	    name, s->len, s->values[0], sum / s->len, s->values[s->len / 2],
+	    s->values[s->len * 99 / 100], s->values[s->len - 1]);
+}
+
+static void
+finish(struct client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->state = STATE_DONE;
+}
+
+static void
+request(struct client *c)
+{
+	const char *cmd;
+
+	cmd = c->requests % 2 ? "PLUGIN-LIST\n" : "SERVER-LIST\n";
+	c->start = now();
+	c->state = STATE_REPLY;
+
+	/* Requests are small enough to never block. */
+	if (send(c->fd, cmd, strlen(cmd), MSG_NOSIGNAL) < 0) {
+		errors++;
+		finish(c);
+	}
+}
+
+/*
+ * Try to connect a client, the transport backlog may be full in which case we
+ * simply try again later.
+ */
+static void
+connect_client(struct client *c)
+{
+	if (c->fd < 0) {
+		if ((c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+			die("socket");
+
+		c->start = now();
+	}
+
+	if (connect(c->fd, (const struct sockaddr *)&addr, sizeof (addr)) == 0)
+		c->state = STATE_HELLO;
+	else if (errno != EAGAIN && errno != EINPROGRESS)
+		die("connect");
+}
+
+/*
+ * Process incoming lines, each request produces exactly one line.
+ */
+static void
+receive(struct client *c)
+{
+	ssize_t nr;
+	char *nl;
+
+	if ((nr = recv(c->fd, c->in + c->in_len, sizeof (c->in) - c->in_len, 0)) <= 0) {
+		if (nr == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			errors++;
+			finish(c);
+		}
+
+		return;
+	}
+
+	c->in_len += nr;
+
+	while (c->state != STATE_DONE && (nl = memchr(c->in, '\n', c->in_len))) {
+		if (c->state == STATE_HELLO)
+			sample(&accepts, now() - c->start);
+		else {
+			if (strncmp(c->in, "OK", 2) != 0)
+				errors++;
+
+			sample(&rtts, now() - c->start);
+			c->requests++;
+		}
+
+		c->in_len -= nl - c->in + 1;
+		memmove(c->in, nl + 1, c->in_len);
+
+		if (c->requests == nrequests)
+			finish(c);
+		else
+			request(c);
+	}
+}
+
+static void
+run(void)
+{
+	unsigned int pending = nclients;
+	double begin;
+	nfds_t n;
+
+	begin = now();
+
+	while (pending) {
+		n = 0;
+
+		for (unsigned int i = 0; i < nclients; ++i) {
+			if (clients[i].state == STATE_CONNECT)
+				connect_client(&clients[i]);
+			if (clients[i].state == STATE_DONE || clients[i].state == STATE_CONNECT)
+				continue;
+
+			fds[n].fd = clients[i].fd;
+			fds[n].events = POLLIN;
+			fds[n++].revents = 0;
+		}
+
+		if (poll(fds, n, 10) < 0)
+			die("poll");
+
+		pending = 0;
+
+		for (unsigned int i = 0, f = 0; i < nclients; ++i) {
+			struct client *c = &clients[i];
+
+			if (c->state == STATE_DONE)
+				continue;
+			if (c->state != STATE_CONNECT && fds[f++].revents)
+				receive(c);
+			if (c->state != STATE_DONE)
+				pending++;
+		}
+	}
+
+	printf("clients  %u, %u requests each, %u errors, %.3f s\n",
+	    nclients, nrequests, errors, (now() - begin) / 1000.0);
+}
+
+static void
+init(void)
+{
+	struct rlimit rl;
+
+	/* Every client needs its own descriptor. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	clients = calloc(nclients, sizeof (*clients));
+	fds = calloc(nclients, sizeof (*fds));
+	accepts.values = calloc(nclients, sizeof (double));
+	rtts.values = calloc((size_t)nclients * nrequests, sizeof (double));
+
+	if (!clients || !fds || !accepts.values || !rtts.values)
+		die("calloc");
+
+	for (unsigned int i = 0; i < nclients; ++i)
+		clients[i].fd = -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:r:")) != -1) {
+		switch (ch) {
+		case 'c':
+			nclients = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			nrequests = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1 || nclients == 0)
+		usage();
+
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(argv[0]) >= sizeof (addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		die(argv[0]);
+	}
+
+	strcpy(addr.sun_path, argv[0]);
+
+	init();
+	run();
+	report("accept", &accepts);
+	report("rtt", &rtts);
+
+	return errors != 0;
+}
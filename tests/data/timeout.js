@@ -0,0 +1,24 @@
+count = 0;
+
+function onCommand()
+{
+	count += 1;
+
+	for (;;)
+		;
+}
+
+function onMessage()
+{
+	count += 1;
+}
+
+function onLoad()
+{
+	t = new Irccd.Timer(Irccd.Timer.Single, 10, function () {
+		for (;;)
+			;
+	});
+
+	t.start();
+}
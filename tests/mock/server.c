@@ -42,6 +42,7 @@ struct irc_server *
 irc_server_new(const char *name)
 {
 	struct mock_server *s;
+	struct irc_metric *m;
 
 	s = irc_util_calloc(1, sizeof (*s));
 	s->parent.name = irc_util_strdup(name);
@@ -50,6 +51,12 @@ irc_server_new(const char *name)
 	s->parent.realname = "t";
 	s->parent.prefix = "!";
 
+	/* The bot registers server metrics, they only need a name. */
+	m = (struct irc_metric *)&s->parent.metrics;
+
+	for (size_t i = 0; i < sizeof (s->parent.metrics) / sizeof (*m); ++i)
+		m[i].name = "irccd_mock";
+
 	return &s->parent;
 }
 
@@ -114,9 +121,9 @@ irc_server_reconnect(struct irc_server *)
 }
 
 const struct irc_channel *
-irc_server_channels_find(struct irc_server *, const char *)
+irc_server_channels_find(struct irc_server *s, const char *name)
 {
-	return NULL;
+	return channels_find(s, name);
 }
 
 IRC_ATTR_PRINTF(2, 3)
@@ -18,12 +18,59 @@
 
 #include <string.h>
 
+#include <ev.h>
+#include <nce/nce.h>
+
 #include <unity.h>
 
+#include <irccd/event.h>
 #include <irccd/irccd.h>
+#include <irccd/plugin.h>
 #include <irccd/server.h>
 #include <irccd/util.h>
 
+#define DISPATCH(s, t, m) do {                                          \
+        irc_bot_dispatch(&(const struct irc_event) {                    \
+                .type = t,                                              \
+                .server = s,                                            \
+                .message = {                                            \
+                        .origin = "jean!jean@localhost",                \
+                        .channel = "#test",                             \
+                        .message = m                                    \
+                }                                                       \
+        });                                                             \
+} while (0)
+
+struct counter {
+	struct irc_plugin parent;
+	unsigned int calls[IRC_EVENT_NUM];
+	const char *victim;
+	int fail;
+};
+
+static int
+counter_handle(struct irc_plugin *plg, const struct irc_event *ev)
+{
+	struct counter *c = IRC_UTIL_CONTAINER_OF(plg, struct counter, parent);
+
+	c->calls[ev->type]++;
+
+	if (c->victim)
+		irc_bot_plugin_remove(c->victim);
+
+	return c->fail ? -1 : 0;
+}
+
+static void
+counter_init(struct counter *c, const char *name, unsigned int events)
+{
+	memset(c, 0, sizeof (*c));
+	irc_plugin_init(&c->parent, name);
+
+	c->parent.events = events;
+	c->parent.handle = counter_handle;
+}
+
 void
 setUp(void)
 {
@@ -169,9 +216,226 @@ servers_clear(void)
 	TEST_ASSERT(!irccd->servers);
 }
 
+static void
+plugins_subscribers(void)
+{
+	struct irc_server *s;
+	struct counter a, b, c;
+
+	s = server_new("test");
+	irc_server_incref(s);
+
+	counter_init(&a, "a", IRC_PLUGIN_EVENT(IRC_EVENT_MESSAGE) |
+	                      IRC_PLUGIN_EVENT(IRC_EVENT_JOIN));
+	counter_init(&b, "b", IRC_PLUGIN_EVENT(IRC_EVENT_TOPIC));
+	counter_init(&c, "c", IRC_PLUGIN_EVENT_ALL);
+	irc_bot_plugin_add(&a.parent);
+	irc_bot_plugin_add(&b.parent);
+	irc_bot_plugin_add(&c.parent);
+
+	DISPATCH(s, IRC_EVENT_MESSAGE, "hello");
+	DISPATCH(s, IRC_EVENT_JOIN, "");
+	TEST_ASSERT_EQUAL(1, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(1, a.calls[IRC_EVENT_JOIN]);
+	TEST_ASSERT_EQUAL(0, b.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(0, b.calls[IRC_EVENT_JOIN]);
+	TEST_ASSERT_EQUAL(1, c.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(1, c.calls[IRC_EVENT_JOIN]);
+
+	/* Not subscribed to commands, b is not invoked at all. */
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!b hello");
+	TEST_ASSERT_EQUAL(2, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(0, b.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(0, b.calls[IRC_EVENT_MESSAGE]);
+
+	/* Subscription is updated on reload. */
+	b.parent.events |= IRC_PLUGIN_EVENT(IRC_EVENT_COMMAND);
+	TEST_ASSERT_EQUAL(0, irc_bot_plugin_reload("b"));
+	TEST_ASSERT_EQUAL(-1, irc_bot_plugin_reload("unknown"));
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!b hello");
+	TEST_ASSERT_EQUAL(3, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(1, b.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(0, b.calls[IRC_EVENT_MESSAGE]);
+
+	/* Plugins list is c -> b -> a, make sure a is no longer invoked. */
+	c.victim = "a";
+	DISPATCH(s, IRC_EVENT_MESSAGE, "hello");
+	TEST_ASSERT_EQUAL(3, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(4, c.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT(!irc_bot_plugin_get("a"));
+
+	c.victim = NULL;
+	irc_bot_plugin_clear();
+	irc_server_decref(s);
+}
+
+static void
+plugins_commands(void)
+{
+	struct irc_server *s;
+	struct counter ask, asking;
+
+	s = server_new("test");
+	irc_server_incref(s);
+
+	counter_init(&ask, "ask", IRC_PLUGIN_EVENT_ALL);
+	counter_init(&asking, "asking", IRC_PLUGIN_EVENT_ALL);
+	irc_bot_plugin_add(&ask.parent);
+	irc_bot_plugin_add(&asking.parent);
+
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!ask will I be rich?");
+	TEST_ASSERT_EQUAL(1, ask.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(0, ask.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(0, asking.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(1, asking.calls[IRC_EVENT_MESSAGE]);
+
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!asking");
+	TEST_ASSERT_EQUAL(1, ask.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(1, ask.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(1, asking.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(1, asking.calls[IRC_EVENT_MESSAGE]);
+
+	/* Neither "ask" nor "asking" is a command here. */
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!askme");
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!");
+	DISPATCH(s, IRC_EVENT_MESSAGE, "ask");
+	TEST_ASSERT_EQUAL(1, ask.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(4, ask.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(1, asking.calls[IRC_EVENT_COMMAND]);
+	TEST_ASSERT_EQUAL(4, asking.calls[IRC_EVENT_MESSAGE]);
+
+	TEST_ASSERT_EQUAL(&ask.parent, irc_bot_plugin_get("ask"));
+	TEST_ASSERT_EQUAL(&asking.parent, irc_bot_plugin_get("asking"));
+	irc_bot_plugin_remove("ask");
+	TEST_ASSERT(!irc_bot_plugin_get("ask"));
+	TEST_ASSERT_EQUAL(&asking.parent, irc_bot_plugin_get("asking"));
+
+	irc_bot_plugin_clear();
+	irc_server_decref(s);
+}
+
+static void
+plugins_stats(void)
+{
+	struct irc_server *s;
+	struct irc_plugin_stats st = {};
+	struct counter a;
+
+	s = server_new("test");
+	irc_server_incref(s);
+
+	counter_init(&a, "a", IRC_PLUGIN_EVENT_ALL);
+	irc_bot_plugin_add(&a.parent);
+
+	DISPATCH(s, IRC_EVENT_MESSAGE, "hello");
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!a hello");
+	a.fail = 1;
+	DISPATCH(s, IRC_EVENT_MESSAGE, "!a hello");
+	TEST_ASSERT_EQUAL(1, a.parent.stats[IRC_EVENT_MESSAGE].count);
+	TEST_ASSERT_EQUAL(0, a.parent.stats[IRC_EVENT_MESSAGE].errors);
+	TEST_ASSERT_EQUAL(2, a.parent.stats[IRC_EVENT_COMMAND].count);
+	TEST_ASSERT_EQUAL(1, a.parent.stats[IRC_EVENT_COMMAND].errors);
+
+	irc_plugin_stats_reset(&a.parent);
+	TEST_ASSERT_EQUAL(0, a.parent.stats[IRC_EVENT_MESSAGE].count);
+	TEST_ASSERT_EQUAL(0, a.parent.stats[IRC_EVENT_COMMAND].count);
+
+	/* 90 fast calls and 10 slow ones. */
+	for (int i = 0; i < 90; ++i)
+		irc_plugin_stats_record(&st, 10, 0);
+	for (int i = 0; i < 10; ++i)
+		irc_plugin_stats_record(&st, 1000 + i, 0);
+
+	TEST_ASSERT_EQUAL(100, st.count);
+	TEST_ASSERT_EQUAL(1009, st.max);
+	TEST_ASSERT_EQUAL(12, irc_plugin_stats_percentile(&st, 50));
+	TEST_ASSERT_EQUAL(12, irc_plugin_stats_percentile(&st, 90));
+	TEST_ASSERT_EQUAL(1009, irc_plugin_stats_percentile(&st, 99));
+
+	/* The rank is rounded up, p99 of 10 calls is the slowest one. */
+	memset(&st, 0, sizeof (st));
+
+	for (int i = 0; i < 9; ++i)
+		irc_plugin_stats_record(&st, 10, 0);
+
+	irc_plugin_stats_record(&st, 1000, 0);
+
+	TEST_ASSERT_EQUAL(12, irc_plugin_stats_percentile(&st, 90));
+	TEST_ASSERT_EQUAL(1000, irc_plugin_stats_percentile(&st, 99));
+
+	irc_bot_plugin_clear();
+	irc_server_decref(s);
+}
+
+static void
+plugins_queue(void)
+{
+	struct irc_server *s;
+	struct counter a, b, c;
+
+	s = server_new("test");
+	irc_server_incref(s);
+
+	counter_init(&a, "a", IRC_PLUGIN_EVENT_ALL);
+	a.parent.queue.max = 2;
+	a.parent.queue.budget = 0;
+	counter_init(&b, "b", IRC_PLUGIN_EVENT_ALL);
+	b.parent.queue.max = 2;
+	b.parent.queue.overflow = IRC_PLUGIN_OVERFLOW_DROP_TYPE;
+	counter_init(&c, "c", IRC_PLUGIN_EVENT_ALL);
+	c.parent.queue.max = 1;
+	c.parent.queue.overflow = IRC_PLUGIN_OVERFLOW_BLOCK;
+	irc_bot_plugin_add(&a.parent);
+	irc_bot_plugin_add(&b.parent);
+	irc_bot_plugin_add(&c.parent);
+
+	DISPATCH(s, IRC_EVENT_MESSAGE, "1");
+	DISPATCH(s, IRC_EVENT_CONNECT, "");
+	DISPATCH(s, IRC_EVENT_MESSAGE, "2");
+	DISPATCH(s, IRC_EVENT_MESSAGE, "3");
+
+	/* Nothing invoked until the loop runs. */
+	TEST_ASSERT_EQUAL(0, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(2, a.parent.queue.pending);
+	TEST_ASSERT_EQUAL(2, a.parent.queue.dropped);
+	TEST_ASSERT_EQUAL(2, b.parent.queue.pending);
+	TEST_ASSERT_EQUAL(2, b.parent.queue.dropped);
+	TEST_ASSERT_EQUAL(4, c.parent.queue.pending);
+	TEST_ASSERT_EQUAL(0, c.parent.queue.dropped);
+	TEST_ASSERT_EQUAL(3, c.parent.queue.spilled);
+
+	nce_sched_run(NULL, EVRUN_NOWAIT);
+
+	/* Oldest events dropped. */
+	TEST_ASSERT_EQUAL(0, a.calls[IRC_EVENT_CONNECT]);
+	TEST_ASSERT_EQUAL(2, a.calls[IRC_EVENT_MESSAGE]);
+	TEST_ASSERT_EQUAL(0, a.parent.queue.pending);
+	TEST_ASSERT_EQUAL(4, a.parent.queue.queued);
+	TEST_ASSERT_EQUAL(2, a.parent.queue.peak);
+
+	/* Only messages dropped. */
+	TEST_ASSERT_EQUAL(1, b.calls[IRC_EVENT_CONNECT]);
+	TEST_ASSERT_EQUAL(1, b.calls[IRC_EVENT_MESSAGE]);
+
+	/* Nothing dropped. */
+	TEST_ASSERT_EQUAL(1, c.calls[IRC_EVENT_CONNECT]);
+	TEST_ASSERT_EQUAL(3, c.calls[IRC_EVENT_MESSAGE]);
+
+	irc_bot_plugin_clear();
+	irc_server_decref(s);
+
+	/* Removed plugins detach their worker, it is destroyed once idle. */
+	nce_sched_run(NULL, EVRUN_NOWAIT);
+}
+
 int
 main(void)
 {
+	int rc;
+
+	/* Plugins are invoked synchronously unless they have a queue. */
+	ev_default_loop(0);
+	nce_sched_default_init();
 	irc_bot_init();
 
 	UNITY_BEGIN();
@@ -179,6 +443,13 @@ main(void)
 	RUN_TEST(servers_add);
 	RUN_TEST(servers_remove);
 	RUN_TEST(servers_clear);
+	RUN_TEST(plugins_subscribers);
+	RUN_TEST(plugins_commands);
+	RUN_TEST(plugins_stats);
+	RUN_TEST(plugins_queue);
+
+	rc = UNITY_END();
+	irc_bot_finish();
 
-	return UNITY_END();
+	return rc;
 }
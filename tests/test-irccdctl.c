@@ -0,0 +1,223 @@
+/*
+ * test-irccdctl.c -- test irccdctl against a running irccd
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <unity.h>
+
+#define COMMANDS 100
+
+static char config[] = "/tmp/irccd-test-XXXXXX";
+static char sock[64];
+static char input[] = "/tmp/irccd-test-XXXXXX";
+static pid_t irccd;
+
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Start irccd with only a transport and wait until it accepts clients.
+ */
+static void
+start(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	FILE *fp;
+	int fd, devnull;
+
+	snprintf(sock, sizeof (sock), "/tmp/irccd-test-%d.sock", (int)getpid());
+	snprintf(addr.sun_path, sizeof (addr.sun_path), "%s", sock);
+
+	if ((fd = mkstemp(config)) < 0 || !(fp = fdopen(fd, "w")))
+		abort();
+
+	fprintf(fp, "transport to \"%s\"\n", sock);
+	fclose(fp);
+
+	if ((irccd = fork()) == 0) {
+		devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, STDOUT_FILENO);
+		dup2(devnull, STDERR_FILENO);
+		execl(IRCCD_EXECUTABLE, "irccd", "-c", config, NULL);
+		_exit(1);
+	}
+
+	for (int i = 0; i < 500; ++i) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (connect(fd, (const struct sockaddr *)&addr, sizeof (addr)) == 0) {
+			close(fd);
+			return;
+		}
+
+		close(fd);
+		usleep(10000);
+	}
+
+	abort();
+}
+
+static void
+stop(void)
+{
+	kill(irccd, SIGTERM);
+	waitpid(irccd, NULL, 0);
+	unlink(config);
+	unlink(sock);
+}
+
+/*
+ * Write lines into the batch input file.
+ */
+static void
+batch_input(const char *lines)
+{
+	FILE *fp;
+	int fd;
+
+	strcpy(input, "/tmp/irccd-test-XXXXXX");
+
+	if ((fd = mkstemp(input)) < 0 || !(fp = fdopen(fd, "w")))
+		abort();
+
+	fputs(lines, fp);
+	fclose(fp);
+}
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+	unlink(input);
+}
+
+static void
+batch_speedup(void)
+{
+	char cmd[256], *lines;
+	long long seq, bat;
+	size_t linesz;
+	FILE *fp;
+
+	/* One connection per command. */
+	snprintf(cmd, sizeof (cmd), IRCCDCTL_EXECUTABLE " -s %s rule-add -c '#seq' accept", sock);
+	seq = now();
+
+	for (int i = 0; i < COMMANDS; ++i)
+		TEST_ASSERT_EQUAL_INT(0, system(cmd));
+
+	seq = now() - seq;
+
+	/* All commands pipelined over one connection. */
+	fp = open_memstream(&lines, &linesz);
+
+	for (int i = 0; i < COMMANDS; ++i)
+		fprintf(fp, "RULE-ADD accept c=#batch\n");
+
+	fclose(fp);
+	batch_input(lines);
+	free(lines);
+
+	snprintf(cmd, sizeof (cmd), IRCCDCTL_EXECUTABLE " -s %s -b %s > /dev/null", sock, input);
+	bat = now();
+
+	TEST_ASSERT_EQUAL_INT(0, system(cmd));
+
+	bat = now() - bat;
+
+	printf("%d commands: %lldms sequential, %lldms batch\n", COMMANDS, seq, bat);
+
+	TEST_ASSERT_LESS_THAN_INT64(seq, bat);
+}
+
+static void
+batch_status(void)
+{
+	char cmd[256], line[256];
+	FILE *fp;
+
+	batch_input(
+		"# comment\n"
+		"RULE-ADD drop c=#status\n"
+		"\n"
+		"SERVER-JOIN unknown #test\n"
+		"RULE-LIST\n"
+		"SERVER-LIST\n"
+		"WATCH\n"
+	);
+
+	snprintf(cmd, sizeof (cmd), IRCCDCTL_EXECUTABLE " -s %s -b < %s", sock, input);
+
+	/* Every reply is reported in order with its line number. */
+	TEST_ASSERT_NOT_NULL((fp = popen(cmd, "r")));
+	TEST_ASSERT_EQUAL_STRING("2: OK\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("4: server unknown not found\n", fgets(line, sizeof (line), fp));
+
+	/* Replies of several lines are shown like the matching command. */
+	TEST_ASSERT_EQUAL_STRING("5: OK 1\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("index:          0\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("action:         drop\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("servers:        \n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("channels:       #status\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("origins:        \n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("plugins:        \n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("events:         \n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("6: OK \n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_EQUAL_STRING("7: ERROR command not supported in batch mode\n", fgets(line, sizeof (line), fp));
+	TEST_ASSERT_NULL(fgets(line, sizeof (line), fp));
+	TEST_ASSERT_NOT_EQUAL_INT(0, pclose(fp));
+}
+
+int
+main(void)
+{
+	int rc;
+
+	start();
+
+	UNITY_BEGIN();
+
+	/* Before the rules are added by the speedup test. */
+	RUN_TEST(batch_status);
+	RUN_TEST(batch_speedup);
+
+	rc = UNITY_END();
+	stop();
+
+	return rc;
+}
@@ -0,0 +1,803 @@
+/*
+ * test-js-plugin.c -- test js-plugin.h functions
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ev.h>
+#include <utlist.h>
+
+#include <unity.h>
+
+#include <irccd/channel.h>
+#include <irccd/event.h>
+#include <irccd/irccd.h>
+#include <irccd/js-plugin.h>
+#include <irccd/metrics.h>
+#include <irccd/plugin.h>
+#include <irccd/server.h>
+
+#include "mock/server.h"
+
+static struct irc_server *server;
+static struct irc_plugin *plugin;
+static duk_context *ctx;
+static char cache[] = "/tmp/irccd-test-XXXXXX";
+
+void
+setUp(void)
+{
+	server = irc_server_new("test");
+	irc_server_incref(server);
+
+	plugin = js_plugin_open("timeout", TOP "/tests/data/timeout.js");
+	ctx = js_plugin_get_context(plugin);
+
+	plugin->timeout = 100;
+}
+
+void
+tearDown(void)
+{
+	if (plugin)
+		irc_plugin_finish(plugin);
+
+	irc_server_decref(server);
+
+	plugin = NULL;
+	ctx = NULL;
+}
+
+static int
+count(void)
+{
+	int ret;
+
+	duk_get_global_string(ctx, "count");
+	ret = duk_get_int(ctx, -1);
+	duk_pop(ctx);
+
+	return ret;
+}
+
+static void
+timeout_handle(void)
+{
+	struct irc_event ev = {
+		.type = IRC_EVENT_COMMAND,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	/* The first call is aborted but the plugin is still usable. */
+	TEST_ASSERT_EQUAL_INT(-1, irc_plugin_handle(plugin, &ev));
+	TEST_ASSERT_EQUAL_UINT64(1, plugin->timeouts);
+
+	ev.type = IRC_EVENT_MESSAGE;
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(plugin, &ev));
+	TEST_ASSERT_EQUAL_UINT64(1, plugin->timeouts);
+	TEST_ASSERT_EQUAL_INT(2, count());
+}
+
+static void
+timeout_timer(void)
+{
+	time_t start = time(NULL);
+
+	irc_plugin_load(plugin);
+
+	while (difftime(time(NULL), start) < 1)
+		ev_run(EVRUN_ONCE);
+
+	TEST_ASSERT_EQUAL_UINT64(1, plugin->timeouts);
+}
+
+static void
+timeout_strikes(void)
+{
+	struct irc_event ev = {
+		.type = IRC_EVENT_COMMAND,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	plugin->strikes = 2;
+	irc_bot_plugin_add(plugin);
+
+	irc_plugin_handle(plugin, &ev);
+	irc_plugin_handle(plugin, &ev);
+	TEST_ASSERT_EQUAL_UINT64(2, plugin->timeouts);
+
+	/* Removal happens from the event loop once the limit is reached. */
+	TEST_ASSERT_NOT_NULL(irc_bot_plugin_get("timeout"));
+	ev_run(EVRUN_NOWAIT);
+	TEST_ASSERT_NULL(irc_bot_plugin_get("timeout"));
+
+	/* Already destroyed by the bot. */
+	plugin = NULL;
+}
+
+static void
+cache_write(const char *path, const char *script)
+{
+	FILE *fp;
+
+	TEST_ASSERT_NOT_NULL((fp = fopen(path, "w")));
+	fputs(script, fp);
+	fclose(fp);
+}
+
+static int
+cache_count(const char *path)
+{
+	struct irc_plugin *js;
+	int ret;
+
+	TEST_ASSERT_NOT_NULL((js = js_plugin_open("cache", path)));
+
+	ctx = js_plugin_get_context(js);
+	ret = count();
+	irc_plugin_finish(js);
+
+	return ret;
+}
+
+static void
+cache_reload(void)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	struct timespec times[2];
+
+	snprintf(path, sizeof (path), "%s/cache.js", cache);
+
+	cache_write(path, "var count = 1;");
+	TEST_ASSERT_EQUAL_INT(1, cache_count(path));
+	TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+
+	/* Same size and mtime, the cached bytecode is used. */
+	cache_write(path, "var count = 2;");
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, path, times, 0));
+	TEST_ASSERT_EQUAL_INT(1, cache_count(path));
+
+	/* Different size, compiled again. */
+	cache_write(path, "var count = 42;");
+	TEST_ASSERT_EQUAL_INT(42, cache_count(path));
+	TEST_ASSERT_EQUAL_INT(42, cache_count(path));
+
+	remove(path);
+}
+
+static void
+cache_corrupt(void)
+{
+	char path[PATH_MAX], file[PATH_MAX];
+	unsigned long long hash = 14695981039346656037ULL;
+	struct stat st;
+	struct timespec times[2];
+	FILE *fp;
+	int ch;
+
+	snprintf(path, sizeof (path), "%s/corrupt.js", cache);
+
+	cache_write(path, "var count = 1;");
+	TEST_ASSERT_EQUAL_INT(1, cache_count(path));
+	TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+
+	/* Same naming as the plugin loader. */
+	for (const char *p = path; *p; ++p)
+		hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+
+	snprintf(file, sizeof (file), "%s/%016llx", cache, hash);
+
+	/* Flip the last byte of the bytecode. */
+	TEST_ASSERT_NOT_NULL((fp = fopen(file, "r+b")));
+	TEST_ASSERT_EQUAL_INT(0, fseek(fp, -1, SEEK_END));
+	ch = fgetc(fp);
+	TEST_ASSERT_EQUAL_INT(0, fseek(fp, -1, SEEK_END));
+	fputc(ch ^ 0xff, fp);
+	fclose(fp);
+
+	/* Same size and mtime but the cache is rejected, compiled again. */
+	cache_write(path, "var count = 3;");
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, path, times, 0));
+	TEST_ASSERT_EQUAL_INT(3, cache_count(path));
+	TEST_ASSERT_EQUAL_INT(3, cache_count(path));
+
+	remove(path);
+}
+
+static void
+shared_isolation(void)
+{
+	struct irc_plugin *a, *b;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_COMMAND,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/shared.js", cache);
+	cache_write(path,
+		"var count = 1;\n"
+		"Array.prototype.count = 10;\n"
+		"function onMessage() { count += [].count; }\n"
+	);
+
+	js_plugin_set_shared(1);
+	a = js_plugin_open("a", path);
+	b = js_plugin_open("b", TOP "/tests/data/timeout.js");
+	js_plugin_set_shared(0);
+
+	TEST_ASSERT_NOT_NULL(a);
+	TEST_ASSERT_NOT_NULL(b);
+	b->timeout = 100;
+
+	/* Globals and built-in prototypes are per plugin. */
+	ctx = js_plugin_get_context(b);
+	TEST_ASSERT_EQUAL_INT(0, count());
+	duk_peval_string(ctx, "[].count === undefined");
+	TEST_ASSERT_TRUE(duk_get_boolean(ctx, -1));
+	duk_pop(ctx);
+
+	/* The deadline applies to the plugin running in the shared heap. */
+	TEST_ASSERT_EQUAL_INT(-1, irc_plugin_handle(b, &ev));
+	TEST_ASSERT_EQUAL_UINT64(1, b->timeouts);
+	irc_plugin_finish(b);
+
+	ev.type = IRC_EVENT_MESSAGE;
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(a, &ev));
+	ctx = js_plugin_get_context(a);
+	TEST_ASSERT_EQUAL_INT(11, count());
+	TEST_ASSERT_EQUAL_UINT64(0, a->timeouts);
+	irc_plugin_finish(a);
+
+	remove(path);
+}
+
+static int
+same(void)
+{
+	int ret;
+
+	duk_get_global_string(ctx, "same");
+	ret = duk_get_boolean(ctx, -1);
+	duk_pop(ctx);
+
+	return ret;
+}
+
+static void
+handlers_cache(void)
+{
+	struct irc_plugin *js;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/handlers.js", cache);
+	cache_write(path,
+		"var count = 0, same = false, last;\n"
+		"function onMessage(server) {\n"
+		"  count++;\n"
+		"  same = server === last;\n"
+		"  last = server;\n"
+		"}\n"
+	);
+
+	TEST_ASSERT_NOT_NULL((js = js_plugin_open("handlers", path)));
+	ctx = js_plugin_get_context(js);
+
+	/* The server object is reused across events. */
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_FALSE(same());
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_TRUE(same());
+
+	/* Until the server is removed from the bot. */
+	irc_server_set_hostname(server, "127.0.0.1");
+	irc_server_set_nickname(server, "test");
+	irc_server_set_username(server, "test");
+	irc_server_set_realname(server, "test");
+	irc_bot_server_add(server);
+	irc_bot_server_remove(server->name);
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_FALSE(same());
+
+	/* Handlers are only resolved again on reload. */
+	duk_peval_string_noresult(ctx, "onMessage = function () { count = 100; }");
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_EQUAL_INT(4, count());
+	irc_plugin_reload(js);
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_EQUAL_INT(100, count());
+
+	irc_plugin_finish(js);
+	remove(path);
+}
+
+static const char *
+eval(const char *code)
+{
+	static char ret[128];
+
+	duk_peval_string(ctx, code);
+	snprintf(ret, sizeof (ret), "%s", duk_safe_to_string(ctx, -1));
+	duk_pop(ctx);
+
+	return ret;
+}
+
+static void
+server_accessors(void)
+{
+	struct irc_plugin *js;
+	struct irc_channel *ch;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	ch = irc_channel_new("#test", NULL, IRC_CHANNEL_FLAGS_JOINED);
+	irc_channel_add(ch, "a", 0);
+	irc_channel_add(ch, "b", 0);
+	irc_channel_add(ch, "c", 1);
+	LL_PREPEND(server->channels, ch);
+
+	snprintf(path, sizeof (path), "%s/accessors.js", cache);
+	cache_write(path,
+		"var s, it;\n"
+		"function onMessage(server) {\n"
+		"  s = server;\n"
+		"}\n"
+		"function next() {\n"
+		"  var u = it.next();\n"
+		"  return u.done ? 'done' : u.value.nickname + '/' + u.value.modes;\n"
+		"}\n"
+	);
+
+	TEST_ASSERT_NOT_NULL((js = js_plugin_open("accessors", path)));
+	ctx = js_plugin_get_context(js);
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+
+	TEST_ASSERT_EQUAL_STRING("test:t:!", eval("[s.name, s.nickname, s.prefix].join(':')"));
+	TEST_ASSERT_EQUAL_STRING("true:false", eval("[s.isJoined('#TEST'), s.isJoined('#none')].join(':')"));
+	TEST_ASSERT_EQUAL_STRING("#test:true", eval("var c = s.channel('#test'); c.name + ':' + c.joined"));
+	TEST_ASSERT_EQUAL_STRING("undefined", eval("typeof (s.channel('#none'))"));
+	TEST_ASSERT_EQUAL_STRING("#test", eval("s.channels()[0].name"));
+
+	/* Users are walked in place. */
+	TEST_ASSERT_EQUAL_STRING("c/1", eval("it = s.users('#test'); next()"));
+
+	/* Removing an already returned user does not break the iteration. */
+	irc_channel_remove(ch, "c");
+	TEST_ASSERT_EQUAL_STRING("b/0", eval("next()"));
+
+	/* The iteration stops if the next user left. */
+	irc_channel_remove(ch, "a");
+	TEST_ASSERT_EQUAL_STRING("done", eval("next()"));
+	TEST_ASSERT_EQUAL_STRING("done", eval("it = s.users('#none'); next()"));
+
+	irc_plugin_finish(js);
+	remove(path);
+
+	LL_DELETE(server->channels, ch);
+	irc_channel_free(ch);
+}
+
+static void
+memory_limit(void)
+{
+	struct irc_plugin *js;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = "big"
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/memory.js", cache);
+	cache_write(path,
+		"var count = 0;\n"
+		"function onMessage(server, origin, channel, message) {\n"
+		"  var list = [];\n"
+		"  for (var i = 0; message === 'big' && i < 100000; ++i)\n"
+		"    list.push('entry ' + i);\n"
+		"  count = list.length + 1;\n"
+		"}\n"
+	);
+
+	TEST_ASSERT_NOT_NULL((js = js_plugin_open("memory", path)));
+	ctx = js_plugin_get_context(js);
+	TEST_ASSERT_GREATER_THAN(0, js->memory);
+	TEST_ASSERT_LESS_OR_EQUAL(js->memory_peak, js->memory);
+
+	/* Allocations beyond the limit fail in the plugin only. */
+	js->memory_limit = js->memory + 256 * 1024;
+	TEST_ASSERT_EQUAL_INT(-1, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_GREATER_THAN(0, js->memory_failures);
+	TEST_ASSERT_LESS_OR_EQUAL(js->memory_limit, js->memory_peak);
+	TEST_ASSERT_EQUAL_INT(0, count());
+
+	/* The plugin keeps working afterwards. */
+	ev.message.message = "small";
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_EQUAL_INT(1, count());
+
+	irc_plugin_stats_reset(js);
+	TEST_ASSERT_EQUAL(js->memory, js->memory_peak);
+	TEST_ASSERT_EQUAL(0, js->memory_failures);
+
+	irc_plugin_finish(js);
+	remove(path);
+}
+
+static int
+metric(const char *line)
+{
+	char *out = NULL;
+	size_t outsz = 0;
+	FILE *fp;
+	int ret;
+
+	TEST_ASSERT_NOT_NULL((fp = open_memstream(&out, &outsz)));
+	irc_metrics_dump(fp, IRC_METRICS_FORMAT_PLAIN);
+	fclose(fp);
+
+	ret = strstr(out, line) != NULL;
+	free(out);
+
+	return ret;
+}
+
+static void
+gc_idle(void)
+{
+	struct irc_plugin *js;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/gc.js", cache);
+	cache_write(path,
+		"function onMessage() {\n"
+		"  for (var i = 0; i < 1000; ++i) {\n"
+		"    var cycle = {};\n"
+		"    cycle.self = cycle;\n"
+		"  }\n"
+		"}\n"
+	);
+
+	TEST_ASSERT_NOT_NULL((js = js_plugin_open("gc", path)));
+	TEST_ASSERT_EQUAL(IRC_PLUGIN_DEFAULT_GC, js->gc_threshold);
+	js->gc_threshold = 16 * 1024;
+
+	/* Nothing collected until the loop is idle. */
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_TRUE(metric("irccd_js_gc_total{plugin=\"gc\"} 0\n"));
+
+	for (int i = 0; i < 10; ++i)
+		ev_run(EVRUN_NOWAIT);
+
+	TEST_ASSERT_TRUE(metric("irccd_js_gc_total{plugin=\"gc\"} 1\n"));
+
+	/* Disabled, left to Duktape. */
+	js->gc_threshold = 0;
+	TEST_ASSERT_EQUAL_INT(0, irc_plugin_handle(js, &ev));
+
+	for (int i = 0; i < 10; ++i)
+		ev_run(EVRUN_NOWAIT);
+
+	TEST_ASSERT_TRUE(metric("irccd_js_gc_total{plugin=\"gc\"} 1\n"));
+
+	irc_plugin_finish(js);
+	remove(path);
+}
+
+/*
+ * Open a plugin in threaded mode and add it to the bot, which starts its
+ * thread.
+ */
+static struct irc_plugin *
+threaded_add(const char *name, const char *path, const char *script)
+{
+	struct irc_plugin *js;
+
+	cache_write(path, script);
+	js_plugin_set_threaded(1);
+	js = js_plugin_open(name, path);
+	js_plugin_set_threaded(0);
+
+	TEST_ASSERT_NOT_NULL(js);
+	TEST_ASSERT_EQUAL_INT(0, irc_bot_plugin_add(js));
+
+	return js;
+}
+
+/*
+ * Run the loop until the plugin has handled that many messages, two seconds
+ * at most.
+ */
+static void
+threaded_wait(struct irc_plugin *js, unsigned long long count)
+{
+	time_t start = time(NULL);
+
+	while (js->stats[IRC_EVENT_MESSAGE].count < count && difftime(time(NULL), start) < 2)
+		ev_run(EVRUN_ONCE);
+
+	TEST_ASSERT_EQUAL_UINT64(count, js->stats[IRC_EVENT_MESSAGE].count);
+}
+
+static void
+threaded_handle(void)
+{
+	struct irc_plugin *js;
+	struct mock_server *mock;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/threaded.js", cache);
+	js = threaded_add("threaded", path,
+		"var count = 0;\n"
+		"function onMessage(server, origin, channel) {\n"
+		"  for (var i = 0, n = 0; i < 100000; ++i) n += i;\n"
+		"  server.message(channel, 'done ' + ++count);\n"
+		"  Irccd.Logger.info('handled ' + count);\n"
+		"}\n"
+	);
+
+	/* Queued for the plugin thread, recorded once handled. */
+	for (int i = 0; i < 3; ++i)
+		TEST_ASSERT_EQUAL_INT(1, irc_plugin_handle(js, &ev));
+
+	threaded_wait(js, 3);
+	TEST_ASSERT_EQUAL_UINT64(0, js->stats[IRC_EVENT_MESSAGE].errors);
+	TEST_ASSERT_GREATER_THAN_size_t(0, js->memory);
+
+	/* Server.message ran on the main thread. */
+	mock = IRC_UTIL_CONTAINER_OF(server, struct mock_server, parent);
+	TEST_ASSERT_NOT_NULL(mock->out);
+	TEST_ASSERT_EQUAL_STRING("message #test done 3", mock->out->line);
+	mock_server_clear(server);
+
+	/* The heap is borrowed from the plugin thread. */
+	ctx = js_plugin_get_context(js);
+	js_plugin_acquire(ctx);
+	TEST_ASSERT_EQUAL_INT(3, count());
+	js_plugin_release(ctx);
+
+	irc_bot_plugin_remove("threaded");
+	remove(path);
+}
+
+static void
+threaded_remove(void)
+{
+	struct irc_plugin *js;
+	char path[PATH_MAX];
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/busy.js", cache);
+	js = threaded_add("busy", path,
+		"function onMessage() { for (;;) {} }\n"
+	);
+	js->timeout = 100;
+
+	/* Removed while busy, once the call is aborted. */
+	TEST_ASSERT_EQUAL_INT(1, irc_plugin_handle(js, &ev));
+	TEST_ASSERT_EQUAL_INT(1, irc_plugin_handle(js, &ev));
+	irc_bot_plugin_remove("busy");
+	TEST_ASSERT_NULL(irc_bot_plugin_get("busy"));
+
+	remove(path);
+}
+
+static void
+threaded_unload(void)
+{
+	char path[PATH_MAX];
+	time_t start = time(NULL);
+	struct irc_event ev = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = "jean!jean@localhost",
+			.channel = "#test",
+			.message = ""
+		}
+	};
+
+	snprintf(path, sizeof (path), "%s/self.js", cache);
+	threaded_add("self", path,
+		"function onMessage() {\n"
+		"  Irccd.Plugin.unload('self');\n"
+		"  Irccd.Logger.info('gone');\n"
+		"}\n"
+	);
+
+	/* Calls are refused once removed, destroyed once the call returns. */
+	TEST_ASSERT_EQUAL_INT(1, irc_plugin_handle(irc_bot_plugin_get("self"), &ev));
+
+	while (irc_bot_plugin_get("self") && difftime(time(NULL), start) < 2)
+		ev_run(EVRUN_ONCE);
+
+	TEST_ASSERT_NULL(irc_bot_plugin_get("self"));
+
+	for (int i = 0; i < 10; ++i)
+		ev_run(EVRUN_NOWAIT);
+
+	remove(path);
+}
+
+static void
+threaded_timer(void)
+{
+	struct irc_plugin *js;
+	char path[PATH_MAX];
+	time_t start = time(NULL);
+	int fired = 0;
+
+	snprintf(path, sizeof (path), "%s/timer.js", cache);
+	js = threaded_add("timer", path,
+		"var fired = false;\n"
+		"function onLoad() {\n"
+		"  var t = new Irccd.Timer(Irccd.Timer.Single, 10, function () {\n"
+		"    fired = Irccd.Plugin.info('timer').name === 'timer';\n"
+		"  });\n"
+		"  t.start();\n"
+		"}\n"
+	);
+
+	/* Callbacks run on the main thread with the heap borrowed. */
+	ctx = js_plugin_get_context(js);
+
+	while (!fired && difftime(time(NULL), start) < 2) {
+		ev_run(EVRUN_ONCE);
+		js_plugin_acquire(ctx);
+		fired = strcmp(eval("fired"), "true") == 0;
+		js_plugin_release(ctx);
+	}
+
+	TEST_ASSERT_TRUE(fired);
+
+	irc_bot_plugin_remove("timer");
+	remove(path);
+}
+
+static void
+cache_clean(void)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (!(dir = opendir(cache)))
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof (path), "%s/%s", cache, entry->d_name);
+		remove(path);
+	}
+
+	closedir(dir);
+	rmdir(cache);
+}
+
+int
+main(void)
+{
+	int rc;
+
+	/* Don't pollute the real cache directory. */
+	if (!mkdtemp(cache))
+		return 1;
+
+	js_plugin_set_cache(cache);
+
+	ev_default_loop(0);
+	irc_bot_init();
+
+	UNITY_BEGIN();
+
+	RUN_TEST(timeout_handle);
+	RUN_TEST(timeout_timer);
+	RUN_TEST(timeout_strikes);
+	RUN_TEST(cache_reload);
+	RUN_TEST(cache_corrupt);
+	RUN_TEST(shared_isolation);
+	RUN_TEST(handlers_cache);
+	RUN_TEST(server_accessors);
+	RUN_TEST(memory_limit);
+	RUN_TEST(gc_idle);
+	RUN_TEST(threaded_handle);
+	RUN_TEST(threaded_remove);
+	RUN_TEST(threaded_unload);
+	RUN_TEST(threaded_timer);
+
+	rc = UNITY_END();
+	cache_clean();
+
+	return rc;
+}
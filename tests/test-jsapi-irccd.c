@@ -133,6 +133,32 @@ basics_system_error_from_c(void)
 	TEST_ASSERT(duk_get_boolean(ctx, -1));
 }
 
+static void
+basics_lazy(void)
+{
+	const int ret = duk_peval_string(ctx,
+		"before = typeof Object.getOwnPropertyDescriptor(Irccd, 'Timer').get;"
+		"listed = Object.keys(Irccd).indexOf('Timer') >= 0;"
+		"single = Irccd.Timer.Single;"
+		"after = typeof Object.getOwnPropertyDescriptor(Irccd, 'Timer').get;"
+		"file = Irccd.System.popen('true', 'r') instanceof Irccd.File;"
+	);
+
+	if (ret != 0)
+		TEST_FAIL();
+
+	TEST_ASSERT(duk_get_global_string(ctx, "before"));
+	TEST_ASSERT_EQUAL_STRING("function", duk_get_string(ctx, -1));
+	TEST_ASSERT(duk_get_global_string(ctx, "listed"));
+	TEST_ASSERT(duk_get_boolean(ctx, -1));
+	TEST_ASSERT(duk_get_global_string(ctx, "single"));
+	TEST_ASSERT_EQUAL_INT(1, duk_get_int(ctx, -1));
+	TEST_ASSERT(duk_get_global_string(ctx, "after"));
+	TEST_ASSERT_EQUAL_STRING("undefined", duk_get_string(ctx, -1));
+	TEST_ASSERT(duk_get_global_string(ctx, "file"));
+	TEST_ASSERT(duk_get_boolean(ctx, -1));
+}
+
 int
 main(void)
 {
@@ -141,6 +167,7 @@ main(void)
 	RUN_TEST(basics_version);
 	RUN_TEST(basics_system_error_from_js);
 	RUN_TEST(basics_system_error_from_c);
+	RUN_TEST(basics_lazy);
 
 	return UNITY_END();
 }
@@ -16,135 +16,325 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#define GREATEST_USE_ABBREVS 0
-#include <greatest.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <unity.h>
 
 #include <irccd/log.h>
 
+#define LOG "test-log.txt"
+
+/* Far more than the queue and a pipe can hold. */
+#define OVERFLOW_LINES  1000
+#define OVERFLOW_SIZE   (OVERFLOW_LINES * 1024)
+
 /*
- * Note: we can't really test logs to console and syslog, so use files as best effort. Write some
- * data and check that it is correctly written.
+ * Lines are written asynchronously, closing the logger writes everything.
  */
-
 static void
-clean(void *udata)
+expect(const char *path, const char *expected)
 {
-	(void)udata;
+	char out[256] = {};
+	FILE *fp;
 
-	remove("stdout.txt");
-	remove("stderr.txt");
+	TEST_ASSERT_NOT_NULL((fp = fopen(path, "r")));
+	fread(out, 1, sizeof (out) - 1, fp);
+	fclose(fp);
+
+	TEST_ASSERT_EQUAL_STRING(expected, out);
 }
 
-GREATEST_TEST
-basics_info_verbose_off(void)
+void
+setUp(void)
 {
-	FILE *fpout;
-	char out[128] = {0}, err[128] = {0};
+	irc_log_set_verbose(0);
+	irc_log_set_rotate(0, 0);
+}
+
+void
+tearDown(void)
+{
+	irc_log_finish();
+	irc_log_set_sampling(IRC_LOG_SUBSYSTEM_CORE, 0);
+	remove(LOG);
+	remove(LOG ".1");
+	remove(LOG ".2");
+	remove(LOG ".3");
+	remove(LOG ".moved");
+}
 
+static void
+basics_info_verbose_off(void)
+{
 	/* Default is quiet, should not log. */
-	irc_log_to_file("stdout.txt");
+	irc_log_to_file(LOG);
 	irc_log_info("hello world!");
+	irc_log_finish();
 
-	if (!(fpout = fopen("stdout.txt", "r")))
-		GREATEST_FAIL();
-
-	fgets(out, sizeof (out), fpout);
-
-	GREATEST_ASSERT_STR_EQ("", out);
-	GREATEST_ASSERT_STR_EQ("", err);
-
-	GREATEST_PASS();
+	expect(LOG, "");
 }
 
-GREATEST_TEST
+static void
 basics_info_verbose_on(void)
 {
-	FILE *fpout;
-	char out[128] = {0};
-
 	irc_log_set_verbose(1);
-	irc_log_to_file("stdout.txt");
+	irc_log_to_file(LOG);
 	irc_log_info("hello world!");
 	irc_log_info("what's up?");
+	irc_log_finish();
 
-	if (!(fpout = fopen("stdout.txt", "r")))
-		GREATEST_FAIL();
-
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("hello world!\n", out);
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("what's up?\n", out);
-
-
-	GREATEST_PASS();
+	expect(LOG, "hello world!\nwhat's up?\n");
 }
 
-GREATEST_TEST
+static void
 basics_warn(void)
 {
-	FILE *fpout;
-	char out[128] = {0};
-
 	/* Warning messages are printed even without verbosity. */
-	irc_log_set_verbose(0);
-	irc_log_to_file("stdout.txt");
+	irc_log_to_file(LOG);
 	irc_log_info("this is not printed");
 	irc_log_warn("error line 1");
 	irc_log_warn("error line 2");
+	irc_log_finish();
 
-	if (!(fpout = fopen("stdout.txt", "r")))
-		GREATEST_FAIL();
-
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("error line 1\n", out);
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("error line 2\n", out);
-
-	GREATEST_PASS();
+	expect(LOG, "error line 1\nerror line 2\n");
 }
 
-GREATEST_TEST
+static void
 basics_debug(void)
 {
-#if !defined(NDEBUG)
-	FILE *fpout;
-	char out[128] = {0};
-
-	/* Debug messages are printed even without verbosity but requires to be built in debug. */
-	irc_log_set_verbose(0);
-	irc_log_to_file("stdout.txt");
+	/* Debug messages are opt-in and require to be built in debug. */
+	irc_log_to_file(LOG);
+	irc_log_debug("not printed");
+	irc_log_set_level(IRC_LOG_SUBSYSTEM_CORE, IRC_LOG_LEVEL_DEBUG);
 	irc_log_debug("startup!");
 	irc_log_debug("shutdown!");
+	irc_log_finish();
 
-	if (!(fpout = fopen("stdout.txt", "r")))
-		GREATEST_FAIL();
-
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("startup!\n", out);
-	GREATEST_ASSERT(fgets(out, sizeof (out), fpout));
-	GREATEST_ASSERT_STR_EQ("shutdown!\n", out);
+#if !defined(NDEBUG)
+	expect(LOG, "startup!\nshutdown!\n");
+#else
+	expect(LOG, "");
 #endif
-	GREATEST_PASS();
 }
 
-GREATEST_SUITE(suite_basics)
+/*
+ * Arguments of disabled messages must not even be evaluated.
+ */
+static const char *
+evaluated(int *count)
+{
+	(*count)++;
+
+	return "world";
+}
+
+static void
+levels_subsystem(void)
+{
+	int count = 0;
+
+	irc_log_set_level(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_INFO);
+	irc_log_to_file(LOG);
+
+	TEST_ASSERT_FALSE(irc_log_enabled(IRC_LOG_LEVEL_INFO));
+	TEST_ASSERT_TRUE(irc_log_enabled(IRC_LOG_LEVEL_WARN));
+	TEST_ASSERT_TRUE(irc_log_enabled_in(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_INFO));
+	TEST_ASSERT_FALSE(irc_log_enabled_in(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_DEBUG));
+
+	IRC_LOG(IRC_LOG_SUBSYSTEM_CONN, IRC_LOG_LEVEL_INFO, "hello %s", evaluated(&count));
+	IRC_LOG(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_DEBUG, "hello %s", evaluated(&count));
+	IRC_LOG(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_INFO, "hello %s", evaluated(&count));
+	irc_log_info("hello core");
+	irc_log_finish();
+
+	TEST_ASSERT_EQUAL_INT(1, count);
+	expect(LOG, "hello world\n");
+}
+
+static void
+json_fields(void)
+{
+	char out[512] = {};
+	FILE *fp;
+
+	irc_log_set_verbose(1);
+	irc_log_to_json(LOG);
+	irc_log_write(IRC_LOG_SUBSYSTEM_SERVER, IRC_LOG_LEVEL_INFO, "local",
+	    "say \"%s\"\tnow\\\x01", "hi");
+	irc_log_warn("core");
+	irc_log_finish();
+
+	TEST_ASSERT_NOT_NULL((fp = fopen(LOG, "r")));
+	fread(out, 1, sizeof (out) - 1, fp);
+	fclose(fp);
+
+	/* The timestamp changes, compare everything after it. */
+	TEST_ASSERT_EQUAL_STRING_LEN("{\"time\":\"", out, 9);
+	TEST_ASSERT_NOT_NULL(strstr(out,
+		"Z\",\"level\":\"info\",\"subsystem\":\"server\",\"server\":\"local\","
+		"\"message\":\"say \\\"hi\\\"\\tnow\\\\\\u0001\"}\n{\"time\":\""));
+	TEST_ASSERT_NOT_NULL(strstr(out,
+		"Z\",\"level\":\"warning\",\"subsystem\":\"core\",\"message\":\"core\"}\n"));
+}
+
+static void
+json_utf8(void)
 {
-	GREATEST_SET_SETUP_CB(clean, NULL);
-	GREATEST_SET_TEARDOWN_CB(clean, NULL);
-	GREATEST_RUN_TEST(basics_info_verbose_off);
-	GREATEST_RUN_TEST(basics_info_verbose_on);
-	GREATEST_RUN_TEST(basics_warn);
-	GREATEST_RUN_TEST(basics_debug);
+	char out[512] = {};
+	FILE *fp;
+
+	/* Truncated, stray and overlong bytes are replaced. */
+	irc_log_to_json(LOG);
+	irc_log_warn("caf\xc3\xa9 \xe2\x82 \xff \xc0\xaf \xf0\x9f\x98\x80");
+	irc_log_finish();
+
+	TEST_ASSERT_NOT_NULL((fp = fopen(LOG, "r")));
+	fread(out, 1, sizeof (out) - 1, fp);
+	fclose(fp);
+
+	TEST_ASSERT_NOT_NULL(strstr(out,
+		"\"message\":\"caf\xc3\xa9 \\ufffd\\ufffd \\ufffd \\ufffd\\ufffd \xf0\x9f\x98\x80\"}\n"));
 }
 
-GREATEST_MAIN_DEFS();
+static void
+levels_sampling(void)
+{
+	irc_log_set_verbose(1);
+	irc_log_set_sampling(IRC_LOG_SUBSYSTEM_CORE, 2);
+	irc_log_to_file(LOG);
+
+	for (int i = 0; i < 5; ++i)
+		irc_log_info("info %d", i);
+
+	/* Warnings are never dropped. */
+	irc_log_warn("warning");
+	irc_log_finish();
+
+	expect(LOG, "info 0\ninfo 2\ninfo 4\nwarning\n");
+}
+
+static void
+basics_reopen(void)
+{
+	irc_log_to_file(LOG);
+	irc_log_warn("before");
+	irc_log_flush();
+	expect(LOG, "before\n");
+
+	rename(LOG, LOG ".moved");
+	irc_log_reopen();
+	irc_log_flush();
+	irc_log_warn("after");
+	irc_log_finish();
+
+	expect(LOG ".moved", "before\n");
+	expect(LOG, "after\n");
+}
+
+static void
+basics_rotate(void)
+{
+	/* Every line exceeds the size, each one ends up in its own file. */
+	irc_log_set_rotate(4, 2);
+	irc_log_to_file(LOG);
+
+	for (int i = 1; i <= 4; ++i) {
+		irc_log_warn("line %d", i);
+		irc_log_flush();
+	}
+
+	irc_log_finish();
+
+	expect(LOG ".2", "line 3\n");
+	expect(LOG ".1", "line 4\n");
+	expect(LOG, "");
+	TEST_ASSERT_NOT_EQUAL_INT(0, access(LOG ".3", F_OK));
+}
+
+static void *
+drain(void *data)
+{
+	struct { int fd; char *buf; size_t len; } *fifo = data;
+	ssize_t nr;
+
+	while ((nr = read(fifo->fd, fifo->buf + fifo->len, OVERFLOW_SIZE - fifo->len - 1)) > 0)
+		fifo->len += nr;
+
+	fifo->buf[fifo->len] = '\0';
+
+	return NULL;
+}
+
+static void
+basics_overflow(void)
+{
+	struct { int fd; char *buf; size_t len; } fifo = {0};
+	char pad[1000];
+	const char *p;
+	unsigned long dropped = 0, n;
+	pthread_t thread;
+	int lines = 0;
+
+	/*
+	 * Nobody reads the FIFO until everything is logged, so the writer
+	 * blocks once the pipe is full and the queue fills up behind it.
+	 */
+	TEST_ASSERT_EQUAL_INT(0, mkfifo(LOG, 0600));
+	TEST_ASSERT_NOT_EQUAL_INT(-1, (fifo.fd = open(LOG, O_RDONLY | O_NONBLOCK)));
+	TEST_ASSERT_NOT_NULL((fifo.buf = malloc(OVERFLOW_SIZE)));
+
+	memset(pad, 'x', sizeof (pad) - 1);
+	pad[sizeof (pad) - 1] = '\0';
+
+	irc_log_to_file(LOG);
+
+	for (int i = 0; i < OVERFLOW_LINES; ++i)
+		irc_log_warn("%s", pad);
+
+	/* Read everything until the logger closes the FIFO. */
+	fcntl(fifo.fd, F_SETFL, 0);
+	pthread_create(&thread, NULL, drain, &fifo);
+	irc_log_finish();
+	pthread_join(thread, NULL);
+	close(fifo.fd);
+
+	for (p = fifo.buf; *p; p = strchr(p, '\n') + 1) {
+		if (sscanf(p, "log: %lu lines dropped\n", &n) == 1)
+			dropped += n;
+		else {
+			TEST_ASSERT_EQUAL_STRING_LEN(pad, p, sizeof (pad) - 1);
+			lines++;
+		}
+	}
+
+	free(fifo.buf);
+
+	TEST_ASSERT_GREATER_THAN_UINT(0, dropped);
+	TEST_ASSERT_EQUAL_UINT(OVERFLOW_LINES, lines + dropped);
+}
 
 int
-main(int argc, char **argv)
+main(void)
 {
-	GREATEST_MAIN_BEGIN();
-	GREATEST_RUN_SUITE(suite_basics);
-	GREATEST_MAIN_END();
+	UNITY_BEGIN();
+
+	RUN_TEST(basics_info_verbose_off);
+	RUN_TEST(basics_info_verbose_on);
+	RUN_TEST(basics_warn);
+	RUN_TEST(basics_debug);
+	RUN_TEST(levels_subsystem);
+	RUN_TEST(levels_sampling);
+	RUN_TEST(json_fields);
+	RUN_TEST(json_utf8);
+	RUN_TEST(basics_reopen);
+	RUN_TEST(basics_rotate);
+	RUN_TEST(basics_overflow);
 
-	return 0;
+	return UNITY_END();
 }
@@ -0,0 +1,135 @@
+/*
+ * test-metrics.c -- test metrics.h functions
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unity.h>
+
+#include <irccd/metrics.h>
+
+static struct irc_metric lines_b = {
+	.name = "irccd_lines_total",
+	.help = "Lines.",
+	.type = IRC_METRIC_COUNTER,
+	.label = "server",
+	.label_value = "b"
+};
+
+static struct irc_metric lines_a = {
+	.name = "irccd_lines_total",
+	.help = "Lines.",
+	.type = IRC_METRIC_COUNTER,
+	.label = "server",
+	.label_value = "a\"\\"
+};
+
+static struct irc_metric peers = {
+	.name = "irccd_peers",
+	.help = "Peers.",
+	.type = IRC_METRIC_GAUGE
+};
+
+static char *
+dump(enum irc_metrics_format fmt, size_t *n)
+{
+	char *out = NULL;
+	size_t outsz = 0;
+	FILE *fp;
+
+	fp = open_memstream(&out, &outsz);
+	*n = irc_metrics_dump(fp, fmt);
+	fclose(fp);
+
+	return out;
+}
+
+void
+setUp(void)
+{
+	irc_metrics_register(&peers);
+	irc_metrics_register(&lines_b);
+	irc_metrics_register(&lines_a);
+}
+
+void
+tearDown(void)
+{
+	irc_metrics_unregister(&peers);
+	irc_metrics_unregister(&lines_b);
+	irc_metrics_unregister(&lines_a);
+}
+
+static void
+basics_plain(void)
+{
+	char *out;
+	size_t n;
+
+	irc_metric_add(&lines_a, 10);
+	irc_metric_inc(&lines_b);
+	irc_metric_set(&peers, 4);
+	irc_metric_sub(&peers, 1);
+
+	/* Sorted by name and label, values are escaped. */
+	out = dump(IRC_METRICS_FORMAT_PLAIN, &n);
+	TEST_ASSERT_EQUAL_size_t(3, n);
+	TEST_ASSERT_EQUAL_STRING(
+		"irccd_lines_total{server=\"a\\\"\\\\\"} 10\n"
+		"irccd_lines_total{server=\"b\"} 1\n"
+		"irccd_peers 3\n",
+		out
+	);
+	free(out);
+}
+
+static void
+basics_prometheus(void)
+{
+	char *out;
+	size_t n;
+
+	/* Registering twice has no effect. */
+	irc_metrics_register(&peers);
+	irc_metrics_unregister(&lines_a);
+
+	/* Description is written once per name. */
+	out = dump(IRC_METRICS_FORMAT_PROMETHEUS, &n);
+	TEST_ASSERT_EQUAL_size_t(2, n);
+	TEST_ASSERT_EQUAL_STRING(
+		"# HELP irccd_lines_total Lines.\n"
+		"# TYPE irccd_lines_total counter\n"
+		"irccd_lines_total{server=\"b\"} 1\n"
+		"# HELP irccd_peers Peers.\n"
+		"# TYPE irccd_peers gauge\n"
+		"irccd_peers 3\n",
+		out
+	);
+	free(out);
+}
+
+int
+main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(basics_plain);
+	RUN_TEST(basics_prometheus);
+
+	return UNITY_END();
+}
@@ -0,0 +1,549 @@
+/*
+ * test-peer.c -- test peer output limits
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nce/nce.h>
+
+#include <unity.h>
+
+#include <irccd/event.h>
+#include <irccd/irccd.h>
+#include <irccd/metrics.h>
+#include <irccd/plugin.h>
+
+#include "irccd/peer.h"
+
+#define EVENT "EVENT-MESSAGE test jean!jean@localhost #test hello\n"
+
+static struct peer *peer;
+static int client = -1;
+static char in[1024 * 1024];
+static size_t in_len;
+static unsigned long long missed;
+static int flood;
+static int eof;
+static int reaped;
+static unsigned long long since;
+
+static void
+reap(struct peer *p)
+{
+	TEST_ASSERT_EQUAL_PTR(peer, p);
+
+	reaped = 1;
+	peer_free(p);
+	peer = NULL;
+}
+
+static void
+open_peer(enum peer_overflow overflow, size_t high)
+{
+	struct peer_limits limits = {
+		.high = high,
+		.low = high / 4,
+		.overflow = overflow
+	};
+	int fds[2], size = 4096;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		TEST_FAIL_MESSAGE(strerror(errno));
+
+	/* Keep kernel buffers small so that the peer fills up quickly. */
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+	setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	client = fds[1];
+	peer = peer_new(fds[0], &limits, reap);
+	peer->is_watching = 1;
+}
+
+/*
+ * Read everything available on the client side.
+ */
+static void
+client_read(void)
+{
+	ssize_t nr;
+
+	while ((nr = read(client, in + in_len, sizeof (in) - in_len)) > 0)
+		in_len += nr;
+
+	if (nr == 0)
+		eof = 1;
+}
+
+/*
+ * Send a copy of the line, the caller reference is dropped.
+ */
+static int
+send_line(struct peer *p, const char *line)
+{
+	struct peer_msg *msg;
+	int rc;
+
+	msg = peer_msg_new(strlen(line));
+	memcpy(msg->data, line, msg->len);
+	rc = peer_send(p, msg, 0);
+	peer_msg_unref(msg);
+
+	return rc;
+}
+
+static void
+run(void (*cb)(struct ev_timer *, int))
+{
+	struct ev_timer tick;
+
+	ev_timer_init(&tick, cb, 0.001, 0.001);
+	ev_timer_start(&tick);
+	nce_sched_run(NULL, 0);
+	ev_timer_stop(&tick);
+}
+
+void
+setUp(void)
+{
+	peer = NULL;
+	in_len = 0;
+	missed = 0;
+	flood = 0;
+	eof = 0;
+	reaped = 0;
+	since = 0;
+}
+
+void
+tearDown(void)
+{
+	if (peer)
+		peer_free(peer);
+	if (client != -1)
+		close(client);
+
+	client = -1;
+}
+
+static void
+drop_cb(struct ev_timer *, int)
+{
+	/* Flood a client that does not read anything. */
+	if (flood < 50) {
+		for (int i = 0; i < 100; ++i)
+			send_line(peer, EVENT);
+
+		/* The daemon memory never grows past the high watermark. */
+		TEST_ASSERT_LESS_OR_EQUAL_size_t(2048, peer->out.len);
+
+		if (++flood == 50) {
+			TEST_ASSERT_GREATER_THAN_UINT64(0, peer->dropped);
+			TEST_ASSERT_GREATER_THAN_UINT64(0, peer->gap);
+		}
+
+		return;
+	}
+
+	/* Now catch up and expect a gap marker before the next event. */
+	client_read();
+
+	if (peer->out.len == 0 && peer->gap) {
+		missed = peer->gap;
+
+		TEST_ASSERT_EQUAL_INT(0, send_line(peer, EVENT));
+		TEST_ASSERT_EQUAL_UINT64(0, peer->gap);
+	} else if (!peer->gap && peer->out.len == 0) {
+		/* Slow but still connected. */
+		TEST_ASSERT_TRUE(nce_stream_active(&peer->stream.stream));
+		nce_sched_break(NULL, EVBREAK_ALL);
+	}
+}
+
+static void
+overflow_drop(void)
+{
+	char marker[128];
+
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+	run(drop_cb);
+	client_read();
+
+	/* Last event is preceded by the number of events missed. */
+	snprintf(marker, sizeof (marker), "EVENT-GAP %llu\n" EVENT, missed);
+	in[in_len] = '\0';
+
+	TEST_ASSERT_GREATER_OR_EQUAL_size_t(strlen(marker), in_len);
+	TEST_ASSERT_EQUAL_STRING(marker, in + in_len - strlen(marker));
+}
+
+static void
+disconnect_cb(struct ev_timer *, int)
+{
+	if (!peer) {
+		nce_sched_break(NULL, EVBREAK_ALL);
+		return;
+	}
+
+	for (int i = 0; i < 100 && send_line(peer, EVENT) == 0; ++i)
+		continue;
+
+	/* Closing, further events are refused until the peer is reaped. */
+	if (peer->is_closing) {
+		TEST_ASSERT_EQUAL_UINT64(1, peer->dropped);
+		TEST_ASSERT_EQUAL_INT(-EBADF, send_line(peer, EVENT));
+	}
+}
+
+static void
+overflow_disconnect(void)
+{
+	open_peer(PEER_OVERFLOW_DISCONNECT, 2048);
+	run(disconnect_cb);
+
+	/* The client sees the end of stream once read entirely. */
+	client_read();
+
+	TEST_ASSERT_TRUE(reaped);
+	TEST_ASSERT_TRUE(eof);
+}
+
+static void
+replay(struct peer *p, unsigned long long epoch, unsigned long long seq)
+{
+	TEST_ASSERT_EQUAL_PTR(peer, p);
+	TEST_ASSERT_TRUE(p->is_sequenced);
+	TEST_ASSERT_EQUAL_UINT64(7, epoch);
+
+	since = seq;
+	send_line(p, "@seq=7:43 " EVENT);
+}
+
+static void
+watch_since_cb(struct ev_timer *, int)
+{
+	client_read();
+	in[in_len] = '\0';
+
+	/* Wait for the hello, invalid numbers are rejected without replaying. */
+	if (!flood && memchr(in, '\n', in_len)) {
+		flood = 1;
+		write(client, "WATCH since=1x\n", 15);
+		write(client, "WATCH since=42\n", 15);
+		write(client, "WATCH since=7:42 e=onMessage\n", 29);
+	} else if (strstr(in, EVENT)) {
+		/* Replayed events follow the acknowledgement. */
+		TEST_ASSERT_EQUAL_UINT64(42, since);
+		TEST_ASSERT_TRUE(peer->is_watching);
+		TEST_ASSERT_NOT_NULL(strstr(in, "Invalid argument\nInvalid argument\nOK\n@seq=7:43 " EVENT));
+		nce_sched_break(NULL, EVBREAK_ALL);
+	}
+}
+
+static void
+watch_since(void)
+{
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+	peer->is_watching = 0;
+	peer->replay = replay;
+	run(watch_since_cb);
+
+	TEST_ASSERT_EQUAL_UINT64(42, since);
+}
+
+/*
+ * Compare events against the filters of the last watch command.
+ */
+static void
+watch_filters_check(void)
+{
+	struct peer_match m = {
+		.type = IRC_EVENT_MESSAGE,
+		.server = "test",
+		.channel = "#staff",
+		.origin = "Jean!jean@Host.Example.org"
+	};
+
+	TEST_ASSERT_TRUE(peer->is_watching);
+
+	/* Servers and channels ignore case, origins are case folded globs. */
+	TEST_ASSERT_TRUE(peer_matches(peer, &m));
+	m.origin = "jean!jean@example.org";
+	TEST_ASSERT_FALSE(peer_matches(peer, &m));
+	m.origin = "jean!jean@irc.example.org";
+	TEST_ASSERT_TRUE(peer_matches(peer, &m));
+	m.origin = NULL;
+	TEST_ASSERT_FALSE(peer_matches(peer, &m));
+	m.origin = "jean!jean@irc.example.org";
+	m.channel = "#other";
+	TEST_ASSERT_FALSE(peer_matches(peer, &m));
+	m.channel = "#STAFF";
+	m.server = "other";
+	TEST_ASSERT_FALSE(peer_matches(peer, &m));
+	m.server = "TEST";
+
+	/* Only the listed events. */
+	m.type = IRC_EVENT_JOIN;
+	TEST_ASSERT_TRUE(peer_matches(peer, &m));
+	m.type = IRC_EVENT_PART;
+	TEST_ASSERT_FALSE(peer_matches(peer, &m));
+}
+
+static void
+watch_filters_cb(struct ev_timer *, int)
+{
+	client_read();
+	in[in_len] = '\0';
+
+	if (!flood && memchr(in, '\n', in_len)) {
+		flood = 1;
+		write(client, "WATCH c\n", 8);
+		write(client, "WATCH x=foo\n", 12);
+		write(client, "WATCH e=onNothing\n", 18);
+		write(client, "WATCH e=onMessage e=onJoin s=test c=#Staff o=*!*@*.example.org\n", 63);
+	} else if (strstr(in, "OK\n")) {
+		/* Bad tokens are rejected and do not enable the watch. */
+		TEST_ASSERT_NOT_NULL(strstr(in,
+			"Invalid argument\n"
+			"Invalid argument\n"
+			"ERROR invalid event onNothing\n"
+			"OK\n"
+		));
+
+		watch_filters_check();
+		flood = 2;
+		nce_sched_break(NULL, EVBREAK_ALL);
+	} else if (flood == 1)
+		TEST_ASSERT_FALSE(peer->is_watching);
+}
+
+static void
+watch_filters(void)
+{
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+	peer->is_watching = 0;
+	run(watch_filters_cb);
+
+	TEST_ASSERT_EQUAL_INT(2, flood);
+}
+
+static struct peer_msg *shared;
+static int other = -1;
+
+static void
+shared_cb(struct ev_timer *, int)
+{
+	char buf[256];
+	ssize_t nr;
+
+	/* Hellos are left aside, then wait for both copies of the event. */
+	client_read();
+
+	if ((nr = read(other, buf, sizeof (buf) - 1)) > 0) {
+		buf[nr] = '\0';
+
+		if (strstr(buf, EVENT))
+			flood++;
+	}
+
+	in[in_len] = '\0';
+
+	if (strstr(in, "@seq=7 " EVENT) && flood && shared->refs == 1)
+		nce_sched_break(NULL, EVBREAK_ALL);
+}
+
+static void
+shared_message(void)
+{
+	struct peer_limits limits = {
+		.high = 2048,
+		.low = 512
+	};
+	struct peer *second;
+	size_t len[2];
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		TEST_FAIL_MESSAGE(strerror(errno));
+
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	other = fds[1];
+	second = peer_new(fds[0], &limits, NULL);
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+
+	/* Both peers refer to the same text, the second one without its tag. */
+	shared = peer_msg_new(strlen("@seq=7 " EVENT));
+	memcpy(shared->data, "@seq=7 " EVENT, shared->len);
+
+	len[0] = peer->out.len;
+	len[1] = second->out.len;
+
+	TEST_ASSERT_EQUAL_INT(0, peer_send(peer, shared, 0));
+	TEST_ASSERT_EQUAL_INT(0, peer_send(second, shared, 7));
+	TEST_ASSERT_EQUAL_UINT(3, shared->refs);
+	TEST_ASSERT_EQUAL_size_t(len[0] + shared->len, peer->out.len);
+	TEST_ASSERT_EQUAL_size_t(len[1] + shared->len - 7, second->out.len);
+
+	run(shared_cb);
+
+	/* Released by both peers once written. */
+	TEST_ASSERT_EQUAL_UINT(1, shared->refs);
+	TEST_ASSERT_EQUAL_INT(1, flood);
+
+	peer_msg_unref(shared);
+	peer_free(second);
+	close(other);
+	other = -1;
+}
+
+static void
+plugin_stats_cb(struct ev_timer *, int)
+{
+	static int ticks;
+
+	client_read();
+	in[in_len] = '\0';
+
+	/* Give up after a second, a truncated reply never ends with a newline. */
+	if (++ticks == 1000)
+		nce_sched_break(NULL, EVBREAK_ALL);
+
+	if (!flood && memchr(in, '\n', in_len)) {
+		flood = 1;
+		in_len = 0;
+		write(client, "PLUGIN-STATS\n", 13);
+	} else if (flood && in_len && in[in_len - 1] == '\n' && strstr(in, "plugin-000 ")) {
+		/* Every line announced is sent. */
+		TEST_ASSERT_EQUAL_STRING_LEN("OK 100\n", in, 7);
+
+		for (const char *ln = in; (ln = strchr(ln, '\n')); ++ln)
+			flood++;
+
+		nce_sched_break(NULL, EVBREAK_ALL);
+	}
+}
+
+static void
+plugin_stats(void)
+{
+	static struct irc_plugin plugins[100];
+	char name[32];
+
+	for (size_t i = 0; i < 100; ++i) {
+		snprintf(name, sizeof (name), "plugin-%03zu", i);
+		irc_plugin_init(&plugins[i], name);
+		irc_bot_plugin_add(&plugins[i]);
+	}
+
+	/* The reply is larger than the high watermark. */
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+	run(plugin_stats_cb);
+	irc_bot_plugin_clear();
+
+	TEST_ASSERT_GREATER_THAN_size_t(4 * IRC_BUF_LEN, in_len);
+	TEST_ASSERT_EQUAL_INT(1 + 101, flood);
+}
+
+static void
+stats_cb(struct ev_timer *, int)
+{
+	static int ticks;
+	unsigned long n;
+	size_t lines = 0;
+
+	client_read();
+	in[in_len] = '\0';
+
+	if (++ticks == 1000)
+		nce_sched_break(NULL, EVBREAK_ALL);
+
+	if (!flood && memchr(in, '\n', in_len)) {
+		flood = 1;
+		in_len = 0;
+		write(client, "STATS\n", 6);
+	} else if (flood && sscanf(in, "OK %lu\n", &n) == 1) {
+		/* Dropped rather than interleaved with the reply. */
+		if (flood++ == 1)
+			TEST_ASSERT_EQUAL_INT(-ENOBUFS, send_line(peer, EVENT));
+
+		for (const char *ln = in; (ln = strchr(ln, '\n')); ++ln)
+			lines++;
+
+		if (lines < n + 1)
+			return;
+
+		/* Every line announced is sent, nothing else. */
+		TEST_ASSERT_EQUAL_size_t(n + 1, lines);
+		TEST_ASSERT_EQUAL_CHAR('\n', in[in_len - 1]);
+		TEST_ASSERT_NOT_NULL(strstr(in, "\nirccd_test_metric{index=\"499\"} 499\n"));
+		TEST_ASSERT_NULL(strstr(in, "EVENT-"));
+		TEST_ASSERT_EQUAL_UINT64(1, peer->gap);
+		flood = -1;
+		nce_sched_break(NULL, EVBREAK_ALL);
+	}
+}
+
+static void
+stats(void)
+{
+	static struct irc_metric metrics[500];
+	static char values[500][8];
+
+	for (size_t i = 0; i < 500; ++i) {
+		snprintf(values[i], sizeof (values[i]), "%zu", i);
+		metrics[i].name = "irccd_test_metric";
+		metrics[i].type = IRC_METRIC_GAUGE;
+		metrics[i].label = "index";
+		metrics[i].label_value = values[i];
+		metrics[i].value = i;
+		irc_metrics_register(&metrics[i]);
+	}
+
+	/* About 18KiB of metrics, more than the watermark and socket buffers. */
+	open_peer(PEER_OVERFLOW_DROP, 2048);
+	run(stats_cb);
+
+	for (size_t i = 0; i < 500; ++i)
+		irc_metrics_unregister(&metrics[i]);
+
+	TEST_ASSERT_EQUAL_INT(-1, flood);
+}
+
+int
+main(void)
+{
+	ev_default_loop(0);
+	nce_sched_default_init();
+	irc_bot_init();
+
+	UNITY_BEGIN();
+
+	RUN_TEST(overflow_drop);
+	RUN_TEST(overflow_disconnect);
+	RUN_TEST(watch_since);
+	RUN_TEST(watch_filters);
+	RUN_TEST(shared_message);
+	RUN_TEST(plugin_stats);
+	RUN_TEST(stats);
+
+	return UNITY_END();
+}
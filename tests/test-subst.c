@@ -17,14 +17,27 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ev.h>
+
+#include <nce/nce.h>
+#include <nce/timer.h>
 
 #include <unity.h>
 
+#include <irccd/metrics.h>
 #include <irccd/subst.h>
 #include <irccd/util.h>
 
+static char output[] = "/tmp/irccd-test-XXXXXX";
+static char command[64];
+static char rendered[64];
+
 void
 setUp(void)
 {
@@ -33,6 +46,59 @@ setUp(void)
 void
 tearDown(void)
 {
+	unlink(output);
+	irc_subst_set_shell_ttl(IRC_SUBST_SHELL_TTL);
+}
+
+/*
+ * Create a file whose content is printed by command.
+ */
+static void
+output_init(void)
+{
+	int fd;
+
+	strcpy(output, "/tmp/irccd-test-XXXXXX");
+
+	if ((fd = mkstemp(output)) < 0)
+		abort();
+
+	close(fd);
+	snprintf(command, sizeof (command), "!{cat %s}", output);
+}
+
+static void
+output_set(const char *value)
+{
+	FILE *fp;
+
+	if (!(fp = fopen(output, "w")))
+		abort();
+
+	fputs(value, fp);
+	fclose(fp);
+}
+
+static int
+metric(const char *name)
+{
+	char *dump = NULL, *line;
+	size_t dumpsz = 0;
+	int value = -1;
+	FILE *fp;
+
+	if (!(fp = open_memstream(&dump, &dumpsz)))
+		abort();
+
+	irc_metrics_dump(fp, IRC_METRICS_FORMAT_PLAIN);
+	fclose(fp);
+
+	if ((line = strstr(dump, name)))
+		value = atoi(line + strlen(name) + 1);
+
+	free(dump);
+
+	return value;
 }
 
 static void
@@ -318,6 +384,94 @@ shell_no_new_line(void)
 	TEST_ASSERT_EQUAL_STRING("hello world", buf);
 }
 
+static void
+shell_cache(void)
+{
+	struct irc_subst params = {
+		.flags = IRC_SUBST_SHELL | IRC_SUBST_SHELL_CACHE
+	};
+
+	output_init();
+	output_set("one");
+
+	/* First use waits for the command. */
+	TEST_ASSERT_EQUAL_INT(3, irc_subst(rendered, sizeof (rendered), command, &params));
+	TEST_ASSERT_EQUAL_STRING("one", rendered);
+	TEST_ASSERT_EQUAL_INT(0, metric("irccd_subst_shell_hits_total"));
+	TEST_ASSERT_EQUAL_INT(1, metric("irccd_subst_shell_misses_total"));
+
+	/* Not expired yet. */
+	output_set("two");
+	TEST_ASSERT_EQUAL_INT(3, irc_subst(rendered, sizeof (rendered), command, &params));
+	TEST_ASSERT_EQUAL_STRING("one", rendered);
+	TEST_ASSERT_EQUAL_INT(1, metric("irccd_subst_shell_hits_total"));
+
+	/* Expired, without a scheduler the command is run in place. */
+	irc_subst_set_shell_ttl(0);
+	TEST_ASSERT_EQUAL_INT(3, irc_subst(rendered, sizeof (rendered), command, &params));
+	TEST_ASSERT_EQUAL_STRING("two", rendered);
+	TEST_ASSERT_EQUAL_INT(1, metric("irccd_subst_shell_hits_total"));
+	TEST_ASSERT_EQUAL_INT(2, metric("irccd_subst_shell_misses_total"));
+}
+
+/*
+ * Render until the refreshed output shows up, the scheduler stops once every
+ * coroutine has ended.
+ */
+static void
+shell_cache_refresh_entry(struct nce_coro *)
+{
+	struct irc_subst params = {
+		.flags = IRC_SUBST_SHELL | IRC_SUBST_SHELL_CACHE
+	};
+	struct nce_timer tick = {};
+
+	nce_timer_set(&tick, 0.001, 0.001);
+	nce_timer_start(&tick);
+
+	for (int i = 0; i < 1000 && strcmp(rendered, "four") != 0; ++i) {
+		nce_timer_wait(&tick);
+		irc_subst(rendered, sizeof (rendered), command, &params);
+	}
+
+	nce_timer_stop(&tick);
+}
+
+static void
+shell_cache_refresh(void)
+{
+	struct irc_subst params = {
+		.flags = IRC_SUBST_SHELL | IRC_SUBST_SHELL_CACHE
+	};
+	struct nce_coro coro = {
+		.name = "test.refresh",
+		.entry = shell_cache_refresh_entry
+	};
+	int refreshes;
+
+	ev_default_loop(0);
+	nce_sched_default_init();
+
+	output_init();
+	output_set("three");
+	irc_subst_set_shell_ttl(0);
+	refreshes = metric("irccd_subst_shell_refreshes_total");
+
+	TEST_ASSERT_EQUAL_INT(5, irc_subst(rendered, sizeof (rendered), command, &params));
+	TEST_ASSERT_EQUAL_STRING("three", rendered);
+
+	/* The previous output is used until the command completes. */
+	output_set("four");
+	TEST_ASSERT_EQUAL_INT(5, irc_subst(rendered, sizeof (rendered), command, &params));
+	TEST_ASSERT_EQUAL_STRING("three", rendered);
+
+	nce_coro_spawn(&coro);
+	nce_sched_run(NULL, 0);
+
+	TEST_ASSERT_EQUAL_STRING("four", rendered);
+	TEST_ASSERT_GREATER_THAN_INT(refreshes, metric("irccd_subst_shell_refreshes_total"));
+}
+
 static void
 shattrs_simple(void)
 {
@@ -404,6 +558,69 @@ ircattrs_invalid_color(void)
 	TEST_ASSERT_EQUAL_STRING("\x03" "standard" "\x03", buf);
 }
 
+static void
+compile_same(void)
+{
+	static const char *templates[] = {
+		"hello world!",
+		"$@# $ @ # ## #! #",
+		"%H:%M #{target} ##{target} #{missing}!",
+		"${HOME} !{printf world} @{red,blue,bold}text@{}",
+		"#{%Y}",
+		"#{"
+	};
+	struct irc_subst_keyword kw[] = {
+		{ "target", "hello" }
+	};
+	struct irc_subst params = {
+		.time = time(NULL),
+		.keywords = kw,
+		.keywordsz = IRC_UTIL_SIZE(kw)
+	};
+	struct irc_subst_template *tpl;
+	char expected[1024], buf[1024];
+
+	/* Every combination of flags renders the same as irc_subst. */
+	for (size_t i = 0; i < IRC_UTIL_SIZE(templates); ++i) {
+		TEST_ASSERT_NOT_NULL((tpl = irc_subst_compile(templates[i])));
+
+		for (int flags = 0; flags < (1 << 6); ++flags) {
+			params.flags = flags;
+
+			TEST_ASSERT_EQUAL_INT(
+			    irc_subst(expected, sizeof (expected), templates[i], &params),
+			    irc_subst_exec(tpl, buf, sizeof (buf), &params));
+			TEST_ASSERT_EQUAL_STRING(expected, buf);
+		}
+
+		irc_subst_free(tpl);
+	}
+}
+
+static void
+compile_errors(void)
+{
+	struct irc_subst params = {
+		.flags = IRC_SUBST_KEYWORDS
+	};
+	struct irc_subst_template *tpl;
+	char buf[4];
+
+	errno = 0;
+	TEST_ASSERT_NULL(irc_subst_compile("hello #{target!"));
+	TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+
+	errno = 0;
+	TEST_ASSERT_NULL(irc_subst_compile("#{aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa}"));
+	TEST_ASSERT_EQUAL_INT(ENOMEM, errno);
+
+	/* Output too small. */
+	TEST_ASSERT_NOT_NULL((tpl = irc_subst_compile("hello")));
+	TEST_ASSERT_EQUAL_INT(-ENOMEM, irc_subst_exec(tpl, buf, sizeof (buf), &params));
+	TEST_ASSERT_EQUAL_STRING("", buf);
+	irc_subst_free(tpl);
+}
+
 int
 main(void)
 {
@@ -426,12 +643,16 @@ main(void)
 	RUN_TEST(env_enomem);
 	RUN_TEST(shell_simple);
 	RUN_TEST(shell_no_new_line);
+	RUN_TEST(shell_cache);
+	RUN_TEST(shell_cache_refresh);
 	RUN_TEST(shattrs_simple);
 	RUN_TEST(shattrs_enomem);
 	RUN_TEST(shattrs_invalid_color);
 	RUN_TEST(ircattrs_simple);
 	RUN_TEST(ircattrs_enomem);
 	RUN_TEST(ircattrs_invalid_color);
+	RUN_TEST(compile_same);
+	RUN_TEST(compile_errors);
 
 	return UNITY_END();
 }
@@ -0,0 +1,398 @@
+/*
+ * test-transport.c -- test events broadcast and replay
+ *
+ * Copyright (c) 2013-2026 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nce/nce.h>
+
+#include <unity.h>
+
+#include <irccd/event.h>
+#include <irccd/server.h>
+
+#include "irccd/peer.h"
+#include "irccd/transport.h"
+
+#define ORIGIN "jean!jean@localhost"
+
+static struct irc_server *server;
+static char dir[] = "/tmp/irccd-test-XXXXXX";
+static char path[64];
+static int client = -1;
+static char in[65536];
+static size_t in_len;
+static unsigned long long epoch;
+static int step;
+static int ticks;
+static struct ev_timer tick;
+
+static void
+broadcast(const char *channel, int n)
+{
+	char message[16];
+
+	snprintf(message, sizeof (message), "m%d", n);
+	transport_broadcast(&(const struct irc_event) {
+		.type = IRC_EVENT_MESSAGE,
+		.server = server,
+		.message = {
+			.origin = ORIGIN,
+			.channel = (char *)channel,
+			.message = message
+		}
+	});
+}
+
+static void
+start(size_t keep)
+{
+	struct peer_limits limits = {
+		.high = PEER_HIGH,
+		.low = PEER_LOW,
+		.overflow = PEER_OVERFLOW_DROP
+	};
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX
+	};
+
+	TEST_ASSERT_EQUAL_INT(0, transport_start(path, -1, -1, 8, &limits, keep));
+
+	/* Accepted by the transport once the loop runs. */
+	snprintf(sun.sun_path, sizeof (sun.sun_path), "%s", path);
+
+	if ((client = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		TEST_FAIL_MESSAGE(strerror(errno));
+	if (connect(client, (const struct sockaddr *)&sun, sizeof (sun)) < 0)
+		TEST_FAIL_MESSAGE(strerror(errno));
+
+	fcntl(client, F_SETFL, O_NONBLOCK);
+}
+
+static void
+request(const char *line)
+{
+	TEST_ASSERT_EQUAL_INT(strlen(line), write(client, line, strlen(line)));
+}
+
+/*
+ * Read everything available and return the data past the hello line, NULL
+ * until the line ends with the given suffix.
+ */
+static const char *
+wait_for(const char *suffix)
+{
+	const char *data, *tag;
+	ssize_t nr;
+
+	while ((nr = read(client, in + in_len, sizeof (in) - in_len - 1)) > 0)
+		in_len += nr;
+
+	in[in_len] = '\0';
+
+	if (!(data = strchr(in, '\n')))
+		return NULL;
+
+	/* Remember the epoch of the first sequenced event. */
+	if (!epoch && (tag = strstr(in, "@seq=")))
+		epoch = strtoull(tag + 5, NULL, 10);
+
+	if (in_len < strlen(suffix) || strcmp(in + in_len - strlen(suffix), suffix) != 0)
+		return NULL;
+
+	return data + 1;
+}
+
+/*
+ * Line of an event as sent to the client, with or without its sequence number.
+ */
+static const char *
+line(char *buf, size_t bufsz, unsigned long long seq, const char *channel, int n)
+{
+	size_t off = 0;
+
+	if (seq)
+		off = snprintf(buf, bufsz, "@seq=%llu:%llu ", epoch, seq);
+
+	snprintf(buf + off, bufsz - off, "EVENT-MESSAGE test " ORIGIN " %s m%d\n", channel, n);
+
+	return buf;
+}
+
+static void
+run(void (*cb)(struct ev_timer *, int))
+{
+	ev_timer_init(&tick, cb, 0.001, 0.001);
+	ev_timer_start(&tick);
+	nce_sched_run(NULL, 0);
+}
+
+static void
+stop(void)
+{
+	nce_sched_break(NULL, EVBREAK_ALL);
+}
+
+void
+setUp(void)
+{
+	in_len = 0;
+	epoch = 0;
+	step = 0;
+	ticks = 0;
+	server = irc_server_new("test");
+	irc_server_incref(server);
+}
+
+void
+tearDown(void)
+{
+	/* Also stopped there when an assertion leaves the loop. */
+	ev_timer_stop(&tick);
+	transport_stop();
+
+	if (client != -1)
+		close(client);
+
+	client = -1;
+	irc_server_decref(server);
+}
+
+static void
+replay_order_cb(struct ev_timer *, int)
+{
+	char buf[256], expected[1024] = {0};
+	const char *data;
+
+	/* Give up after a second. */
+	if (++ticks == 1000)
+		stop();
+
+	switch (step) {
+	case 0:
+		if (!wait_for("\n"))
+			break;
+
+		request("WATCH since=0 c=#a\n");
+		step++;
+		break;
+	case 1:
+		if (!wait_for(" m5\n"))
+			break;
+
+		/* Live events follow the replayed ones. */
+		broadcast("#a", 6);
+		broadcast("#b", 7);
+		step++;
+		break;
+	case 2:
+		if (!(data = wait_for(" m6\n")))
+			break;
+
+		strcat(expected, "OK\n");
+
+		for (int n = 1; n <= 5; n += 2)
+			strcat(expected, line(buf, sizeof (buf), n, "#a", n));
+
+		/* Live, m7 is filtered out. */
+		strcat(expected, line(buf, sizeof (buf), 6, "#a", 6));
+
+		TEST_ASSERT_EQUAL_STRING(expected, data);
+		step++;
+		stop();
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+replay_order(void)
+{
+	start(65536);
+
+	/* Only the events of #a are replayed, in order. */
+	for (int n = 1; n <= 5; ++n)
+		broadcast(n % 2 ? "#a" : "#b", n);
+
+	run(replay_order_cb);
+
+	TEST_ASSERT_EQUAL_INT(3, step);
+}
+
+static void
+replay_gap_cb(struct ev_timer *, int)
+{
+	char buf[256], req[64];
+	const char *data;
+	unsigned long long gap, next;
+
+	if (++ticks == 1000)
+		stop();
+
+	switch (step) {
+	case 0:
+		if (!wait_for("\n"))
+			break;
+
+		/* Unknown epoch, the daemon restarted since then. */
+		request("WATCH since=1:42\n");
+		step++;
+		break;
+	case 1:
+		if (!(data = wait_for(" m20\n")))
+			break;
+
+		/* The oldest events are gone, the others follow the marker. */
+		TEST_ASSERT_EQUAL_INT(1, sscanf(data, "OK\nEVENT-GAP %llu\n", &gap));
+		TEST_ASSERT_GREATER_THAN_UINT64(0, gap);
+		TEST_ASSERT_LESS_THAN_UINT64(20, gap);
+
+		data = strstr(data, "EVENT-GAP");
+		data = strchr(data, '\n') + 1;
+
+		for (next = gap + 1; next <= 20; ++next) {
+			line(buf, sizeof (buf), next, "#a", next);
+			TEST_ASSERT_EQUAL_STRING_LEN(buf, data, strlen(buf));
+			data += strlen(buf);
+		}
+
+		TEST_ASSERT_EQUAL_STRING("", data);
+
+		/* Up to date, only new events are sent. */
+		snprintf(req, sizeof (req), "WATCH since=%llu:20\n", epoch);
+		request(req);
+		in_len = 0;
+		step++;
+		break;
+	case 2:
+		if (!wait_for("OK\n"))
+			break;
+
+		broadcast("#a", 21);
+		step++;
+		break;
+	case 3:
+		if (!wait_for(" m21\n"))
+			break;
+
+		in[in_len] = '\0';
+		line(buf, sizeof (buf), 21, "#a", 21);
+		TEST_ASSERT_EQUAL_STRING_LEN("OK\n", in, 3);
+		TEST_ASSERT_EQUAL_STRING(buf, in + 3);
+		step++;
+		stop();
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+replay_gap(void)
+{
+	/* Room for a few events only. */
+	start(1024);
+
+	for (int n = 1; n <= 20; ++n)
+		broadcast("#a", n);
+
+	run(replay_gap_cb);
+
+	TEST_ASSERT_EQUAL_INT(4, step);
+}
+
+static void
+watch_untagged_cb(struct ev_timer *, int)
+{
+	char buf[256];
+	const char *data;
+
+	if (++ticks == 1000)
+		stop();
+
+	switch (step) {
+	case 0:
+		if (!wait_for("\n"))
+			break;
+
+		request("WATCH c=#b\n");
+		step++;
+		break;
+	case 1:
+		if (!wait_for("OK\n"))
+			break;
+
+		broadcast("#a", 1);
+		broadcast("#b", 2);
+		step++;
+		break;
+	case 2:
+		if (!(data = wait_for(" m2\n")))
+			break;
+
+		/* Same line as the replay ring, without the sequence number. */
+		TEST_ASSERT_EQUAL_STRING_LEN("OK\n", data, 3);
+		TEST_ASSERT_EQUAL_STRING(line(buf, sizeof (buf), 0, "#b", 2), data + 3);
+		step++;
+		stop();
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+watch_untagged(void)
+{
+	start(65536);
+	run(watch_untagged_cb);
+
+	TEST_ASSERT_EQUAL_INT(3, step);
+}
+
+int
+main(void)
+{
+	int rc;
+
+	if (!mkdtemp(dir))
+		return 1;
+
+	snprintf(path, sizeof (path), "%s/irccd.sock", dir);
+
+	ev_default_loop(0);
+	nce_sched_default_init();
+
+	UNITY_BEGIN();
+
+	RUN_TEST(replay_order);
+	RUN_TEST(replay_gap);
+	RUN_TEST(watch_untagged);
+
+	rc = UNITY_END();
+	rmdir(dir);
+
+	return rc;
+}